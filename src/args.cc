@@ -13,7 +13,9 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
 #include <iostream>
+#include <thread>
 
 namespace fasttext {
 
@@ -30,14 +32,32 @@ Args::Args() {
   loss = loss_name::ns;
   model = model_name::sg;
   bucket = 2000000;
+  bucket_auto = false;
+  bucket_budget_mb = 0;
+  bucket_collision = 0.1;
   minn = 3;
   maxn = 6;
   thread = 12;
+  thread_auto = false;
+  readers = 0;
+  warmup = 64;
+  numa = false;
+  batch = 1;
   lrUpdateRate = 100;
   t = 1e-4;
   label = "__label__";
   verbose = 2;
   pretrainedVectors = "";
+  init_model = "";
+  checkpoint = 0;
+  resume = false;
+  workers = 1;
+  rank = 0;
+  coordinator = "127.0.0.1:7070";
+  syncEvery = 1000000;
+  syncDense = false;
+  outputShards = "";
+  shm = "";
   saveOutput = 0;
 
   qout = false;
@@ -60,6 +80,8 @@ Args::Args() {
   margin = 1.0;
   var_scale = 0.05; // This is the default for 50 dim - find a good value for 300 dim
   multi = true;
+  senses = 2;
+  multi_top = 0;
   expdot = false;
   var = false;
 }
@@ -127,13 +149,37 @@ void Args::parseArgs(int argc, char** argv) {
         exit(EXIT_FAILURE);
       }
     } else if (strcmp(argv[ai], "-bucket") == 0) {
-      bucket = atoi(argv[ai + 1]);
+      if (strcmp(argv[ai + 1], "auto") == 0) {
+        bucket_auto = true;
+      } else {
+        bucket = atoi(argv[ai + 1]);
+      }
+    } else if (strcmp(argv[ai], "-bucket_budget_mb") == 0) {
+      bucket_budget_mb = atoi(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-bucket_collision") == 0) {
+      bucket_collision = atof(argv[ai + 1]);
     } else if (strcmp(argv[ai], "-minn") == 0) {
       minn = atoi(argv[ai + 1]);
     } else if (strcmp(argv[ai], "-maxn") == 0) {
       maxn = atoi(argv[ai + 1]);
     } else if (strcmp(argv[ai], "-thread") == 0) {
-      thread = atoi(argv[ai + 1]);
+      // auto starts a thread per core and keeps the fastest count of them
+      if (strcmp(argv[ai + 1], "auto") == 0) {
+        thread_auto = true;
+        thread = std::max(1u, std::thread::hardware_concurrency());
+      } else {
+        thread = atoi(argv[ai + 1]);
+      }
+    } else if (strcmp(argv[ai], "-cache") == 0) {
+      cache = std::string(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-readers") == 0) {
+      readers = atoi(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-warmup") == 0) {
+      warmup = atoi(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-numa") == 0) {
+      numa = atoi(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-batch") == 0) {
+      batch = atoi(argv[ai + 1]);
     } else if (strcmp(argv[ai], "-t") == 0) {
       t = atof(argv[ai + 1]);
     } else if (strcmp(argv[ai], "-label") == 0) {
@@ -142,6 +188,26 @@ void Args::parseArgs(int argc, char** argv) {
       verbose = atoi(argv[ai + 1]);
     } else if (strcmp(argv[ai], "-pretrainedVectors") == 0) {
       pretrainedVectors = std::string(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-init_model") == 0) {
+      init_model = std::string(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-checkpoint") == 0) {
+      checkpoint = atof(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-resume") == 0) {
+      resume = true; ai--;
+    } else if (strcmp(argv[ai], "-workers") == 0) {
+      workers = atoi(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-rank") == 0) {
+      rank = atoi(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-coordinator") == 0) {
+      coordinator = std::string(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-syncEvery") == 0) {
+      syncEvery = atoi(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-syncDense") == 0) {
+      syncDense = true; ai--;
+    } else if (strcmp(argv[ai], "-outputShards") == 0) {
+      outputShards = std::string(argv[ai + 1]);
+    } else if (strcmp(argv[ai], "-shm") == 0) {
+      shm = std::string(argv[ai + 1]);
     } else if (strcmp(argv[ai], "-saveOutput") == 0) {
       saveOutput = atoi(argv[ai + 1]);
     } else if (strcmp(argv[ai], "-qnorm") == 0) {
@@ -184,6 +250,12 @@ void Args::parseArgs(int argc, char** argv) {
     } else if (strcmp(argv[ai], "-multi") == 0) {
       multi = atoi(argv[ai + 1]); // 0 for false and else for true
       std::cerr << "Multi" << multi << std::endl;
+    } else if (strcmp(argv[ai], "-senses") == 0) {
+      senses = atoi(argv[ai + 1]);
+      std::cerr << "Senses" << senses << std::endl;
+    } else if (strcmp(argv[ai], "-multi_top") == 0) {
+      multi_top = atoi(argv[ai + 1]); // 0 for all words
+      std::cerr << "Multi top" << multi_top << std::endl;
     } else if (strcmp(argv[ai], "-var_scale") == 0) {
       var_scale = atof(argv[ai + 1]); // 0 for false and else for true
       std::cerr << "var scale" << var_scale << std::endl;
@@ -213,6 +285,54 @@ void Args::parseArgs(int argc, char** argv) {
     printHelp();
     exit(EXIT_FAILURE);
   }
+  if (checkpoint < 0) {
+    std::cerr << "-checkpoint must not be negative." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (workers < 1 || rank < 0 || rank >= workers) {
+    std::cerr << "-rank must be in [0, -workers)." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (syncEvery < 1) {
+    std::cerr << "-syncEvery must be at least 1." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (!outputShards.empty() &&
+      (workers < 2 ||
+       std::count(outputShards.begin(), outputShards.end(), ',') !=
+           workers - 1)) {
+    std::cerr << "-outputShards needs one host:port per worker." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (!shm.empty() && !outputShards.empty()) {
+    std::cerr << "-shm and -outputShards cannot be used together."
+              << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (readers < 0) {
+    std::cerr << "-readers must not be negative." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (warmup < 1) {
+    std::cerr << "-warmup must be at least 1." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (batch < 1) {
+    std::cerr << "-batch must be at least 1." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (senses < 1 || senses > 4) {
+    std::cerr << "-senses must be between 1 and 4." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (!multi) {
+    senses = 1;
+  }
+  multi = senses > 1;
+  if (bucket_collision <= 0.0 || bucket_collision >= 1.0) {
+    std::cerr << "-bucket_collision must be in (0, 1)." << std::endl;
+    exit(EXIT_FAILURE);
+  }
   if (wordNgrams <= 1 && maxn == 0) {
     bucket = 0;
   }
@@ -224,7 +344,7 @@ void Args::printHelp() {
   if (loss == loss_name::softmax) lname = "softmax";
   std::cerr
     << "\nThe following arguments are mandatory:\n"
-    << "  -input              training file path\n"
+    << "  -input              training file, directory, glob, @list of files or - for stdin\n"
     << "  -output             output file path\n"
     << "\nThe following arguments are optional:\n"
     << "  -verbose            verbosity level [" << verbose << "]\n"
@@ -232,7 +352,9 @@ void Args::printHelp() {
     << "  -minCount           minimal number of word occurences [" << minCount << "]\n"
     << "  -minCountLabel      minimal number of label occurences [" << minCountLabel << "]\n"
     << "  -wordNgrams         max length of word ngram [" << wordNgrams << "]\n"
-    << "  -bucket             number of buckets [" << bucket << "]\n"
+    << "  -bucket             number of buckets, or auto [" << bucket << "]\n"
+    << "  -bucket_collision   target char ngram collision rate for -bucket auto [" << bucket_collision << "]\n"
+    << "  -bucket_budget_mb   cap on the input matrix size in MB, 0 for none [" << bucket_budget_mb << "]\n"
     << "  -minn               min length of char ngram [" << minn << "]\n"
     << "  -maxn               max length of char ngram [" << maxn << "]\n"
     << "  -t                  sampling threshold [" << t << "]\n"
@@ -245,9 +367,27 @@ void Args::printHelp() {
     << "  -epoch              number of epochs [" << epoch << "]\n"
     << "  -neg                number of negatives sampled [" << neg << "]\n"
     << "  -loss               loss function {ns, hs, softmax} [ns]\n"
-    << "  -thread             number of threads [" << thread << "]\n"
+    << "  -thread             number of threads, or auto [" << thread << "]\n"
+    << "  -cache              binary id cache of the input, written when missing or stale [" << cache << "]\n"
+    << "  -readers            tokenizer threads feeding the training threads, 0 to tokenize in place [" << readers << "]\n"
+    << "  -warmup             MB of stdin read for the first vocabulary with -input - [" << warmup << "]\n"
+    << "  -numa               pin threads and interleave parameters across NUMA nodes [" << numa << "]\n"
+    << "  -batch              supervised softmax examples per update [" << batch << "]\n"
     << "  -pretrainedVectors  pretrained word vectors for supervised learning ["<< pretrainedVectors <<"]\n"
+    << "  -init_model         model .bin to continue training from on the new input [" << init_model << "]\n"
+    << "  -checkpoint         minutes between checkpoints to <output>.ckpt, 0 for none [" << checkpoint << "]\n"
+    << "  -resume             continue from <output>.ckpt when there is one [" << resume << "]\n"
+    << "  -workers            processes training on shards of the input, see the coordinator command [" << workers << "]\n"
+    << "  -rank               shard of this process, 0 to -workers - 1; rank 0 writes the output [" << rank << "]\n"
+    << "  -coordinator        host:port of the coordinator averaging the workers [" << coordinator << "]\n"
+    << "  -syncEvery          tokens trained by a worker between two averaging rounds [" << syncEvery << "]\n"
+    << "  -syncDense          send every row at each round instead of the rows written since, the coordinator then sums whole matrices [" << syncDense << "]\n"
+    << "  -outputShards       host:port of every worker, each keeping a slice of the output rows [" << outputShards << "]\n"
+    << "  -shm                shared memory segment the -workers of one host train in, instead of averaging [" << shm << "]\n"
     << "  -saveOutput         whether output params should be saved [" << saveOutput << "]\n"
+    << "  -multi              whether words get several Gaussian components [" << multi << "]\n"
+    << "  -senses             number of Gaussian components per word, 1 to 4 [" << senses << "]\n"
+    << "  -multi_top          only the N most frequent words get the extra components, 0 for all [" << multi_top << "]\n"
     << "\nThe following arguments for quantization are optional:\n"
     << "  -cutoff             number of words and ngrams to retain [" << cutoff << "]\n"
     << "  -retrain            finetune embeddings if a cutoff is applied [" << retrain << "]\n"
@@ -26,6 +26,7 @@ class Args {
     std::string input;
     std::string test;
     std::string output;
+    std::string cache;
     real diversity_weight;
     double lr;
     int lrUpdateRate;
@@ -39,13 +40,31 @@ class Args {
     loss_name loss;
     model_name model;
     int bucket;
+    bool bucket_auto;
+    int bucket_budget_mb;
+    double bucket_collision;
     int minn;
     int maxn;
     int thread;
+    bool thread_auto;
+    int readers;
+    int warmup;
+    bool numa;
+    int batch;
     double t;
     std::string label;
     int verbose;
     std::string pretrainedVectors;
+    std::string init_model;
+    double checkpoint;
+    bool resume;
+    int workers;
+    int rank;
+    std::string coordinator;
+    int syncEvery;
+    bool syncDense;
+    std::string outputShards;
+    std::string shm;
     int saveOutput;
 
     bool qout;
@@ -73,6 +92,8 @@ class Args {
     float margin;
     float var_scale;
     bool multi;
+    int senses;
+    int multi_top;
     bool expdot;
     bool var;
 };
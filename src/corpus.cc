@@ -0,0 +1,730 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ *               2018-present, Ben Athiwaratkun
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "corpus.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+
+#ifdef FASTTEXT_ZLIB
+#include <zlib.h>
+#endif
+#ifdef FASTTEXT_ZSTD
+#include <zstd.h>
+#endif
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+namespace fasttext {
+
+// Size of the text blocks of the vocabulary pass and the id cache encoder.
+static const int64_t kStreamBlockBytes = 8 << 20;
+
+// textBytes holds the size of the text of every file, which for the
+// compressed ones is only known once the vocabulary pass has read them.
+ChunkScheduler::ChunkScheduler(const std::vector<std::string>& files,
+                               const std::vector<int64_t>& textBytes,
+                               int32_t threads, int32_t epochs,
+                               int64_t chunkBytes)
+  : paths_(files), totalBytes_(0), threads_(threads), epochs_(epochs),
+    nodes_(threads, 0), epoch_(threads, 0), current_(threads, -1), doneBytes_(0), held_(threads),
+    shardRank_(0), shardCount_(1), decodersLeft_(0), decodersDone_(true),
+    blockMark_(files.size(), 0), blockDone_(files.size()) {
+  for (int32_t f = 0; f < files.size(); f++) {
+    if (CompressedFile::format(files[f]) != CompressedFile::PLAIN) {
+      files_.push_back(nullptr);
+      streams_.push_back(f);
+    } else {
+      files_.push_back(std::unique_ptr<MappedFile>(new MappedFile(files[f])));
+    }
+    totalBytes_ += textBytes[f];
+  }
+  if (chunkBytes <= 0) {
+    chunkBytes = chunkSize(totalBytes_, threads_);
+  }
+  chunkBytes_ = chunkBytes;
+  for (int32_t f = 0; f < files_.size(); f++) {
+    if (files_[f]) split(f, chunkBytes);
+  }
+  deal();
+  if (!streams_.empty()) {
+    blocks_.reset(new MpmcQueue<std::unique_ptr<Block>>(2 * threads_));
+    decodersLeft_ = streams_.size();
+    decodersDone_ = false;
+  }
+}
+
+ChunkScheduler::ChunkScheduler(const std::vector<Chunk>& chunks,
+                               int64_t totalBytes, int32_t threads,
+                               int32_t epochs)
+  : chunks_(chunks), totalBytes_(totalBytes), threads_(threads),
+    epochs_(epochs), nodes_(threads, 0), epoch_(threads, 0), current_(threads, -1),
+    doneBytes_(0), held_(threads), chunkBytes_(0), shardRank_(0),
+    shardCount_(1), decodersLeft_(0), decodersDone_(true) {
+  deal();
+}
+
+ChunkScheduler::~ChunkScheduler() {
+  for (auto it = decoders_.begin(); it != decoders_.end(); ++it) {
+    it->join();
+  }
+}
+
+// The decoders start with the first request, after a restore() has set
+// the blocks they skip.
+void ChunkScheduler::start() {
+  for (auto it = streams_.cbegin(); it != streams_.cend(); ++it) {
+    int32_t f = *it;
+    decoders_.push_back(std::thread([=]() { decode(f); }));
+  }
+}
+
+void ChunkScheduler::decode(int32_t file) {
+  int64_t seq = 0;
+  for (int32_t e = 0; e < epochs_; e++) {
+    CompressedFile in(paths_[file]);
+    std::unique_ptr<Block> block(new Block());
+    for (int64_t b = 0; in.read(block->text, chunkBytes_); b++) {
+      if (b % shardCount_ != shardRank_) {
+        continue;
+      }
+      if (seq < blockMark_[file]) {
+        seq++;
+        continue;
+      }
+      block->file = file;
+      block->seq = seq++;
+      blocks_->push(block);
+      block.reset(new Block());
+    }
+  }
+  if (--decodersLeft_ == 0) {
+    decodersDone_ = true;
+  }
+}
+
+// Aims for a few dozen chunks per thread so stealing can even out the tail.
+int64_t ChunkScheduler::chunkSize(int64_t totalBytes, int32_t threads) {
+  int64_t chunkBytes = totalBytes / (int64_t(threads) * 32);
+  chunkBytes = std::max<int64_t>(chunkBytes, 64 << 10);
+  return std::min<int64_t>(chunkBytes, 8 << 20);
+}
+
+void ChunkScheduler::deal() {
+  int64_t n = chunks_.size();
+  if (!done_) {
+    done_.reset(new std::atomic<bool>[epochs_ * n]);
+    for (int64_t i = 0; i < epochs_ * n; i++) {
+      done_[i] = false;
+    }
+  }
+  // the nodes that have threads, each with the next contiguous shard
+  std::vector<int32_t> used(nodes_);
+  std::sort(used.begin(), used.end());
+  used.erase(std::unique(used.begin(), used.end()), used.end());
+  int64_t g = used.size();
+  std::vector<std::vector<int32_t>> members(g);
+  for (int32_t t = 0; t < threads_; t++) {
+    int64_t j = std::lower_bound(used.begin(), used.end(), nodes_[t]) -
+                used.begin();
+    members[j].push_back(t);
+  }
+  order_.clear();
+  epochBegin_.assign(1, 0);
+  heads_.reset(new std::atomic<int64_t>[int64_t(epochs_) * threads_]);
+  ends_.assign(int64_t(epochs_) * threads_, 0);
+  for (int32_t e = 0; e < epochs_; e++) {
+    std::minstd_rand rng(e + 1);
+    for (int64_t j = 0; j < g; j++) {
+      std::vector<int32_t> perm;
+      for (int64_t i = j * n / g; i < (j + 1) * n / g; i++) {
+        perm.push_back(i);
+      }
+      std::shuffle(perm.begin(), perm.end(), rng);
+      int64_t begin = order_.size();
+      for (size_t i = 0; i < perm.size(); i++) {
+        if (!done_[e * n + perm[i]]) order_.push_back(perm[i]);
+      }
+      int64_t size = order_.size() - begin;
+      int64_t m = members[j].size();
+      for (int64_t r = 0; r < m; r++) {
+        int64_t slot = int64_t(e) * threads_ + members[j][r];
+        heads_[slot] = begin + r * size / m;
+        ends_[slot] = begin + (r + 1) * size / m;
+      }
+    }
+    epochBegin_.push_back(order_.size());
+  }
+  victims_.assign(threads_, std::vector<int32_t>());
+  for (int32_t t = 0; t < threads_; t++) {
+    victims_[t].push_back(t);
+    for (int32_t k = 1; k < threads_; k++) {
+      int32_t v = (t + k) % threads_;
+      if (nodes_[v] == nodes_[t]) victims_[t].push_back(v);
+    }
+    for (int32_t k = 1; k < threads_; k++) {
+      int32_t v = (t + k) % threads_;
+      if (nodes_[v] != nodes_[t]) victims_[t].push_back(v);
+    }
+  }
+}
+
+void ChunkScheduler::split(int32_t file, int64_t chunkBytes) {
+  std::vector<Chunk> chunks =
+      splitText(files_[file]->data(), files_[file]->size(), chunkBytes);
+  for (auto it = chunks.begin(); it != chunks.end(); ++it) {
+    it->file = file;
+    chunks_.push_back(*it);
+  }
+}
+
+// Cuts text every chunkBytes, moving each cut just past the next newline.
+std::vector<Chunk> ChunkScheduler::splitText(const char* data, int64_t size,
+                                             int64_t chunkBytes) {
+  std::vector<Chunk> chunks;
+  int64_t begin = 0;
+  while (begin < size) {
+    int64_t end = size;
+    if (begin + chunkBytes < size) {
+      const void* nl = std::memchr(data + begin + chunkBytes, '\n',
+                                   size - begin - chunkBytes);
+      end = nl ? static_cast<const char*>(nl) - data + 1 : size;
+    }
+    Chunk chunk;
+    chunk.file = 0;
+    chunk.begin = begin;
+    chunk.end = end;
+    chunk.text = data + begin;
+    chunks.push_back(chunk);
+    begin = end;
+  }
+  return chunks;
+}
+
+// Keeps chunk and decoded block i when i % count == rank, so that the
+// processes of a -workers run split the input between them. Must come
+// before restore() and the first next().
+void ChunkScheduler::shard(int32_t rank, int32_t count) {
+  shardRank_ = rank;
+  shardCount_ = count;
+  std::vector<Chunk> kept;
+  int64_t chunkBytes = 0;
+  int64_t keptBytes = 0;
+  for (size_t i = 0; i < chunks_.size(); i++) {
+    chunkBytes += chunks_[i].end - chunks_[i].begin;
+    if (i % count == rank) {
+      keptBytes += chunks_[i].end - chunks_[i].begin;
+      kept.push_back(chunks_[i]);
+    }
+  }
+  // the compressed files are only known by their total text size
+  totalBytes_ = keptBytes + (totalBytes_ - chunkBytes) / count;
+  chunks_.swap(kept);
+  done_.reset();
+  deal();
+}
+
+// The node of each thread. Must come before the first next().
+void ChunkScheduler::setNodes(const std::vector<int32_t>& nodes) {
+  nodes_ = nodes;
+  deal();
+}
+
+// Decoded blocks are taken as soon as they are ready, so that the
+// decoders are never stalled behind the mapped chunks.
+bool ChunkScheduler::next(int32_t threadId, Chunk& chunk) {
+  release(threadId);
+  if (!blocks_) {
+    return nextChunk(threadId, chunk);
+  }
+  std::call_once(started_, [this]() { start(); });
+  std::unique_ptr<Block> block;
+  if (blocks_->tryPop(block)) {
+    hold(threadId, block, chunk);
+    return true;
+  }
+  if (nextChunk(threadId, chunk)) {
+    return true;
+  }
+  if (blocks_->pop(block, decodersDone_)) {
+    hold(threadId, block, chunk);
+    return true;
+  }
+  return false;
+}
+
+void ChunkScheduler::hold(int32_t threadId,
+                          std::unique_ptr<Block>& block, Chunk& chunk) {
+  chunk.file = -1;
+  chunk.begin = 0;
+  chunk.end = block->text.size();
+  chunk.text = block->text.data();
+  held_[threadId] = std::move(block);
+}
+
+// Marks the chunk or block the thread was reading as done.
+void ChunkScheduler::release(int32_t threadId) {
+  if (current_[threadId] >= 0) {
+    done_[current_[threadId]] = true;
+    current_[threadId] = -1;
+  }
+  if (held_[threadId]) {
+    std::lock_guard<std::mutex> lock(blockMutex_);
+    int32_t f = held_[threadId]->file;
+    std::set<int64_t>& done = blockDone_[f];
+    done.insert(held_[threadId]->seq);
+    while (!done.empty() && *done.begin() == blockMark_[f]) {
+      done.erase(done.begin());
+      blockMark_[f]++;
+    }
+    held_[threadId].reset();
+  }
+}
+
+bool ChunkScheduler::nextChunk(int32_t threadId, Chunk& chunk) {
+  while (epoch_[threadId] < epochs_) {
+    int32_t e = epoch_[threadId];
+    // own slice first, then steal from the other threads of this epoch
+    const std::vector<int32_t>& victims = victims_[threadId];
+    for (size_t k = 0; k < victims.size(); k++) {
+      int64_t slot = int64_t(e) * threads_ + victims[k];
+      std::atomic<int64_t>& head = heads_[slot];
+      int64_t end = ends_[slot];
+      if (head.load() >= end) continue;
+      int64_t i = head++;
+      if (i < end) {
+        chunk = chunks_[order_[i]];
+        current_[threadId] = e * int64_t(chunks_.size()) + order_[i];
+        return true;
+      }
+    }
+    epoch_[threadId]++;
+  }
+  return false;
+}
+
+const char* ChunkScheduler::data(const Chunk& chunk) const {
+  if (chunk.text != nullptr) {
+    return chunk.text;
+  }
+  return files_[chunk.file]->data() + chunk.begin;
+}
+
+// Blocks done past the first one still pending are decoded again on resume.
+void ChunkScheduler::save(std::ostream& out) {
+  int64_t n = chunks_.size();
+  out.write((char*) &n, sizeof(int64_t));
+  out.write((char*) &epochs_, sizeof(int32_t));
+  std::vector<char> done(epochs_ * n);
+  for (int64_t i = 0; i < epochs_ * n; i++) {
+    done[i] = done_[i];
+  }
+  out.write(done.data(), done.size());
+  int64_t bytes = doneBytes_;
+  out.write((char*) &bytes, sizeof(int64_t));
+  std::lock_guard<std::mutex> lock(blockMutex_);
+  int32_t nfiles = blockMark_.size();
+  out.write((char*) &nfiles, sizeof(int32_t));
+  out.write((char*) blockMark_.data(), nfiles * sizeof(int64_t));
+}
+
+// Must come before the first next().
+void ChunkScheduler::restore(std::istream& in) {
+  int64_t n;
+  int32_t epochs;
+  in.read((char*) &n, sizeof(int64_t));
+  in.read((char*) &epochs, sizeof(int32_t));
+  if (n != chunks_.size() || epochs != epochs_) {
+    std::cerr << "The checkpoint was cut into other chunks, resume with the "
+              << "same -thread and -epoch." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  std::vector<char> done(epochs_ * n);
+  in.read(done.data(), done.size());
+  for (int64_t i = 0; i < epochs_ * n; i++) {
+    done_[i] = done[i];
+  }
+  int64_t bytes;
+  in.read((char*) &bytes, sizeof(int64_t));
+  doneBytes_ = bytes;
+  int32_t nfiles;
+  in.read((char*) &nfiles, sizeof(int32_t));
+  if (nfiles != blockMark_.size()) {
+    std::cerr << "The checkpoint was written for other input files."
+              << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  in.read((char*) blockMark_.data(), nfiles * sizeof(int64_t));
+  deal();
+}
+
+void ChunkScheduler::addDone(int64_t bytes) {
+  doneBytes_ += bytes;
+}
+
+real ChunkScheduler::progress() const {
+  if (totalBytes_ == 0) return 1.0;
+  real p = real(doneBytes_) / (real(totalBytes_) * epochs_);
+  return std::min(p, real(1.0));
+}
+
+int64_t ChunkScheduler::totalBytes() const {
+  return totalBytes_;
+}
+
+int32_t ChunkScheduler::nchunks() const {
+  return chunks_.size();
+}
+
+MappedFile::MappedFile(const std::string& path)
+  : data_(nullptr), size_(0), map_(nullptr) {
+#ifndef _WIN32
+  int fd = ::open(path.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd >= 0 && fstat(fd, &st) == 0) {
+    size_ = st.st_size;
+    if (size_ > 0) {
+      void* p = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED) {
+        map_ = p;
+        data_ = static_cast<const char*>(p);
+        madvise(p, size_, MADV_SEQUENTIAL);
+      }
+    }
+  }
+  if (fd >= 0) {
+    ::close(fd);
+  }
+#endif
+  if (map_ == nullptr) {
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs.is_open()) {
+      std::cerr << "File cannot be opened: " << path << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    copy_.assign(std::istreambuf_iterator<char>(ifs),
+                 std::istreambuf_iterator<char>());
+    data_ = copy_.data();
+    size_ = copy_.size();
+  }
+}
+
+MappedFile::~MappedFile() {
+#ifndef _WIN32
+  if (map_ != nullptr) {
+    munmap(map_, size_);
+  }
+#endif
+}
+
+const char* MappedFile::data() const {
+  return data_;
+}
+
+int64_t MappedFile::size() const {
+  return size_;
+}
+
+CompressedFile::CompressedFile(const std::string& path)
+  : in_(path, std::ifstream::binary), format_(format(path)), stream_(nullptr),
+    inbuf_(1 << 20), inPos_(0), inSize_(0), frameEnd_(true), done_(false),
+    path_(path) {
+  if (!in_.is_open()) {
+    std::cerr << "Input file cannot be opened!" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+#ifdef FASTTEXT_ZLIB
+  if (format_ == GZIP) {
+    z_stream* z = new z_stream();
+    // 16 + MAX_WBITS: expect a gzip header and trailer
+    if (inflateInit2(z, 16 + MAX_WBITS) != Z_OK) {
+      std::cerr << "zlib cannot be initialized." << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    stream_ = z;
+  }
+#endif
+#ifdef FASTTEXT_ZSTD
+  if (format_ == ZSTD) {
+    ZSTD_DStream* z = ZSTD_createDStream();
+    ZSTD_initDStream(z);
+    stream_ = z;
+  }
+#endif
+  if (stream_ == nullptr) {
+    std::cerr << path << " is " << (format_ == GZIP ? "gzip" : "zstd")
+              << " compressed but this build cannot read it, rebuild with "
+              << (format_ == GZIP ? "ZLIB=1" : "ZSTD=1") << "." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+}
+
+CompressedFile::~CompressedFile() {
+#ifdef FASTTEXT_ZLIB
+  if (format_ == GZIP) {
+    z_stream* z = static_cast<z_stream*>(stream_);
+    inflateEnd(z);
+    delete z;
+  }
+#endif
+#ifdef FASTTEXT_ZSTD
+  if (format_ == ZSTD) {
+    ZSTD_freeDStream(static_cast<ZSTD_DStream*>(stream_));
+  }
+#endif
+}
+
+int32_t CompressedFile::format(const std::string& path) {
+  std::ifstream ifs(path, std::ifstream::binary);
+  unsigned char magic[4] = {0, 0, 0, 0};
+  ifs.read((char*) magic, 4);
+  if (magic[0] == 0x1f && magic[1] == 0x8b) {
+    return GZIP;
+  }
+  if (magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f &&
+      magic[3] == 0xfd) {
+    return ZSTD;
+  }
+  return PLAIN;
+}
+
+// Appends the output of one decompression step to out.
+void CompressedFile::decode(std::string& out) {
+  const size_t step = 1 << 18;
+  if (inPos_ == inSize_) {
+    in_.read(inbuf_.data(), inbuf_.size());
+    inSize_ = in_.gcount();
+    inPos_ = 0;
+    if (inSize_ == 0) {
+      if (!frameEnd_) {
+        std::cerr << path_ << " is truncated." << std::endl;
+        exit(EXIT_FAILURE);
+      }
+      done_ = true;
+      return;
+    }
+  }
+  size_t old = out.size();
+  size_t produced = 0;
+  bool ok = false;
+  out.resize(old + step);
+#ifdef FASTTEXT_ZLIB
+  if (format_ == GZIP) {
+    z_stream* z = static_cast<z_stream*>(stream_);
+    z->next_in = reinterpret_cast<Bytef*>(&inbuf_[inPos_]);
+    z->avail_in = inSize_ - inPos_;
+    z->next_out = reinterpret_cast<Bytef*>(&out[old]);
+    z->avail_out = step;
+    int ret = inflate(z, Z_NO_FLUSH);
+    ok = ret == Z_OK || ret == Z_STREAM_END;
+    inPos_ = inSize_ - z->avail_in;
+    produced = step - z->avail_out;
+    frameEnd_ = ret == Z_STREAM_END;
+    // the next gzip member, if any, starts right after this one
+    if (frameEnd_) {
+      inflateReset(z);
+    }
+  }
+#endif
+#ifdef FASTTEXT_ZSTD
+  if (format_ == ZSTD) {
+    ZSTD_inBuffer zin = {inbuf_.data(), inSize_, inPos_};
+    ZSTD_outBuffer zout = {&out[old], step, 0};
+    size_t ret = ZSTD_decompressStream(static_cast<ZSTD_DStream*>(stream_),
+                                       &zout, &zin);
+    ok = !ZSTD_isError(ret);
+    inPos_ = zin.pos;
+    produced = zout.pos;
+    frameEnd_ = ret == 0;
+  }
+#endif
+  if (!ok) {
+    std::cerr << path_ << " is corrupt." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  out.resize(old + produced);
+}
+
+// Returns at least `bytes` of text when there is that much left, cut
+// after the last newline; the rest of the line opens the next block.
+bool CompressedFile::read(std::string& block, int64_t bytes) {
+  block.swap(carry_);
+  carry_.clear();
+  while (!done_) {
+    if (block.size() >= bytes) {
+      size_t nl = block.rfind('\n');
+      if (nl != std::string::npos) {
+        carry_.assign(block, nl + 1, std::string::npos);
+        block.resize(nl + 1);
+        break;
+      }
+    }
+    decode(block);
+  }
+  return !block.empty();
+}
+
+// Compressed files are decoded on a separate thread while fn runs.
+int64_t readBlocks(const std::string& path,
+                   std::function<void(const char*, const char*)> fn) {
+  if (CompressedFile::format(path) == CompressedFile::PLAIN) {
+    MappedFile text(path);
+    fn(text.data(), text.data() + text.size());
+    return text.size();
+  }
+  MpmcQueue<std::unique_ptr<std::string>> queue(4);
+  std::atomic<bool> closed(false);
+  std::thread decoder([&]() {
+    CompressedFile in(path);
+    std::unique_ptr<std::string> block(new std::string());
+    while (in.read(*block, kStreamBlockBytes)) {
+      queue.push(block);
+      block.reset(new std::string());
+    }
+    closed = true;
+  });
+  std::unique_ptr<std::string> block;
+  int64_t bytes = 0;
+  while (queue.pop(block, closed)) {
+    fn(block->data(), block->data() + block->size());
+    bytes += block->size();
+  }
+  decoder.join();
+  return bytes;
+}
+
+IdCache::IdCache(const std::string& path) : file_(new MappedFile(path)) {
+  if (file_->size() < HEADER_SIZE ||
+      *reinterpret_cast<const int32_t*>(file_->data()) != MAGIC) {
+    std::cerr << path << " is not an id cache." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+}
+
+void IdCache::write(const std::string& path,
+                    const std::vector<std::string>& inputs,
+                    const Dictionary& dict) {
+  std::ofstream ofs(path, std::ofstream::binary);
+  if (!ofs.is_open()) {
+    std::cerr << "Id cache " << path << " cannot be written." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  int32_t magic = MAGIC, version = 1;
+  uint64_t fingerprint = dict.fingerprint();
+  int64_t ncodes = 0;
+  ofs.write((char*) &magic, sizeof(int32_t));
+  ofs.write((char*) &version, sizeof(int32_t));
+  ofs.write((char*) &fingerprint, sizeof(uint64_t));
+  ofs.write((char*) &ncodes, sizeof(int64_t));
+  for (auto it = inputs.cbegin(); it != inputs.cend(); ++it) {
+    readBlocks(*it, [&](const char* begin, const char* end) {
+      ncodes += dict.encode(begin, end, ofs);
+    });
+  }
+  ofs.seekp(HEADER_SIZE - sizeof(int64_t));
+  ofs.write((char*) &ncodes, sizeof(int64_t));
+}
+
+bool IdCache::matches(const std::string& path, uint64_t fingerprint) {
+  std::ifstream ifs(path, std::ifstream::binary);
+  int32_t magic = 0, version = 0;
+  uint64_t stored = 0;
+  ifs.read((char*) &magic, sizeof(int32_t));
+  ifs.read((char*) &version, sizeof(int32_t));
+  ifs.read((char*) &stored, sizeof(uint64_t));
+  return ifs.good() && magic == MAGIC && version == 1 && stored == fingerprint;
+}
+
+const int32_t* IdCache::codes() const {
+  return reinterpret_cast<const int32_t*>(file_->data() + HEADER_SIZE);
+}
+
+int64_t IdCache::bytes() const {
+  return file_->size() - HEADER_SIZE;
+}
+
+// Cuts after the first end of sentence past every chunkBytes. The codes
+// are walked in order so that the hash after an unknown word is skipped.
+std::vector<Chunk> IdCache::split(int32_t eos, int64_t chunkBytes) const {
+  std::vector<Chunk> chunks;
+  const int32_t* codes = this->codes();
+  int64_t n = bytes() / sizeof(int32_t);
+  int64_t step = std::max<int64_t>(chunkBytes / sizeof(int32_t), 1);
+  Chunk chunk;
+  chunk.file = 0;
+  chunk.begin = 0;
+  for (int64_t i = 0; i < n; i++) {
+    if (codes[i] == Dictionary::ID_OOV_WORD) {
+      i++;
+    } else if (codes[i] == eos && i + 1 - chunk.begin / 4 >= step) {
+      chunk.end = (i + 1) * sizeof(int32_t);
+      chunks.push_back(chunk);
+      chunk.begin = chunk.end;
+    }
+  }
+  if (chunk.begin < n * int64_t(sizeof(int32_t))) {
+    chunk.end = n * sizeof(int32_t);
+    chunks.push_back(chunk);
+  }
+  return chunks;
+}
+
+ChunkReader::ChunkReader(std::shared_ptr<Dictionary> dict,
+                         const ChunkScheduler& chunks, const IdCache* cache,
+                         std::unordered_map<std::string, int64_t>* oov)
+  : dict_(dict), chunks_(chunks), cache_(cache), oov_(oov), text_(nullptr),
+    begin_(nullptr), ptr_(nullptr), end_(nullptr), size_(0) {}
+
+void ChunkReader::open(const Chunk& chunk) {
+  size_ = chunk.end - chunk.begin;
+  if (cache_ != nullptr) {
+    begin_ = cache_->codes() + chunk.begin / sizeof(int32_t);
+    ptr_ = begin_;
+    end_ = cache_->codes() + chunk.end / sizeof(int32_t);
+    return;
+  }
+  text_ = chunks_.data(chunk);
+  scanner_.reset(text_, text_ + size_);
+}
+
+bool ChunkReader::next(std::vector<int32_t>& words,
+                       std::vector<int32_t>& labels,
+                       std::minstd_rand& rng, int32_t& ntokens) {
+  if (cache_ != nullptr) {
+    if (ptr_ >= end_) return false;
+    ntokens = dict_->getLine(ptr_, end_, words, labels, rng);
+    return true;
+  }
+  if (scanner_.done()) return false;
+  ntokens = dict_->getLine(scanner_, words, labels, rng, oov_);
+  return true;
+}
+
+int64_t ChunkReader::position() {
+  if (cache_ != nullptr) {
+    return (ptr_ - begin_) * sizeof(int32_t);
+  }
+  return scanner_.position() - text_;
+}
+
+int64_t ChunkReader::size() const {
+  return size_;
+}
+
+}
@@ -0,0 +1,364 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ *               2018-present, Ben Athiwaratkun
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#ifndef FASTTEXT_CORPUS_H
+#define FASTTEXT_CORPUS_H
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "dictionary.h"
+#include "real.h"
+
+namespace fasttext {
+
+// A newline-aligned byte range [begin, end) of one input file. Blocks
+// decompressed from a stream carry their own text.
+struct Chunk {
+  int32_t file;
+  int64_t begin;
+  int64_t end;
+  const char* text = nullptr;
+};
+
+// Lines tokenized by a reader thread, stored back to back.
+struct LineBatch {
+  std::vector<int32_t> words;
+  std::vector<int32_t> wordEnds;
+  std::vector<int32_t> labels;
+  std::vector<int32_t> labelEnds;
+  int64_t tokens = 0;
+  int64_t bytes = 0;
+
+  int32_t size() const {
+    return wordEnds.size();
+  }
+};
+
+// Bounded lock-free multi-producer multi-consumer ring (Vyukov). Each cell
+// carries a sequence number telling producers and consumers whose turn it
+// is. push() and pop() spin with yield when the ring is full or empty and
+// keep the wait and occupancy counters reported after training.
+template <typename T>
+class MpmcQueue {
+  private:
+    struct Cell {
+      std::atomic<size_t> seq;
+      T value;
+    };
+
+    std::unique_ptr<Cell[]> cells_;
+    size_t mask_;
+    std::atomic<size_t> tail_;
+    std::atomic<size_t> head_;
+
+  public:
+    std::atomic<int64_t> pushWaits;
+    std::atomic<int64_t> popWaits;
+    std::atomic<int64_t> occupancySum;
+    std::atomic<int64_t> pops;
+
+    explicit MpmcQueue(size_t capacity)
+      : tail_(0), head_(0), pushWaits(0), popWaits(0), occupancySum(0),
+        pops(0) {
+      size_t n = 1;
+      while (n < capacity) n <<= 1;
+      cells_.reset(new Cell[n]);
+      mask_ = n - 1;
+      for (size_t i = 0; i < n; i++) {
+        cells_[i].seq.store(i, std::memory_order_relaxed);
+      }
+    }
+
+    size_t capacity() const {
+      return mask_ + 1;
+    }
+
+    size_t size() const {
+      size_t tail = tail_.load(std::memory_order_relaxed);
+      size_t head = head_.load(std::memory_order_relaxed);
+      return tail > head ? tail - head : 0;
+    }
+
+    bool tryPush(T& value) {
+      size_t pos = tail_.load(std::memory_order_relaxed);
+      for (;;) {
+        Cell& cell = cells_[pos & mask_];
+        size_t seq = cell.seq.load(std::memory_order_acquire);
+        intptr_t dif = intptr_t(seq) - intptr_t(pos);
+        if (dif == 0) {
+          if (tail_.compare_exchange_weak(pos, pos + 1,
+                                          std::memory_order_relaxed)) {
+            cell.value = std::move(value);
+            cell.seq.store(pos + 1, std::memory_order_release);
+            return true;
+          }
+        } else if (dif < 0) {
+          return false;
+        } else {
+          pos = tail_.load(std::memory_order_relaxed);
+        }
+      }
+    }
+
+    bool tryPop(T& value) {
+      size_t pos = head_.load(std::memory_order_relaxed);
+      for (;;) {
+        Cell& cell = cells_[pos & mask_];
+        size_t seq = cell.seq.load(std::memory_order_acquire);
+        intptr_t dif = intptr_t(seq) - intptr_t(pos + 1);
+        if (dif == 0) {
+          if (head_.compare_exchange_weak(pos, pos + 1,
+                                          std::memory_order_relaxed)) {
+            value = std::move(cell.value);
+            cell.seq.store(pos + mask_ + 1, std::memory_order_release);
+            return true;
+          }
+        } else if (dif < 0) {
+          return false;
+        } else {
+          pos = head_.load(std::memory_order_relaxed);
+        }
+      }
+    }
+
+    void push(T& value) {
+      while (!tryPush(value)) {
+        pushWaits++;
+        std::this_thread::yield();
+      }
+    }
+
+    // Returns false once the queue is empty and closed is set.
+    bool pop(T& value, const std::atomic<bool>& closed) {
+      occupancySum += size();
+      pops++;
+      while (!tryPop(value)) {
+        if (closed.load()) {
+          return tryPop(value);
+        }
+        popWaits++;
+        std::this_thread::yield();
+      }
+      return true;
+    }
+};
+
+// Read-only view of a whole file, mmap'ed where the platform allows it.
+class MappedFile {
+  private:
+    const char* data_;
+    int64_t size_;
+    void* map_;
+    std::string copy_;
+
+  public:
+    explicit MappedFile(const std::string&);
+    ~MappedFile();
+
+    const char* data() const;
+    int64_t size() const;
+};
+
+// Sequential reader of a gzip or zstd compressed file, returning its text
+// in newline-aligned blocks. Concatenated gzip members and zstd frames are
+// read as one stream. Support is compiled in with FASTTEXT_ZLIB and
+// FASTTEXT_ZSTD (see the Makefile).
+class CompressedFile {
+  public:
+    static const int32_t PLAIN = 0;
+    static const int32_t GZIP = 1;
+    static const int32_t ZSTD = 2;
+
+  private:
+    std::ifstream in_;
+    int32_t format_;
+    void* stream_;
+    std::vector<char> inbuf_;
+    size_t inPos_;
+    size_t inSize_;
+    bool frameEnd_;
+    bool done_;
+    std::string carry_;
+    std::string path_;
+
+    void decode(std::string&);
+
+  public:
+    explicit CompressedFile(const std::string&);
+    ~CompressedFile();
+
+    static int32_t format(const std::string&);
+
+    bool read(std::string&, int64_t);
+};
+
+// Calls fn on the text of a plain or compressed file, a newline-aligned
+// piece at a time, and returns the size of the text.
+int64_t readBlocks(const std::string&,
+                   std::function<void(const char*, const char*)>);
+
+// Hands out every chunk exactly once per epoch. Each epoch's chunks are
+// shuffled and dealt into one slice per thread; a thread drains its own
+// slice and then steals from the others before moving to the next epoch.
+// All cursors are atomics, there are no locks.
+// With setNodes() the chunks are first cut into one contiguous shard per
+// NUMA node, kept over the epochs: a node's threads share its shard, and
+// only steal from the other nodes once it is drained.
+// Compressed files cannot be cut at byte offsets: each is decompressed once
+// per epoch by its own decoder thread into a queue of text blocks, which
+// the threads take in turn with the chunks of the mapped files.
+// A chunk or block counts as done when its thread asks for the next one;
+// save() and restore() carry the done set over to a resumed run.
+// shard() keeps the part of the input one process of a -workers run reads.
+class ChunkScheduler {
+  private:
+    struct Block {
+      std::string text;
+      int32_t file;
+      // position of the block in the decoder's output over all epochs
+      int64_t seq;
+    };
+
+    std::vector<std::string> paths_;
+    std::vector<std::unique_ptr<MappedFile>> files_;
+    std::vector<Chunk> chunks_;
+    int64_t totalBytes_;
+    int32_t threads_;
+    int32_t epochs_;
+
+    // chunk ids, one shuffled permutation per epoch without the done ones
+    std::vector<int32_t> order_;
+    std::vector<int64_t> epochBegin_;
+    // epochs * threads cursors into order_, and the end of each slice
+    std::unique_ptr<std::atomic<int64_t>[]> heads_;
+    std::vector<int64_t> ends_;
+    // node of each thread, and the threads each one takes chunks from in
+    // turn: itself, the rest of its node, then the other nodes
+    std::vector<int32_t> nodes_;
+    std::vector<std::vector<int32_t>> victims_;
+    // current epoch of each thread, only touched by its owner
+    std::vector<int32_t> epoch_;
+    // epochs * nchunks flags, and the epoch * nchunks + id each thread reads
+    std::unique_ptr<std::atomic<bool>[]> done_;
+    std::vector<int64_t> current_;
+    std::atomic<int64_t> doneBytes_;
+
+    std::unique_ptr<MpmcQueue<std::unique_ptr<Block>>> blocks_;
+    // block each thread is reading, released when it asks for the next one
+    std::vector<std::unique_ptr<Block>> held_;
+    std::vector<int32_t> streams_;
+    int64_t chunkBytes_;
+    // -workers: this process reads every shardCount_-th chunk and block
+    int32_t shardRank_;
+    int32_t shardCount_;
+    std::vector<std::thread> decoders_;
+    std::once_flag started_;
+    std::atomic<int32_t> decodersLeft_;
+    std::atomic<bool> decodersDone_;
+    // per file: blocks all done below the mark, and the done ones above it
+    std::mutex blockMutex_;
+    std::vector<int64_t> blockMark_;
+    std::vector<std::set<int64_t>> blockDone_;
+
+    void split(int32_t, int64_t);
+    void start();
+    void decode(int32_t);
+    bool nextChunk(int32_t, Chunk&);
+    void hold(int32_t, std::unique_ptr<Block>&, Chunk&);
+    void release(int32_t);
+    void deal();
+
+  public:
+    ChunkScheduler(const std::vector<std::string>&,
+                   const std::vector<int64_t>&, int32_t, int32_t,
+                   int64_t chunkBytes = 0);
+    ChunkScheduler(const std::vector<Chunk>&, int64_t, int32_t, int32_t);
+    ~ChunkScheduler();
+
+    static int64_t chunkSize(int64_t, int32_t);
+    static std::vector<Chunk> splitText(const char*, int64_t, int64_t);
+
+    void shard(int32_t, int32_t);
+    void setNodes(const std::vector<int32_t>&);
+    bool next(int32_t, Chunk&);
+    const char* data(const Chunk&) const;
+
+    void save(std::ostream&);
+    void restore(std::istream&);
+
+    void addDone(int64_t);
+    real progress() const;
+    int64_t totalBytes() const;
+    int32_t nchunks() const;
+};
+
+// Corpus pre-tokenized by Dictionary::encode: a header carrying the
+// dictionary fingerprint, then the int32 codes. Chunk offsets are bytes
+// from the first code.
+class IdCache {
+  private:
+    static const int32_t MAGIC = 0x31534449;
+    static const int64_t HEADER_SIZE = 24;
+    std::unique_ptr<MappedFile> file_;
+
+  public:
+    explicit IdCache(const std::string&);
+
+    static void write(const std::string&, const std::vector<std::string>&,
+                      const Dictionary&);
+    static bool matches(const std::string&, uint64_t);
+
+    const int32_t* codes() const;
+    int64_t bytes() const;
+    std::vector<Chunk> split(int32_t, int64_t) const;
+};
+
+// Yields the lines of one chunk at a time, tokenized in place from the
+// mapped text or walked from the id cache, with the same subsampling and
+// ngrams as getLine.
+class ChunkReader {
+  private:
+    std::shared_ptr<Dictionary> dict_;
+    const ChunkScheduler& chunks_;
+    const IdCache* cache_;
+    std::unordered_map<std::string, int64_t>* oov_;
+    const char* text_;
+    TextScanner scanner_;
+    const int32_t* begin_;
+    const int32_t* ptr_;
+    const int32_t* end_;
+    int64_t size_;
+
+  public:
+    ChunkReader(std::shared_ptr<Dictionary>, const ChunkScheduler&,
+                const IdCache*,
+                std::unordered_map<std::string, int64_t>* oov = nullptr);
+
+    void open(const Chunk&);
+    bool next(std::vector<int32_t>&, std::vector<int32_t>&,
+              std::minstd_rand&, int32_t&);
+    int64_t position();
+    int64_t size() const;
+};
+
+}
+
+#endif
@@ -17,37 +17,53 @@
 #include <algorithm>
 #include <iterator>
 #include <cmath>
+#include <limits>
+#include <cstring>
+
+#include "utils.h"
 
 namespace fasttext {
 
 const std::string Dictionary::EOS = "</s>";
 const std::string Dictionary::BOW = "<";
 const std::string Dictionary::EOW = ">";
+const int32_t Dictionary::ID_OOV_WORD;
 
 Dictionary::Dictionary(std::shared_ptr<Args> args) : args_(args),
   word2int_(MAX_VOCAB_SIZE, -1), size_(0), nwords_(0), nlabels_(0),
-  ntokens_(0) {}
+  ntokens_(0), minThreshold_(1), wordRows_(0) {}
 
 int32_t Dictionary::find(const std::string& w) const {
-  int32_t h = hash(w) % MAX_VOCAB_SIZE;
-  while (word2int_[h] != -1 && words_[word2int_[h]].word != w) {
+  return find(w.data(), w.size(), hash(w));
+}
+
+// Slot of the token [w, w + len) whose hash is already known.
+int32_t Dictionary::find(const char* w, size_t len, uint32_t hw) const {
+  int32_t h = hw % MAX_VOCAB_SIZE;
+  while (word2int_[h] != -1) {
+    const std::string& word = words_[word2int_[h]].word;
+    if (word.size() == len && std::memcmp(word.data(), w, len) == 0) break;
     h = (h + 1) % MAX_VOCAB_SIZE;
   }
   return h;
 }
 
 void Dictionary::add(const std::string& w) {
-  int32_t h = find(w);
-  ntokens_++;
+  add(w.data(), w.size());
+}
+
+void Dictionary::add(const char* w, size_t len, int64_t count) {
+  int32_t h = find(w, len, hash(w, len));
+  ntokens_ += count;
   if (word2int_[h] == -1) {
     entry e;
-    e.word = w;
-    e.count = 1;
-    e.type = getType(w);
+    e.word.assign(w, len);
+    e.count = count;
+    e.type = getType(w, len);
     words_.push_back(e);
     word2int_[h] = size_++;
   } else {
-    words_[word2int_[h]].count++;
+    words_[word2int_[h]].count += count;
   }
 }
 
@@ -116,7 +132,14 @@ entry_type Dictionary::getType(int32_t id) const {
 }
 
 entry_type Dictionary::getType(const std::string& w) const {
-  return (w.find(args_->label) == 0) ? entry_type::label : entry_type::word;
+  return getType(w.data(), w.size());
+}
+
+entry_type Dictionary::getType(const char* w, size_t len) const {
+  const std::string& label = args_->label;
+  bool prefix = len >= label.size() &&
+                std::memcmp(w, label.data(), label.size()) == 0;
+  return prefix ? entry_type::label : entry_type::word;
 }
 
 std::string Dictionary::getWord(int32_t id) const {
@@ -126,17 +149,22 @@ std::string Dictionary::getWord(int32_t id) const {
 }
 
 uint32_t Dictionary::hash(const std::string& str) const {
+  return hash(str.data(), str.size());
+}
+
+uint32_t Dictionary::hash(const char* str, size_t len) const {
   uint32_t h = 2166136261;
-  for (size_t i = 0; i < str.size(); i++) {
+  for (size_t i = 0; i < len; i++) {
     h = h ^ uint32_t(str[i]);
     h = h * 16777619;
   }
   return h;
 }
 
-void Dictionary::computeNgrams(const std::string& word,
-                               std::vector<int32_t>& ngrams,
-                               std::vector<std::string>& substrings) const {
+// Calls fn with every char ngram of word, between -minn and -maxn UTF-8
+// characters, and its raw hash.
+template <typename Fn>
+void Dictionary::forEachNgram(const std::string& word, Fn fn) const {
   for (size_t i = 0; i < word.size(); i++) {
     std::string ngram;
     if ((word[i] & 0xC0) == 0x80) continue;
@@ -146,39 +174,118 @@ void Dictionary::computeNgrams(const std::string& word,
         ngram.push_back(word[j++]);
       }
       if (n >= args_->minn && !(n == 1 && (i == 0 || j == word.size()))) {
-        int32_t h = hash(ngram) % args_->bucket;
-        ngrams.push_back(nwords_ + h);
-        substrings.push_back(ngram);
-        // BenA: debug
-        //std::cerr << "ngram = " << ngram << "hash = " << h << std::endl;
+        fn(ngram, hash(ngram));
       }
     }
   }
 }
 
+void Dictionary::computeNgrams(const std::string& word,
+                               std::vector<int32_t>& ngrams,
+                               std::vector<std::string>& substrings) const {
+  forEachNgram(word, [&](const std::string& ngram, uint32_t h) {
+    ngrams.push_back(ngramBase() + int32_t(h % args_->bucket));
+    substrings.push_back(ngram);
+  });
+}
+
 void Dictionary::computeNgrams(const std::string& word,
                                std::vector<int32_t>& ngrams) const {
-  for (size_t i = 0; i < word.size(); i++) {
-    std::string ngram;
-    if ((word[i] & 0xC0) == 0x80) continue;
-    for (size_t j = i, n = 1; j < word.size() && n <= args_->maxn; n++) {
-      ngram.push_back(word[j++]);
-      while (j < word.size() && (word[j] & 0xC0) == 0x80) {
-        ngram.push_back(word[j++]);
+  forEachNgram(word, [&](const std::string&, uint32_t h) {
+    ngrams.push_back(ngramBase() + int32_t(h % args_->bucket));
+  });
+}
+
+// HyperLogLog sketch used to estimate the number of distinct char ngrams
+// without materializing them. 2^14 registers give a ~0.8% standard error.
+class NgramSketch {
+  private:
+    static const int32_t P = 14;
+    static const int32_t M = 1 << P;
+    std::vector<uint8_t> registers_;
+
+  public:
+    NgramSketch() : registers_(M, 0) {}
+
+    void add(uint32_t h) {
+      // FNV-1a leaves the high bits poorly mixed, finalize before bucketing
+      uint64_t x = utils::mix64(h);
+      int32_t idx = x >> (64 - P);
+      uint64_t w = x << P;
+      uint8_t rho = (w == 0) ? (64 - P + 1) : (__builtin_clzll(w) + 1);
+      registers_[idx] = std::max(registers_[idx], rho);
+    }
+
+    int64_t estimate() const {
+      double sum = 0.0;
+      int32_t zeros = 0;
+      for (int32_t i = 0; i < M; i++) {
+        sum += std::ldexp(1.0, -registers_[i]);
+        if (registers_[i] == 0) zeros++;
       }
-      if (n >= args_->minn && !(n == 1 && (i == 0 || j == word.size()))) {
-        int32_t h = hash(ngram) % args_->bucket;
-        ngrams.push_back(nwords_ + h);
-        // BenA: debug
-        //std::cerr << "ngram = " << ngram << "hash = " << h << std::endl;
+      double alpha = 0.7213 / (1.0 + 1.079 / M);
+      double e = alpha * M * M / sum;
+      if (e <= 2.5 * M && zeros > 0) {
+        e = M * std::log(double(M) / zeros);
       }
+      return int64_t(e);
+    }
+};
+
+int64_t Dictionary::countNgrams() const {
+  NgramSketch sketch;
+  for (int32_t i = 0; i < size_; i++) {
+    if (words_[i].type != entry_type::word) continue;
+    forEachNgram(BOW + words_[i].word + EOW,
+                 [&](const std::string&, uint32_t h) { sketch.add(h); });
+  }
+  return sketch.estimate();
+}
+
+void Dictionary::initBucket() {
+  if (args_->bucket == 0) return;
+  int64_t bucket = args_->bucket;
+  if (args_->bucket_auto && args_->wordNgrams > 1) {
+    // the word ngrams are only known while reading the text
+    std::cerr << "Warning: -bucket auto only estimates char ngrams, the "
+              << "word ngrams of -wordNgrams keep " << bucket << " buckets."
+              << std::endl;
+  } else if (args_->bucket_auto) {
+    int64_t ngrams = (args_->maxn > 0) ? countNgrams() : 0;
+    if (ngrams > 0) {
+      // a given ngram shares its bucket with probability 1 - exp(-n / bucket)
+      bucket = std::ceil(-ngrams / std::log(1.0 - args_->bucket_collision));
+    }
+    if (args_->verbose > 0) {
+      std::cerr << "Number of char ngrams (estimated): " << ngrams << std::endl;
+    }
+  }
+  if (args_->bucket_budget_mb > 0) {
+    int64_t rows = (int64_t(args_->bucket_budget_mb) << 20) /
+                   (int64_t(args_->dim) * sizeof(real));
+    if (rows <= nwords_) {
+      std::cerr << "-bucket_budget_mb is too small for the vocabulary."
+                << std::endl;
+      exit(EXIT_FAILURE);
     }
+    bucket = std::min(bucket, rows - nwords_);
+  }
+  bucket = std::min(bucket,
+      int64_t(std::numeric_limits<int32_t>::max()) - size_);
+  args_->bucket = std::max(bucket, int64_t(1));
+  if (args_->verbose > 0) {
+    std::cerr << "Number of buckets: " << args_->bucket << std::endl;
   }
 }
 
+int32_t Dictionary::ngramBase() const {
+  return std::max(nwords_, wordRows_);
+}
+
 void Dictionary::initNgrams() {
   for (size_t i = 0; i < size_; i++) {
     std::string word = BOW + words_[i].word + EOW;
+    words_[i].subwords.clear();
     words_[i].subwords.push_back(i);
     computeNgrams(word, words_[i].subwords);
   }
@@ -211,24 +318,82 @@ bool Dictionary::readWord(std::istream& in, std::string& word) const
   return !word.empty();
 }
 
-void Dictionary::readFromFile(std::istream& in) {
-  std::string word;
-  int64_t minThreshold = 1;
-  while (readWord(in, word)) {
-    add(word);
+// Same tokens as readWord on a stream, returned as a view into the
+// scanned buffer, or into EOS for an empty line.
+bool Dictionary::readWord(TextScanner& in, const char*& word,
+                          size_t& len) const {
+  if (!in.next(word, len)) return false;
+  if (len == 0) {
+    word = EOS.data();
+    len = EOS.size();
+  }
+  return true;
+}
+
+void Dictionary::readFromFile(const char* begin, const char* end) {
+  addText(begin, end);
+  initVocab();
+}
+
+// Counts the tokens of one piece of the corpus; pieces must end on a
+// newline so that no token is split between two calls.
+void Dictionary::addText(const char* begin, const char* end) {
+  TextScanner in(begin, end);
+  const char* word;
+  size_t len;
+  while (readWord(in, word, len)) {
+    add(word, len);
     if (ntokens_ % 1000000 == 0 && args_->verbose > 1) {
       std::cerr << "\rRead " << ntokens_  / 1000000 << "M words" << std::flush;
     }
     if (size_ > 0.75 * MAX_VOCAB_SIZE) {
-      minThreshold++;
-      threshold(minThreshold, minThreshold);
+      minThreshold_++;
+      threshold(minThreshold_, minThreshold_);
+    }
+  }
+}
+
+// Counts the tokens of a piece of the corpus into a private table, so that
+// several files can be counted at once and merged with addCounts. Returns
+// the number of tokens read.
+int64_t Dictionary::countText(
+    const char* begin, const char* end,
+    std::unordered_map<std::string, int64_t>& counts) const {
+  TextScanner in(begin, end);
+  const char* word;
+  size_t len;
+  std::string key;
+  int64_t ntokens = 0;
+  while (readWord(in, word, len)) {
+    key.assign(word, len);
+    counts[key]++;
+    ntokens++;
+  }
+  return ntokens;
+}
+
+void Dictionary::addCounts(
+    const std::unordered_map<std::string, int64_t>& counts) {
+  for (auto it = counts.cbegin(); it != counts.cend(); ++it) {
+    add(it->first.data(), it->first.size(), it->second);
+    if (size_ > 0.75 * MAX_VOCAB_SIZE) {
+      minThreshold_++;
+      threshold(minThreshold_, minThreshold_);
     }
   }
+}
+
+void Dictionary::initVocab() {
   threshold(args_->minCount, args_->minCountLabel);
+  if (args_->verbose > 0) {
+    std::cerr << "\rRead " << ntokens_  / 1000000 << "M words" << std::endl;
+  }
+  if (args_->bucket_auto || args_->bucket_budget_mb > 0) {
+    initBucket();
+  }
   initTableDiscard();
   initNgrams();
   if (args_->verbose > 0) {
-    std::cerr << "\rRead " << ntokens_  / 1000000 << "M words" << std::endl;
     std::cerr << "Number of words:  " << nwords_ << std::endl;
     std::cerr << "Number of labels: " << nlabels_ << std::endl;
   }
@@ -239,10 +404,13 @@ void Dictionary::readFromFile(std::istream& in) {
   }
 }
 
+// Equal counts are ordered by the word, so that the ids do not depend on
+// the order the words were added in, e.g. by the tables of addCounts.
 void Dictionary::threshold(int64_t t, int64_t tl) {
   sort(words_.begin(), words_.end(), [](const entry& e1, const entry& e2) {
       if (e1.type != e2.type) return e1.type < e2.type;
-      return e1.count > e2.count;
+      if (e1.count != e2.count) return e1.count > e2.count;
+      return e1.word < e2.word;
     });
   words_.erase(remove_if(words_.begin(), words_.end(), [&](const entry& e) {
         return (e.type == entry_type::word && e.count < t) ||
@@ -261,6 +429,89 @@ void Dictionary::threshold(int64_t t, int64_t tl) {
   }
 }
 
+// Moves the char ngram buckets behind `rows` word rows, so that words can
+// be added without shifting them; 0 goes back to the packed layout.
+void Dictionary::setWordRows(int32_t rows) {
+  wordRows_ = rows;
+  initNgrams();
+}
+
+// Adds words met while streaming, after the current words and before the
+// labels. Their discard probability uses ntokens, the tokens seen so far.
+void Dictionary::promote(
+    const std::vector<std::pair<std::string, int64_t>>& added,
+    int64_t ntokens) {
+  if (added.empty()) return;
+  assert(nwords_ + added.size() <= ngramBase());
+  ntokens_ = ntokens;
+  std::vector<entry> entries;
+  for (auto it = added.cbegin(); it != added.cend(); ++it) {
+    entry e;
+    e.word = it->first;
+    e.count = it->second;
+    e.type = entry_type::word;
+    entries.push_back(e);
+  }
+  // the labels move up, their slots are found before the entries shift
+  std::vector<int32_t> labelSlots;
+  for (int32_t i = nwords_; i < size_; i++) {
+    labelSlots.push_back(find(words_[i].word));
+  }
+  words_.insert(words_.begin() + nwords_, entries.begin(), entries.end());
+  int32_t first = nwords_;
+  nwords_ += entries.size();
+  size_ += entries.size();
+  for (size_t i = 0; i < labelSlots.size(); i++) {
+    word2int_[labelSlots[i]] = nwords_ + i;
+  }
+  for (int32_t i = first; i < nwords_; i++) {
+    word2int_[find(words_[i].word)] = i;
+  }
+  pdiscard_.insert(pdiscard_.begin() + first, entries.size(), 0.0);
+  for (int32_t i = first; i < nwords_; i++) {
+    real f = real(words_[i].count) / real(ntokens_);
+    pdiscard_[i] = std::sqrt(args_->t / f) + args_->t / f;
+    words_[i].subwords.push_back(i);
+    computeNgrams(BOW + words_[i].word + EOW, words_[i].subwords);
+  }
+}
+
+// Adds the counts of another dictionary. Its unknown words go after the
+// words and its unknown labels after the labels, so known ids are kept.
+void Dictionary::merge(const Dictionary& other) {
+  std::vector<entry> words, labels;
+  for (auto it = other.words_.cbegin(); it != other.words_.cend(); ++it) {
+    int32_t id = getId(it->word);
+    if (id >= 0) {
+      words_[id].count += it->count;
+    } else if (it->type == entry_type::word) {
+      words.push_back(*it);
+    } else {
+      labels.push_back(*it);
+    }
+  }
+  words_.insert(words_.begin() + nwords_, words.begin(), words.end());
+  words_.insert(words_.end(), labels.begin(), labels.end());
+  nwords_ += words.size();
+  nlabels_ += labels.size();
+  size_ = words_.size();
+  ntokens_ += other.ntokens_;
+  std::fill(word2int_.begin(), word2int_.end(), -1);
+  for (int32_t i = 0; i < size_; i++) {
+    word2int_[find(words_[i].word)] = i;
+  }
+  initTableDiscard();
+  initNgrams();
+}
+
+// Orders the entries by count again after merge(), as initVocab() does;
+// the ids change.
+void Dictionary::sortByCount() {
+  threshold(0, 0);
+  initTableDiscard();
+  initNgrams();
+}
+
 void Dictionary::initTableDiscard() {
   pdiscard_.resize(size_);
   for (size_t i = 0; i < size_; i++) {
@@ -277,6 +528,60 @@ std::vector<int64_t> Dictionary::getCounts(entry_type type) const {
   return counts;
 }
 
+// A dense table costs 4 bytes per bucket against 8 per kept ngram for the
+// sorted one, it is used unless it would be more than 8 times larger.
+void Dictionary::initPruneIdx() {
+  pruneDense_.clear();
+  pruneKeys_.clear();
+  pruneVals_.clear();
+  if (pruneidx_size_ <= 0) return;
+  if (args_->bucket <= 16 * pruneidx_size_) {
+    pruneDense_.assign(args_->bucket, -1);
+    for (const auto& pair : pruneidx_) {
+      pruneDense_[pair.first] = pair.second;
+    }
+    return;
+  }
+  std::vector<std::pair<int32_t, int32_t>> sorted(pruneidx_.begin(),
+                                                  pruneidx_.end());
+  std::sort(sorted.begin(), sorted.end());
+  // 1-based Eytzinger layout, filled by an in-order walk of the implicit tree
+  int64_t n = sorted.size();
+  pruneKeys_.assign(n + 1, 0);
+  pruneVals_.assign(n + 1, -1);
+  int64_t i = 0, k = 1;
+  std::vector<int64_t> stack;
+  while (i < n) {
+    while (k <= n) {
+      stack.push_back(k);
+      k = 2 * k;
+    }
+    k = stack.back();
+    stack.pop_back();
+    pruneKeys_[k] = sorted[i].first;
+    pruneVals_[k] = sorted[i].second;
+    i++;
+    k = 2 * k + 1;
+  }
+}
+
+int32_t Dictionary::prunedId(int32_t id) const {
+  if (!pruneDense_.empty()) {
+    return pruneDense_[id];
+  }
+  int64_t n = pruneKeys_.size() - 1;
+  int64_t k = 1;
+  while (k <= n) {
+    k = 2 * k + (pruneKeys_[k] < id);
+  }
+  // drop the trailing right turns and the last left turn
+  k >>= __builtin_ffsll(~k);
+  if (k == 0 || pruneKeys_[k] != id) {
+    return -1;
+  }
+  return pruneVals_[k];
+}
+
 void Dictionary::addNgrams(std::vector<int32_t>& line,
                            const std::vector<int32_t>& hashes,
                            int32_t n) const {
@@ -287,11 +592,10 @@ void Dictionary::addNgrams(std::vector<int32_t>& line,
       h = h * 116049371 + hashes[j];
       int64_t id = h % args_->bucket;
       if (pruneidx_size_ > 0) {
-        if (pruneidx_.count(id)) {
-          id = pruneidx_.at(id);
-        } else {continue;}
+        id = prunedId(id);
+        if (id < 0) {continue;}
       }
-      line.push_back(nwords_ + id);
+      line.push_back(ngramBase() + id);
     }
   }
 }
@@ -355,6 +659,134 @@ std::string Dictionary::getLabel(int32_t lid) const {
   return words_[lid + nwords_].word;
 }
 
+// Mapped text counterpart of getLine, with no allocation per token.
+// Unknown words are also counted into oov when it is given.
+int32_t Dictionary::getLine(TextScanner& in,
+                            std::vector<int32_t>& words,
+                            std::vector<int32_t>& labels,
+                            std::minstd_rand& rng,
+                            std::unordered_map<std::string, int64_t>* oov)
+                            const {
+  std::uniform_real_distribution<> uniform(0, 1);
+  bool sup = args_->model == model_name::sup;
+  const int32_t eos = getId(EOS);
+  std::vector<int32_t> word_hashes;
+  words.clear();
+  labels.clear();
+  int32_t ntokens = 0;
+  const char* token;
+  size_t len;
+  while (readWord(in, token, len)) {
+    uint32_t h = hash(token, len);
+    int32_t wid = word2int_[find(token, len, h)];
+    if (wid < 0) {
+      if (getType(token, len) == entry_type::word) {
+        if (sup) word_hashes.push_back(h);
+        if (oov != nullptr) (*oov)[std::string(token, len)]++;
+      }
+      continue;
+    }
+    entry_type type = getType(wid);
+    ntokens++;
+    if (type == entry_type::word && !discard(wid, uniform(rng))) {
+      words.push_back(wid);
+      if (sup) word_hashes.push_back(h);
+    }
+    if (type == entry_type::label) {
+      labels.push_back(wid - nwords_);
+    }
+    if (wid == eos) break;
+    if (ntokens > MAX_LINE_SIZE && !sup) break;
+  }
+  if (sup) {
+    addNgrams(words, word_hashes, args_->wordNgrams);
+  }
+  return ntokens;
+}
+
+// Writes the text as int32 codes: the id of every known token, the hash
+// of unknown words (needed by the word ngrams), nothing for unknown labels.
+int64_t Dictionary::encode(const char* begin, const char* end,
+                           std::ostream& out) const {
+  TextScanner in(begin, end);
+  const char* token;
+  size_t len;
+  std::vector<int32_t> codes;
+  int64_t n = 0;
+  while (readWord(in, token, len)) {
+    uint32_t h = hash(token, len);
+    int32_t wid = word2int_[find(token, len, h)];
+    if (wid >= 0) {
+      codes.push_back(wid);
+    } else if (getType(token, len) == entry_type::word) {
+      codes.push_back(ID_OOV_WORD);
+      codes.push_back(h);
+    }
+    if (codes.size() >= (1 << 16)) {
+      out.write((char*) codes.data(), codes.size() * sizeof(int32_t));
+      n += codes.size();
+      codes.clear();
+    }
+  }
+  out.write((char*) codes.data(), codes.size() * sizeof(int32_t));
+  return n + codes.size();
+}
+
+// Same lines as getLine on the text the codes were encoded from.
+int32_t Dictionary::getLine(const int32_t*& ptr, const int32_t* end,
+                            std::vector<int32_t>& words,
+                            std::vector<int32_t>& labels,
+                            std::minstd_rand& rng) const {
+  std::uniform_real_distribution<> uniform(0, 1);
+  bool sup = args_->model == model_name::sup;
+  const int32_t eos = getId(EOS);
+  std::vector<int32_t> word_hashes;
+  words.clear();
+  labels.clear();
+  int32_t ntokens = 0;
+  while (ptr < end) {
+    int32_t code = *ptr++;
+    if (code == ID_OOV_WORD) {
+      if (ptr < end) word_hashes.push_back(*ptr++);
+      continue;
+    }
+    entry_type type = getType(code);
+    ntokens++;
+    if (type == entry_type::word && !discard(code, uniform(rng))) {
+      words.push_back(code);
+      if (sup) word_hashes.push_back(hash(words_[code].word));
+    }
+    if (type == entry_type::label) {
+      labels.push_back(code - nwords_);
+    }
+    if (code == eos) break;
+    if (ntokens > MAX_LINE_SIZE && !sup) break;
+  }
+  if (sup) {
+    addNgrams(words, word_hashes, args_->wordNgrams);
+  }
+  return ntokens;
+}
+
+// FNV-1a over the vocabulary in id order; the id stream is only valid for
+// a dictionary with the same fingerprint.
+uint64_t Dictionary::fingerprint() const {
+  uint64_t h = 14695981039346656037ULL;
+  auto mix = [&h](uint64_t x) {
+    h ^= x;
+    h *= 1099511628211ULL;
+  };
+  mix(nwords_);
+  mix(nlabels_);
+  for (int32_t i = 0; i < size_; i++) {
+    for (size_t j = 0; j < words_[i].word.size(); j++) {
+      mix(uint8_t(words_[i].word[j]));
+    }
+    mix(0);
+  }
+  return h;
+}
+
 void Dictionary::save(std::ostream& out) const {
   out.write((char*) &size_, sizeof(int32_t));
   out.write((char*) &nwords_, sizeof(int32_t));
@@ -401,6 +833,7 @@ void Dictionary::load(std::istream& in) {
     in.read((char*) &second, sizeof(int32_t));
     pruneidx_[first] = second;
   }
+  initPruneIdx();
   initTableDiscard();
   initNgrams();
 }
@@ -423,6 +856,7 @@ void Dictionary::prune(std::vector<int32_t>& idx) {
     idx.insert(idx.end(), ngrams.begin(), ngrams.end());
   }
   pruneidx_size_ = pruneidx_.size();
+  initPruneIdx();
 
   std::fill(word2int_.begin(), word2int_.end(), -1);
 
@@ -21,6 +21,7 @@
 
 #include "args.h"
 #include "real.h"
+#include "scanner.h"
 
 namespace fasttext {
 
@@ -40,8 +41,13 @@ class Dictionary {
     static const int32_t MAX_LINE_SIZE = 1024;
 
     int32_t find(const std::string&) const;
+    int32_t find(const char*, size_t, uint32_t) const;
     void initTableDiscard();
     void initNgrams();
+    template <typename Fn>
+    void forEachNgram(const std::string&, Fn) const;
+    int64_t countNgrams() const;
+    void initBucket();
 
     std::shared_ptr<Args> args_;
     std::vector<int32_t> word2int_;
@@ -52,9 +58,22 @@ class Dictionary {
     int32_t nwords_;
     int32_t nlabels_;
     int64_t ntokens_;
+    // count below which words are dropped while the vocabulary is too large
+    int64_t minThreshold_;
+    // rows reserved for words in the input matrix, the char ngram buckets
+    // start after max(nwords_, wordRows_); only set while streaming
+    int32_t wordRows_;
+    int32_t ngramBase() const;
 
     int64_t pruneidx_size_ = -1;
     std::unordered_map<int32_t, int32_t> pruneidx_;
+    // flat copies of pruneidx_ used by addNgrams: a dense table over the
+    // buckets when it is small enough, else the keys in Eytzinger order
+    std::vector<int32_t> pruneDense_;
+    std::vector<int32_t> pruneKeys_;
+    std::vector<int32_t> pruneVals_;
+    void initPruneIdx();
+    int32_t prunedId(int32_t) const;
     void addNgrams(
         std::vector<int32_t>& line,
         const std::vector<int32_t>& hashes,
@@ -64,6 +83,8 @@ class Dictionary {
     static const std::string EOS;
     static const std::string BOW;
     static const std::string EOW;
+    // code of the binary id stream for an unknown word, followed by its hash
+    static const int32_t ID_OOV_WORD = -1;
 
     explicit Dictionary(std::shared_ptr<Args>);
     int32_t nwords() const;
@@ -81,10 +102,19 @@ class Dictionary {
     void computeNgrams(const std::string&, std::vector<int32_t>&) const;
     void computeNgrams(const std::string&, std::vector<int32_t>&,
                        std::vector<std::string>&) const;
+    entry_type getType(const char*, size_t) const;
     uint32_t hash(const std::string& str) const;
+    uint32_t hash(const char*, size_t) const;
     void add(const std::string&);
+    void add(const char*, size_t, int64_t count = 1);
     bool readWord(std::istream&, std::string&) const;
-    void readFromFile(std::istream&);
+    bool readWord(TextScanner&, const char*&, size_t&) const;
+    void readFromFile(const char*, const char*);
+    void addText(const char*, const char*);
+    int64_t countText(const char*, const char*,
+                      std::unordered_map<std::string, int64_t>&) const;
+    void addCounts(const std::unordered_map<std::string, int64_t>&);
+    void initVocab();
     std::string getLabel(int32_t) const;
     void save(std::ostream&) const;
     void load(std::istream&);
@@ -93,7 +123,19 @@ class Dictionary {
                     std::vector<int32_t>&, std::minstd_rand&) const;
     int32_t getLine(std::istream&, std::vector<int32_t>&,
                     std::vector<int32_t>&, std::minstd_rand&) const;
+    int32_t getLine(TextScanner&, std::vector<int32_t>&,
+                    std::vector<int32_t>&, std::minstd_rand&,
+                    std::unordered_map<std::string, int64_t>* oov = nullptr)
+                    const;
+    int32_t getLine(const int32_t*&, const int32_t*, std::vector<int32_t>&,
+                    std::vector<int32_t>&, std::minstd_rand&) const;
+    int64_t encode(const char*, const char*, std::ostream&) const;
+    uint64_t fingerprint() const;
     void threshold(int64_t, int64_t);
+    void setWordRows(int32_t);
+    void promote(const std::vector<std::pair<std::string, int64_t>>&, int64_t);
+    void merge(const Dictionary&);
+    void sortByCount();
     void prune(std::vector<int32_t>&);
     void convertNgrams(std::vector<int32_t>&);
 };
@@ -12,6 +12,8 @@
 
 #include <math.h>
 
+#include <chrono>
+#include <cstdio>
 #include <iostream>
 #include <sstream>
 #include <iomanip>
@@ -19,12 +21,31 @@
 #include <string>
 #include <vector>
 #include <queue>
+#include <unordered_map>
 #include <algorithm>
+#include <functional>
+#include <iterator>
 
 
 namespace fasttext {
 
-FastText::FastText() : quant_(false) {}
+// distinct random streams for the matrices initialized by uniform()
+const uint64_t kInputStream = 1;
+const uint64_t kInput2Stream = 2;
+
+// stdin text trained on between two vocabulary updates with -input -
+const int64_t kStreamRoundBytes = 16 << 20;
+// unknown words counted while streaming before the rarest are dropped
+const size_t kMaxCandidates = 1 << 22;
+// output rows a training thread holds from the -outputShards owners
+const int64_t kOutputCacheRows = 4096;
+// -thread auto: each count is timed for kTuneSeconds after kTuneWarmup
+const double kTuneWarmup = 0.5;
+const double kTuneSeconds = 2.0;
+
+FastText::FastText()
+  : training_(false), activeThreads_(0), threadsDone_(0), resumed_(false),
+    deltas_(-1), baseBytes_(0), deltaBytes_(0), quant_(false) {}
 
 void FastText::getVector(Vector& vec, const std::string& word) {  
   const std::vector<int32_t>& ngrams = dict_->getNgrams(word);
@@ -155,10 +176,53 @@ void FastText::saveModel() {
   } else {
     output_->save(ofs);
   }
+  if (!quant_) {
+    saveExtraMatrices(ofs);
+  }
 
   ofs.close();
 }
 
+// The sense and variance matrices follow the output matrix, each behind a
+// flag telling whether the model has it.
+void FastText::saveExtraMatrices(std::ostream& out) {
+  const std::shared_ptr<Matrix> extra[] = {input2_, output2_, inputvar_,
+                                           input2var_, outputvar_, output2var_};
+  out.write((char*) &(args_->senses), sizeof(int));
+  for (int32_t i = 0; i < 6; i++) {
+    bool present = extra[i] != nullptr;
+    out.write((char*) &present, sizeof(bool));
+    if (present) {
+      extra[i]->save(out);
+    }
+  }
+}
+
+// Models saved before the extra matrices end after the output matrix.
+void FastText::loadExtraMatrices(std::istream& in) {
+  std::shared_ptr<Matrix>* extra[] = {&input2_, &output2_, &inputvar_,
+                                      &input2var_, &outputvar_, &output2var_};
+  for (int32_t i = 0; i < 6; i++) {
+    extra[i]->reset();
+  }
+  if (in.peek() == EOF) {
+    return;
+  }
+  int senses;
+  in.read((char*) &senses, sizeof(int));
+  for (int32_t i = 0; i < 6; i++) {
+    bool present;
+    in.read((char*) &present, sizeof(bool));
+    if (present) {
+      *extra[i] = std::make_shared<Matrix>();
+      (*extra[i])->load(in);
+    }
+  }
+  if (input2_) {
+    args_->senses = senses;
+  }
+}
+
 
 void FastText::saveNgramVectors(std::string prefix) {
   std::string fndict(prefix + ".words");
@@ -193,7 +257,8 @@ void FastText::saveNgramVectors(std::string prefix) {
     std::cerr << "Error opening file for saving vectors." << std::endl;
     exit(EXIT_FAILURE);
   }  
-  for (int32_t i = 0; i < dict_->nwords(); i++) {
+  // one row per word, or per label for supervised models
+  for (int32_t i = 0; i < output_->m_; i++) {
     vec.zero();
     vec.addRow(*output_, i);
     ofs3 << vec << std::endl;
@@ -202,36 +267,49 @@ void FastText::saveNgramVectors(std::string prefix) {
 
 
   ///////////////////////////////////////
-  // For multi-prototype
-  std::cerr << "Saving 2nd component. args_->multi = " << args_->multi << std::endl;
-  if (args_->multi){
-    std::cout << "Multi-Prototype Case: saving additional matrices" << std::endl; 
-  std::string f_in2(prefix + ".in2");
-  std::cerr << "Saving input2_ to file: " << f_in2 << std::endl;
-  std::ofstream ofs_in2(f_in2);
-  if (!ofs_in2.is_open()) {
-    std::cerr << "Error opening file for saving vectors." << std::endl;
-    exit(EXIT_FAILURE);
-  }
-  for (int32_t i = 0; i < dict_->nwords(); i++) {
-    vec.zero();
-    vec.addRow(*input2_, i);
-    ofs_in2 << vec << std::endl;
-  }
-  ofs_in2.close();
-  std::cerr << "Writing output2_ to file " << std::endl;
-  std::ofstream ofs3_2(prefix + ".out2");
-  if (!ofs3_2.is_open()) {
-    std::cerr << "Error opening file for saving vectors." << std::endl;
-    exit(EXIT_FAILURE);
-  }  
-  for (int32_t i = 0; i < dict_->nwords(); i++) {
-    vec.zero();
-    vec.addRow(*output2_, i);
-    ofs3_2 << vec << std::endl;
+  // For multi-prototype: one .inK/.outK pair per extra sense
+  std::cerr << "Saving extra components. args_->senses = " << args_->senses << std::endl;
+  if (args_->multi && input2_){
+    std::cout << "Multi-Prototype Case: saving additional matrices" << std::endl;
+    int64_t nsense2 = input2_->m_ / (args_->senses - 1);
+    for (int32_t k = 1; k < args_->senses; k++) {
+      std::string f_in2(prefix + ".in" + std::to_string(k + 1));
+      std::cerr << "Saving sense " << k + 1 << " of input to file: " << f_in2 << std::endl;
+      std::ofstream ofs_in2(f_in2);
+      if (!ofs_in2.is_open()) {
+        std::cerr << "Error opening file for saving vectors." << std::endl;
+        exit(EXIT_FAILURE);
+      }
+      for (int32_t i = 0; i < dict_->nwords(); i++) {
+        vec.zero();
+        // words past -multi_top have a single component
+        if (i < nsense2) {
+          vec.addRow(*input2_, (k - 1) * nsense2 + i);
+        } else {
+          vec.addRow(*input_, i);
+        }
+        ofs_in2 << vec << std::endl;
+      }
+      ofs_in2.close();
+      std::string f_out2(prefix + ".out" + std::to_string(k + 1));
+      std::cerr << "Writing sense " << k + 1 << " of output to file " << f_out2 << std::endl;
+      std::ofstream ofs3_2(f_out2);
+      if (!ofs3_2.is_open()) {
+        std::cerr << "Error opening file for saving vectors." << std::endl;
+        exit(EXIT_FAILURE);
+      }
+      for (int32_t i = 0; i < dict_->nwords(); i++) {
+        vec.zero();
+        if (i < nsense2) {
+          vec.addRow(*output2_, (k - 1) * nsense2 + i);
+        } else {
+          vec.addRow(*output_, i);
+        }
+        ofs3_2 << vec << std::endl;
+      }
+      ofs3_2.close();
+    }
   }
-  ofs3_2.close();
-  } 
 
   //////////////////////////////////////////
   if (args_->include_dictemb){
@@ -270,6 +348,9 @@ void FastText::loadModel(const std::string& filename) {
 void FastText::loadModel(const std::string& filename, bool multi) {
   loadModel(filename);
   args_->multi = multi; // setting 'multi variable explicitly'
+  if (!multi) {
+    args_->senses = 1;
+  }
 }
 
 void FastText::loadModel(std::istream& in) {
@@ -298,6 +379,9 @@ void FastText::loadModel(std::istream& in) {
   } else {
     output_->load(in);
   }
+  if (!quant_) {
+    loadExtraMatrices(in);
+  }
 
   model_ = std::make_shared<Model>(input_, output_, input2_, output2_, inputvar_, input2var_, outputvar_, output2var_, args_, 0, dict_->nwords());
 
@@ -315,7 +399,8 @@ void FastText::printInfo(real progress, real loss) {
   real t = real(clock() - start) / CLOCKS_PER_SEC;
   real wst = real(tokenCount) / t;
   real lr = args_->lr * (1.0 - progress);
-  int eta = int(t / progress * (1 - progress) / args_->thread);
+  int threads = args_->thread_auto ? activeThreads_.load() : args_->thread;
+  int eta = int(t / progress * (1 - progress) / threads);
   int etah = eta / 3600;
   int etam = (eta - etah * 3600) / 60;
   std::cerr << std::fixed;
@@ -368,6 +453,13 @@ void FastText::quantize(std::shared_ptr<Args> qargs) {
       args_->lr = qargs->lr;
       args_->thread = qargs->thread;
       args_->verbose = qargs->verbose;
+      std::vector<std::string> files = utils::expandPaths(args_->input);
+      std::vector<int64_t> textBytes;
+      for (auto it = files.cbegin(); it != files.cend(); ++it) {
+        textBytes.push_back(readBlocks(*it, [](const char*, const char*) {}));
+      }
+      startChunks(files, textBytes);
+      start = clock();
       tokenCount = 0;
       std::vector<std::thread> threads;
       for (int32_t i = 0; i < args_->thread; i++) {
@@ -398,6 +490,22 @@ void FastText::supervised(Model& model, real lr,
   model.update(line, labels[i], lr);
 }
 
+void FastText::supervisedBatch(Model& model, real lr,
+                               const std::vector<int32_t>& line,
+                               const std::vector<int32_t>& labels,
+                               std::vector<std::vector<int32_t>>& batchLines,
+                               std::vector<int32_t>& batchTargets) {
+  if (labels.size() == 0 || line.size() == 0) return;
+  std::uniform_int_distribution<> uniform(0, labels.size() - 1);
+  batchLines.push_back(line);
+  batchTargets.push_back(labels[uniform(model.rng)]);
+  if (batchLines.size() == args_->batch) {
+    model.updateBatch(batchLines, batchTargets, lr);
+    batchLines.clear();
+    batchTargets.clear();
+  }
+}
+
 void FastText::cbow(Model& model, real lr,
                     const std::vector<int32_t>& line) {
   std::vector<int32_t> bow;
@@ -656,13 +764,105 @@ void FastText::analogies(int32_t k) {
   }
 }
 
-void FastText::trainThread(int32_t threadId) {
-  std::ifstream ifs(args_->input);
-  utils::seek(ifs, threadId * utils::size(ifs) / args_->thread);
+// Consecutive thread ids share a node, so each node trains on one
+// contiguous shard of the corpus. Only nodes with CPUs get threads. With
+// -thread auto the ids go round-robin over the nodes instead, so that the
+// first threads the tuner activates use the bandwidth of all of them.
+int32_t FastText::threadNode(int32_t threadId) const {
+  if (args_->thread_auto) {
+    return cpuNodes_[threadId % cpuNodes_.size()];
+  }
+  return cpuNodes_[int64_t(threadId) * cpuNodes_.size() / args_->thread];
+}
 
+std::vector<int32_t> FastText::threadNodes() const {
+  std::vector<int32_t> nodes(args_->thread);
+  for (int32_t i = 0; i < args_->thread; i++) {
+    nodes[i] = threadNode(i);
+  }
+  return nodes;
+}
+
+void FastText::printNodeInfo(double seconds) const {
+  std::vector<int32_t> threads(numaCpus_.size(), 0);
+  for (int32_t i = 0; i < args_->thread; i++) {
+    threads[threadNode(i)]++;
+  }
+  for (size_t n = 0; n < numaCpus_.size(); n++) {
+    if (threads[n] == 0) continue;
+    std::cerr << "Node " << n << ": threads " << threads[n]
+              << "  words/sec/thread: " << std::fixed << std::setprecision(0)
+              << nodeTokens_[n] / seconds / threads[n] << std::endl;
+  }
+}
+
+void FastText::printQueueInfo() const {
+  int64_t pops = std::max<int64_t>(lineQueue_->pops, 1);
+  std::cerr << "Readers: " << args_->readers << "  trainers: " << args_->thread
+            << "  queue capacity: " << lineQueue_->capacity()
+            << "  mean occupancy: " << std::fixed << std::setprecision(1)
+            << real(lineQueue_->occupancySum) / pops
+            << "  trainer waits: " << lineQueue_->popWaits
+            << "  reader waits: " << lineQueue_->pushWaits << std::endl;
+}
+
+// Tokenizes chunks into batches of id sequences for the training threads,
+// so that reading, lookups and subsampling stay off their critical path.
+void FastText::readerThread(int32_t readerId) {
+  ChunkReader reader(dict_, *chunks_, idCache_.get());
+  std::minstd_rand rng(args_->thread + readerId);
+  if (resumed_) {
+    rng = rngs_[args_->thread + readerId];
+  }
+  std::vector<int32_t> line, labels;
+  int32_t ntokens;
+  Chunk chunk;
+  while (chunks_->next(readerId, chunk)) {
+    keepRng(args_->thread + readerId, rng);
+    reader.open(chunk);
+    std::unique_ptr<LineBatch> batch(new LineBatch());
+    int64_t donePos = 0;
+    while (reader.next(line, labels, rng, ntokens)) {
+      batch->tokens += ntokens;
+      batch->words.insert(batch->words.end(), line.begin(), line.end());
+      batch->wordEnds.push_back(batch->words.size());
+      batch->labels.insert(batch->labels.end(), labels.begin(), labels.end());
+      batch->labelEnds.push_back(batch->labels.size());
+      if (batch->tokens >= kReaderBatchTokens) {
+        int64_t pos = reader.position();
+        batch->bytes = pos - donePos;
+        donePos = pos;
+        lineQueue_->push(batch);
+        batch.reset(new LineBatch());
+      }
+    }
+    batch->bytes = reader.size() - donePos;
+    lineQueue_->push(batch);
+  }
+  readersDone_++;
+  if (readersDone_ == args_->readers) {
+    readersClosed_ = true;
+  }
+}
+
+void FastText::trainThread(int32_t threadId) {
+  int32_t node = 0;
+  if (args_->numa) {
+    node = threadNode(threadId);
+    utils::bindToCpus(numaCpus_[node]);
+  }
     Model model(input_, output_, input2_, output2_,
               inputvar_, input2var_, outputvar_, output2var_, 
               args_, threadId, dict_->nwords());
+  if (resumed_) {
+    model.rng = rngs_[threadId];
+  }
+  if (outputShard_) {
+    model.setOutputCache(
+        std::unique_ptr<OutputCache>(new OutputCache(
+            outputShard_, shardBounds_, shardOwners_, kOutputCacheRows)),
+        shardBounds_.back(), outputSenses());
+  }
   
   if (args_->model == model_name::sup) {
     model.setTargetCounts(dict_->getCounts(entry_type::label));
@@ -670,33 +870,103 @@ void FastText::trainThread(int32_t threadId) {
     model.setTargetCounts(dict_->getCounts(entry_type::word));
   }
 
-  const int64_t ntokens = dict_->ntokens();
   int64_t localTokenCount = 0;
   std::vector<int32_t> line, labels;
-  while (tokenCount < args_->epoch * ntokens) {
-    real progress = real(tokenCount) / (args_->epoch * ntokens);
-    real lr = args_->lr * (1.0 - progress);
-    localTokenCount += dict_->getLine(ifs, line, labels, model.rng);
-    if (args_->model == model_name::sup) {
+  // supervised softmax examples waiting for a mini-batch update
+  bool batched = args_->model == model_name::sup &&
+                 args_->loss == loss_name::softmax && args_->batch > 1;
+  std::vector<std::vector<int32_t>> batchLines;
+  std::vector<int32_t> batchTargets;
+  real progress = 0.0;
+  real lr = args_->lr;
+  int64_t pendingBytes = 0;
+
+  auto trainLine = [&]() {
+    if (outputShard_) {
+      model.prefetchOutput(args_->model == model_name::sup ? labels : line);
+    }
+    if (batched) {
+      supervisedBatch(model, lr, line, labels, batchLines, batchTargets);
+    } else if (args_->model == model_name::sup) {
       supervised(model, lr, line, labels);
     } else if (args_->model == model_name::cbow) {
       cbow(model, lr, line);
     } else if (args_->model == model_name::sg) {
       skipgram(model, lr, line);
     }
-    if (localTokenCount > args_->lrUpdateRate) {
-      tokenCount += localTokenCount;
-      localTokenCount = 0;
-      if (threadId == 0 && args_->verbose > 1) {
-        printInfo(progress, model.getLoss());
+  };
+  // the lr follows the bytes of the corpus actually trained on
+  auto sync = [&]() {
+    tokenCount += localTokenCount;
+    if (args_->numa) {
+      nodeTokens_[node] += localTokenCount;
+    }
+    localTokenCount = 0;
+    chunks_->addDone(pendingBytes);
+    pendingBytes = 0;
+    progress = chunks_->progress();
+    lr = args_->lr * (1.0 - progress);
+    if (threadId == 0 && args_->verbose > 1) {
+      printInfo(progress, model.getLoss());
+    }
+    if (args_->thread_auto) {
+      park(threadId);
+    }
+  };
+
+  if (args_->readers > 0) {
+    std::unique_ptr<LineBatch> batch;
+    while (lineQueue_->pop(batch, readersClosed_)) {
+      keepRng(threadId, model.rng);
+      for (int32_t l = 0; l < batch->size(); l++) {
+        int32_t wb = l == 0 ? 0 : batch->wordEnds[l - 1];
+        int32_t lb = l == 0 ? 0 : batch->labelEnds[l - 1];
+        line.assign(batch->words.begin() + wb,
+                    batch->words.begin() + batch->wordEnds[l]);
+        labels.assign(batch->labels.begin() + lb,
+                      batch->labels.begin() + batch->labelEnds[l]);
+        trainLine();
+      }
+      localTokenCount += batch->tokens;
+      pendingBytes += batch->bytes;
+      if (localTokenCount > args_->lrUpdateRate) {
+        sync();
       }
     }
+  } else {
+    ChunkReader reader(dict_, *chunks_, idCache_.get());
+    int32_t ntokens;
+    Chunk chunk;
+    while (chunks_->next(threadId, chunk)) {
+      keepRng(threadId, model.rng);
+      reader.open(chunk);
+      int64_t donePos = 0;
+      while (reader.next(line, labels, model.rng, ntokens)) {
+        localTokenCount += ntokens;
+        trainLine();
+        if (localTokenCount > args_->lrUpdateRate) {
+          int64_t pos = reader.position();
+          pendingBytes += pos - donePos;
+          donePos = pos;
+          sync();
+        }
+      }
+      pendingBytes += reader.size() - donePos;
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(parkMutex_);
+    threadsDone_++;
+  }
+  parkCv_.notify_all();
+  sync();
+  if (!batchLines.empty()) {
+    model.updateBatch(batchLines, batchTargets, lr);
   }
   if (threadId == 0 && args_->verbose > 0) {
     printInfo(1.0, model.getLoss());
     std::cerr << std::endl;
   }
-  ifs.close();
 }
 
 void FastText::loadVectors(std::string filename) {
@@ -728,7 +998,7 @@ void FastText::loadVectors(std::string filename) {
 
   dict_->threshold(1, 0);
   input_ = std::make_shared<Matrix>(dict_->nwords()+args_->bucket, args_->dim);
-  input_->uniform(1.0 / args_->dim);
+  input_->uniform(1.0 / args_->dim, kInputStream, args_->thread);
 
   for (size_t i = 0; i < n; i++) {
     int32_t idx = dict_->getId(words[i]);
@@ -739,80 +1009,1334 @@ void FastText::loadVectors(std::string filename) {
   }
 }
 
-void FastText::train(std::shared_ptr<Args> args) {
-  args_ = args;
-  dict_ = std::make_shared<Dictionary>(args_);
-  if (args_->input == "-") {
-    // manage expectations
-    std::cerr << "Cannot use stdin for training!" << std::endl;
-    exit(EXIT_FAILURE);
+// Builds the dictionary over the inputs, plain or compressed, and returns
+// the size of the text of each. Several files are counted in parallel into
+// one table per thread, the largest files first onto the least loaded
+// thread, and the tables are merged; as threshold() orders equal counts by
+// the word, the dictionary is the same whatever -thread.
+std::vector<int64_t> FastText::readVocabulary(
+    const std::vector<std::string>& files) {
+  std::vector<int64_t> textBytes(files.size(), 0);
+  int32_t nthreads = std::min<int64_t>(args_->thread, files.size());
+  if (nthreads <= 1) {
+    for (int32_t f = 0; f < files.size(); f++) {
+      textBytes[f] = readBlocks(files[f], [&](const char* begin,
+                                              const char* end) {
+        dict_->addText(begin, end);
+      });
+    }
+    dict_->initVocab();
+    return textBytes;
   }
-  std::ifstream ifs(args_->input);
-  if (!ifs.is_open()) {
-    std::cerr << "Input file cannot be opened!" << std::endl;
-    exit(EXIT_FAILURE);
+  std::vector<std::pair<int64_t, int32_t>> sizes;
+  for (int32_t f = 0; f < files.size(); f++) {
+    std::ifstream ifs(files[f], std::ifstream::binary);
+    if (!ifs.is_open()) {
+      std::cerr << files[f] << " cannot be opened!" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    sizes.push_back(std::make_pair(utils::size(ifs), f));
   }
-  dict_->readFromFile(ifs);
-  ifs.close();
+  std::sort(sizes.rbegin(), sizes.rend());
+  std::vector<std::vector<int32_t>> assigned(nthreads);
+  std::vector<int64_t> load(nthreads, 0);
+  for (auto it = sizes.cbegin(); it != sizes.cend(); ++it) {
+    int32_t t = std::min_element(load.begin(), load.end()) - load.begin();
+    assigned[t].push_back(it->second);
+    load[t] += it->first;
+  }
+  std::vector<std::unordered_map<std::string, int64_t>> counts(nthreads);
+  std::vector<std::thread> threads;
+  std::atomic<int64_t> ntokens(0);
+  for (int32_t t = 0; t < nthreads; t++) {
+    threads.push_back(std::thread([&, t]() {
+      for (auto it = assigned[t].cbegin(); it != assigned[t].cend(); ++it) {
+        textBytes[*it] = readBlocks(files[*it], [&](const char* begin,
+                                                    const char* end) {
+          int64_t n = dict_->countText(begin, end, counts[t]);
+          int64_t read = ntokens += n;
+          if ((read - n) / 1000000 != read / 1000000 && args_->verbose > 1) {
+            std::cerr << "\rRead " << read / 1000000 << "M words"
+                      << std::flush;
+          }
+        });
+      }
+    }));
+  }
+  for (auto it = threads.begin(); it != threads.end(); ++it) {
+    it->join();
+  }
+  for (int32_t t = 0; t < nthreads; t++) {
+    dict_->addCounts(counts[t]);
+    counts[t].clear();
+  }
+  dict_->initVocab();
+  return textBytes;
+}
+
+// Reads at least `bytes` of the stream into text, cut after its last newline;
+// the rest of the line is kept in carry for the next call.
+static bool readLines(std::istream& in, std::string& text,
+                      std::string& carry, int64_t bytes) {
+  text.swap(carry);
+  carry.clear();
+  std::vector<char> buffer(1 << 20);
+  while (in && (int64_t(text.size()) < bytes || text.find('\n') == std::string::npos)) {
+    in.read(buffer.data(), buffer.size());
+    text.append(buffer.data(), in.gcount());
+  }
+  if (in) {
+    size_t nl = text.rfind('\n');
+    carry.assign(text, nl + 1, std::string::npos);
+    text.resize(nl + 1);
+  }
+  return !text.empty();
+}
+
+// A word row reserve that leaves room for a quarter more words.
+static int64_t reserveRows(int64_t nwords) {
+  return nwords + std::max<int64_t>(nwords / 4, 4096);
+}
+
+// Makes room for `nwords` words in the rows between the words and the char
+// ngram buckets, growing them by half when they are full.
+void FastText::growWords(int64_t nwords) {
+  int64_t rows = output_->m_;
+  if (nwords <= rows) return;
+  int64_t grown = std::max(nwords, rows + rows / 2);
+  real logvar = log(args_->var_scale);
+  input_->insertRows(rows, grown - rows);
+  input_->uniformRows(1.0 / args_->dim, rows, grown, kInputStream);
+  output_->insertRows(rows, grown - rows);
+  if (args_->var) {
+    inputvar_->insertRows(rows, grown - rows);
+    inputvar_->initRows(logvar, rows, grown);
+    outputvar_->insertRows(rows, grown - rows);
+    outputvar_->initRows(logvar, rows, grown);
+  }
+  dict_->setWordRows(grown);
+}
+
+// Gives the words below `nwords`, within -multi_top, their extra senses:
+// the (senses - 1) blocks of the sense matrices grow to the word rows.
+void FastText::growSenses(int64_t nwords) {
+  if (!input2_) return;
+  int64_t blocks = args_->senses - 1;
+  int64_t rows = input2_->m_ / blocks;
+  int64_t limit = args_->multi_top > 0 ? args_->multi_top : output_->m_;
+  if (nwords <= rows || rows >= limit) return;
+  int64_t grown = std::min(output_->m_, limit);
+  real logvar = log(args_->var_scale);
+  // last block first, so that the earlier ones stay in place
+  for (int64_t b = blocks - 1; b >= 0; b--) {
+    input2_->insertRows((b + 1) * rows, grown - rows);
+    output2_->insertRows((b + 1) * rows, grown - rows);
+    if (args_->var) {
+      input2var_->insertRows((b + 1) * rows, grown - rows);
+      output2var_->insertRows((b + 1) * rows, grown - rows);
+    }
+  }
+  for (int64_t b = 0; b < blocks; b++) {
+    int64_t begin = b * grown + rows;
+    int64_t end = (b + 1) * grown;
+    input2_->uniformRows(1.0 / args_->dim, begin, end, kInput2Stream);
+    if (args_->var) {
+      input2var_->initRows(logvar, begin, end);
+      output2var_->initRows(logvar, begin, end);
+    }
+  }
+}
+
+// Adds the words that reached -minCount in the rounds so far, while the
+// training threads wait. Their rows are already initialized.
+void FastText::promoteWords() {
+  for (auto it = streamOov_.begin(); it != streamOov_.end(); ++it) {
+    for (auto w = it->cbegin(); w != it->cend(); ++w) {
+      streamCandidates_[w->first] += w->second;
+    }
+    it->clear();
+  }
+  std::vector<std::pair<std::string, int64_t>> added;
+  for (auto it = streamCandidates_.begin(); it != streamCandidates_.end();) {
+    if (it->second >= args_->minCount) {
+      added.push_back(*it);
+      it = streamCandidates_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  while (streamCandidates_.size() > kMaxCandidates) {
+    for (auto it = streamCandidates_.begin(); it != streamCandidates_.end();) {
+      if (it->second <= streamPrune_) {
+        it = streamCandidates_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    streamPrune_++;
+  }
+  if (added.empty()) return;
+  std::sort(added.begin(), added.end(),
+            [](const std::pair<std::string, int64_t>& a,
+               const std::pair<std::string, int64_t>& b) {
+              return a.second > b.second ||
+                     (a.second == b.second && a.first < b.first);
+            });
+  int32_t first = dict_->nwords();
+  growWords(first + added.size());
+  growSenses(first + added.size());
+  dict_->promote(added, tokenCount);
+  std::vector<int64_t> counts = dict_->getCounts(entry_type::word);
+  counts.resize(output_->m_, 0);
+  for (auto it = streamModels_.begin(); it != streamModels_.end(); ++it) {
+    (*it)->addNegatives(counts, first);
+  }
+}
+
+void FastText::streamThread(int32_t threadId) {
+  if (args_->numa) {
+    utils::bindToCpus(numaCpus_[threadNode(threadId)]);
+  }
+  Model model(input_, output_, input2_, output2_,
+              inputvar_, input2var_, outputvar_, output2var_,
+              args_, threadId, dict_->nwords());
+  std::vector<int64_t> counts = dict_->getCounts(entry_type::word);
+  counts.resize(output_->m_, 0);
+  model.setTargetCounts(counts);
+  streamModels_[threadId] = &model;
+
+  std::vector<int32_t> line, labels;
+  int64_t round = 0;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(streamMutex_);
+      streamCv_.wait(lock, [&]() {
+        return streamRound_ > round || streamDone_;
+      });
+      if (streamRound_ == round) break;
+      round = streamRound_;
+    }
+    ChunkReader reader(dict_, *chunks_, nullptr, &streamOov_[threadId]);
+    int64_t localTokenCount = 0;
+    int32_t ntokens;
+    Chunk chunk;
+    while (chunks_->next(threadId, chunk)) {
+      reader.open(chunk);
+      while (reader.next(line, labels, model.rng, ntokens)) {
+        localTokenCount += ntokens;
+        if (args_->model == model_name::cbow) {
+          cbow(model, args_->lr, line);
+        } else {
+          skipgram(model, args_->lr, line);
+        }
+      }
+    }
+    tokenCount += localTokenCount;
+    if (threadId == 0) {
+      streamLoss_ = model.getLoss();
+    }
+    {
+      std::lock_guard<std::mutex> lock(streamMutex_);
+      streamArrived_++;
+    }
+    streamCv_.notify_all();
+  }
+}
+
+// Trains on stdin a round of text at a time, starting from the vocabulary of
+// the warm-up text and adding the words that reach -minCount as they come.
+void FastText::trainStream(std::string& text, std::string& carry) {
+  streamRound_ = 0;
+  streamArrived_ = 0;
+  streamDone_ = false;
+  streamPrune_ = 1;
+  streamLoss_ = 0.0;
+  streamModels_.assign(args_->thread, nullptr);
+  streamOov_.assign(args_->thread, std::unordered_map<std::string, int64_t>());
+  std::vector<std::thread> threads;
+  for (int32_t i = 0; i < args_->thread; i++) {
+    threads.push_back(std::thread([=]() { streamThread(i); }));
+  }
+  int64_t bytes = 0;
+  while (!text.empty()) {
+    int64_t size = text.size();
+    chunks_ = std::make_shared<ChunkScheduler>(
+        ChunkScheduler::splitText(text.data(), size,
+                                  ChunkScheduler::chunkSize(size, args_->thread)),
+        size, args_->thread, 1);
+    if (args_->numa) {
+      chunks_->setNodes(threadNodes());
+    }
+    {
+      std::lock_guard<std::mutex> lock(streamMutex_);
+      streamRound_++;
+    }
+    streamCv_.notify_all();
+    {
+      std::unique_lock<std::mutex> lock(streamMutex_);
+      streamCv_.wait(lock, [&]() { return streamArrived_ == args_->thread; });
+      streamArrived_ = 0;
+    }
+    promoteWords();
+    bytes += size;
+    if (args_->verbose > 1) {
+      double t = double(clock() - start) / double(CLOCKS_PER_SEC);
+      std::cerr << std::fixed;
+      std::cerr << "\rRead " << bytes / 1000000 << "MB";
+      std::cerr << "  words/sec/thread: " << std::setw(7)
+                << int64_t(tokenCount / std::max(t, 1e-3));
+      std::cerr << "  words: " << dict_->nwords();
+      std::cerr << "  loss: " << std::setprecision(6) << streamLoss_;
+      std::cerr << std::flush;
+    }
+    readLines(std::cin, text, carry, kStreamRoundBytes);
+  }
+  {
+    std::lock_guard<std::mutex> lock(streamMutex_);
+    streamDone_ = true;
+  }
+  streamCv_.notify_all();
+  for (auto it = threads.begin(); it != threads.end(); ++it) {
+    it->join();
+  }
+  if (args_->verbose > 1) {
+    std::cerr << std::endl;
+  }
+
+  // back to the packed layout of a trained model
+  int32_t nwords = dict_->nwords();
+  int64_t spare = output_->m_ - nwords;
+  input_->eraseRows(nwords, spare);
+  output_->eraseRows(nwords, spare);
+  if (args_->var) {
+    inputvar_->eraseRows(nwords, spare);
+    outputvar_->eraseRows(nwords, spare);
+  }
+  if (input2_) {
+    int64_t blocks = args_->senses - 1;
+    int64_t rows = input2_->m_ / blocks;
+    int64_t kept = std::min<int64_t>(rows, nwords);
+    for (int64_t b = blocks - 1; b >= 0; b--) {
+      input2_->eraseRows(b * rows + kept, rows - kept);
+      output2_->eraseRows(b * rows + kept, rows - kept);
+      if (args_->var) {
+        input2var_->eraseRows(b * rows + kept, rows - kept);
+        output2var_->eraseRows(b * rows + kept, rows - kept);
+      }
+    }
+  }
+  dict_->setWordRows(0);
+}
+
+void FastText::tokenize(std::shared_ptr<Args> args) {
+  args_ = args;
+  dict_ = std::make_shared<Dictionary>(args_);
+  std::vector<std::string> files = utils::expandPaths(args_->input);
+  readVocabulary(files);
+  std::string path = args_->cache.empty() ? args_->output + ".ids" : args_->cache;
+  std::cerr << "Writing ids to " << path << std::endl;
+  IdCache::write(path, files, *dict_);
+}
+
+void FastText::initMatrices(int64_t wordRows) {
   // For initialization of variance
   real logvar = log(args_->var_scale);
 
   if (args_->pretrainedVectors.size() != 0) {
     loadVectors(args_->pretrainedVectors);
   } else {
-    input_ = std::make_shared<Matrix>(dict_->nwords()+args_->bucket, args_->dim);
-    input_->uniform(1.0 / args_->dim);
+    input_ = std::make_shared<Matrix>(wordRows+args_->bucket, args_->dim);
+    input_->uniform(1.0 / args_->dim, kInputStream, args_->thread);
     if (args_->var){
-      inputvar_ = std::make_shared<Matrix>(dict_->nwords(), args_->dim);
-      inputvar_->init(logvar);
+      inputvar_ = std::make_shared<Matrix>(wordRows, args_->dim);
+      inputvar_->init(logvar, args_->thread);
     }
   }
 
+  // with -outputShards the output side is built by shardOutput() instead
+  bool sharded = !args_->outputShards.empty();
+  if (!sharded) {
+    if (args_->model == model_name::sup) {
+      output_ = std::make_shared<Matrix>(dict_->nlabels(), args_->dim);
+    } else {
+      output_ = std::make_shared<Matrix>(wordRows, args_->dim);
+      // Feb6
+      if (args_->var){
+        outputvar_ = std::make_shared<Matrix>(wordRows, args_->dim);
+        outputvar_->init(logvar, args_->thread);
+      }
+    }
+    output_->zero(args_->thread);
+  }
+
+  // BenA: This is for multi-prototype
+  // dictionary ids are sorted by frequency, the top ids get the extra senses,
+  // stacked as (senses - 1) blocks of nsense2 rows
+  int64_t nsense2 = dict_->nwords();
+  if (args_->multi_top > 0 && args_->multi_top < nsense2) {
+    nsense2 = args_->multi_top;
+  }
+  if (args_->multi && args_->model != model_name::sup) {
+    if (args_->pretrainedVectors.size() != 0) {
+      std::cerr << "Pre Trained Option Not Available" << std::endl;
+    }
+    int64_t rows = (args_->senses - 1) * nsense2;
+    input2_ = std::make_shared<Matrix>(rows, args_->dim);
+    input2_->uniform(1.0 / args_->dim, kInput2Stream, args_->thread);
+    if (!sharded) {
+      output2_ = std::make_shared<Matrix>(rows, args_->dim);
+      output2_->zero(args_->thread);
+    }
+    if (args_->var){
+      input2var_ = std::make_shared<Matrix>(rows, args_->dim);
+      input2var_->init(logvar, args_->thread);
+      if (!sharded) {
+        output2var_ = std::make_shared<Matrix>(rows, args_->dim);
+        output2var_->init(logvar, args_->thread);
+      }
+    }
+  }
+}
+
+// Starts from the parameters of -init_model, whose dictionary takes the new
+// words and labels of the input after its own so that known ids are kept.
+// The dimensions and subword settings are those of the model.
+void FastText::initFromModel() {
+  std::ifstream ifs(args_->init_model, std::ifstream::binary);
+  if (!ifs.is_open()) {
+    std::cerr << "Model file cannot be opened for loading!" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (!checkModel(ifs)) {
+    std::cerr << "Model file has wrong file format!" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  Args saved;
+  saved.load(ifs);
+  if (saved.model != args_->model) {
+    std::cerr << args_->init_model << " was trained with another model!"
+              << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  args_->dim = saved.dim;
+  args_->loss = saved.loss;
+  args_->bucket = saved.bucket;
+  args_->minn = saved.minn;
+  args_->maxn = saved.maxn;
+  args_->wordNgrams = saved.wordNgrams;
+  std::shared_ptr<Dictionary> fresh = dict_;
+  dict_ = std::make_shared<Dictionary>(args_);
+  dict_->load(ifs);
+  bool quant_input;
+  ifs.read((char*) &quant_input, sizeof(bool));
+  if (quant_input) {
+    std::cerr << "Cannot continue training from a quantized model!"
+              << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  input_ = std::make_shared<Matrix>();
+  input_->load(ifs);
+  bool qout;
+  ifs.read((char*) &qout, sizeof(bool));
+  output_ = std::make_shared<Matrix>();
+  output_->load(ifs);
+  loadExtraMatrices(ifs);
+  ifs.close();
+  args_->multi = input2_ != nullptr;
+  args_->var = inputvar_ != nullptr;
+
+  int32_t nwords = dict_->nwords();
+  int32_t nlabels = dict_->nlabels();
+  dict_->merge(*fresh);
+  int32_t added = dict_->nwords() - nwords;
+  if (args_->verbose > 0) {
+    std::cerr << "Words added to " << args_->init_model << ": " << added
+              << std::endl;
+  }
+  real logvar = log(args_->var_scale);
+  input_->insertRows(nwords, added);
+  input_->uniformRows(1.0 / args_->dim, nwords, nwords + added, kInputStream);
   if (args_->model == model_name::sup) {
-    output_ = std::make_shared<Matrix>(dict_->nlabels(), args_->dim);
+    output_->insertRows(nlabels, dict_->nlabels() - nlabels);
   } else {
-    output_ = std::make_shared<Matrix>(dict_->nwords(), args_->dim);
-    // Feb6
-    if (args_->var){
-      outputvar_ = std::make_shared<Matrix>(dict_->nwords(), args_->dim);
-      outputvar_->init(logvar);
+    output_->insertRows(nwords, added);
+  }
+  if (inputvar_) {
+    inputvar_->insertRows(nwords, added);
+    inputvar_->initRows(logvar, nwords, nwords + added);
+  }
+  if (outputvar_) {
+    outputvar_->insertRows(nwords, added);
+    outputvar_->initRows(logvar, nwords, nwords + added);
+  }
+}
+
+void FastText::keepRng(int32_t slot, const std::minstd_rand& rng) {
+  if (args_->checkpoint > 0) {
+    std::lock_guard<std::mutex> lock(rngMutex_);
+    rngs_[slot] = rng;
+  }
+}
+
+void FastText::checkpointThread() {
+  std::unique_lock<std::mutex> lock(trainingMutex_);
+  std::chrono::duration<double> every(60 * args_->checkpoint);
+  while (!trainingCv_.wait_for(lock, every, [this]() { return !training_; })) {
+    lock.unlock();
+    saveCheckpoint();
+    lock.lock();
+  }
+}
+
+// A round every -syncEvery tokens trained by this process. Once training
+// is over the rounds go on, with nothing left to send, until every worker
+// is done and all of them hold the last mean.
+void FastText::syncThread() {
+  std::unique_lock<std::mutex> lock(trainingMutex_);
+  int64_t next = args_->syncEvery;
+  while (!sync_->finished()) {
+    trainingCv_.wait_for(lock, std::chrono::milliseconds(50), [&]() {
+      return !training_ || tokenCount >= next;
+    });
+    bool done = !training_;
+    if (!done && tokenCount < next) {
+      continue;
     }
+    lock.unlock();
+    sync_->exchange(done);
+    lock.lock();
+    next = tokenCount + args_->syncEvery;
   }
-  output_->zero();
+}
 
-  // BenA: This is for multi-prototype
-  if (args_->pretrainedVectors.size() != 0) {
-    std::cerr << "Pre Trained Option Not Available" << std::endl;
+// Output senses of every word, as planes of its rows in the shards.
+int32_t FastText::outputSenses() const {
+  return args_->multi && args_->model != model_name::sup ? args_->senses : 1;
+}
+
+// Where plane p of the rows of id lives in the whole output matrices: the
+// senses, then their variances. Null when the word has no such sense.
+real* FastText::outputPlaneRow(int32_t p, int64_t id) {
+  int32_t senses = outputSenses();
+  int32_t k = p % senses;
+  std::shared_ptr<Matrix> m = p < senses ? (k == 0 ? output_ : output2_)
+                                         : (k == 0 ? outputvar_ : output2var_);
+  int64_t nsense2 = senses > 1 ? input2_->m_ / (senses - 1) : 0;
+  if (!m || (k > 0 && id >= nsense2)) {
+    return nullptr;
+  }
+  int64_t row = k == 0 ? id : (k - 1) * nsense2 + id;
+  return m->data_ + row * args_->dim;
+}
+
+// Keeps the output rows of this process's range in its shard, from
+// -init_model or as initMatrices() would set them, and drops the whole
+// matrices: the other rows are pulled from their owners while training.
+void FastText::shardOutput() {
+  if (args_->loss != loss_name::ns) {
+    std::cerr << "-outputShards needs -loss ns!" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  std::istringstream owners(args_->outputShards);
+  std::string owner;
+  while (std::getline(owners, owner, ',')) {
+    shardOwners_.push_back(owner);
+  }
+  bool words = args_->model != model_name::sup;
+  int32_t senses = outputSenses();
+  int32_t planes = args_->var && words ? 2 * senses : senses;
+  int64_t dim = args_->dim;
+  shardBounds_ = OutputShard::bounds(words ? dict_->nwords()
+                                           : dict_->nlabels(),
+                                     args_->workers);
+  int64_t begin = shardBounds_[args_->rank];
+  int64_t end = shardBounds_[args_->rank + 1];
+  outputShard_ = std::make_shared<OutputShard>(begin, end, planes * dim);
+  real logvar = log(args_->var_scale);
+  for (int64_t id = begin; id < end; id++) {
+    real* row = outputShard_->row(id);
+    for (int32_t p = 0; p < planes; p++) {
+      const real* from = outputPlaneRow(p, id);
+      if (from) {
+        std::copy(from, from + dim, row + p * dim);
+      } else if (p >= senses) {
+        std::fill(row + p * dim, row + (p + 1) * dim, logvar);
+      }
+    }
+  }
+  output_.reset();
+  output2_.reset();
+  outputvar_.reset();
+  output2var_.reset();
+  owner = shardOwners_[args_->rank];
+  outputShard_->listen(atoi(owner.substr(owner.rfind(':') + 1).c_str()));
+  if (args_->verbose > 0) {
+    std::cerr << "Output rows of this worker: " << end - begin << std::endl;
+  }
+}
+
+// Rank 0 reads every output row back into whole matrices for the model it
+// writes; the other ranks serve their shard until it has.
+void FastText::gatherOutput() {
+  if (args_->rank > 0) {
+    outputShard_->waitReleased();
+    outputShard_.reset();
+    return;
+  }
+  std::vector<real> rows;
+  OutputShard::gather(outputShard_, args_->rank, shardOwners_, shardBounds_,
+                      rows);
+  int64_t width = outputShard_->width();
+  outputShard_.reset();
+  bool words = args_->model != model_name::sup;
+  int32_t senses = outputSenses();
+  int64_t nrows = shardBounds_.back();
+  int64_t dim = args_->dim;
+  output_ = std::make_shared<Matrix>(nrows, dim);
+  if (senses > 1) {
+    output2_ = std::make_shared<Matrix>(input2_->m_, dim);
+  }
+  if (args_->var && words) {
+    outputvar_ = std::make_shared<Matrix>(nrows, dim);
+    if (senses > 1) {
+      output2var_ = std::make_shared<Matrix>(input2_->m_, dim);
+    }
+  }
+  for (int64_t id = 0; id < nrows; id++) {
+    for (int32_t p = 0; p < width / dim; p++) {
+      real* to = outputPlaneRow(p, id);
+      if (to) {
+        const real* from = rows.data() + id * width + p * dim;
+        std::copy(from, from + dim, to);
+      }
+    }
+  }
+}
+
+// What snapshot() needs besides the matrices to write a model.
+static std::string modelMeta(Args& args, Dictionary& dict) {
+  std::ostringstream meta;
+  args.save(meta);
+  dict.save(meta);
+  meta.write((char*) &(args.senses), sizeof(int));
+  return meta.str();
+}
+
+// The first process of a -shm run copies its parameters into the segment,
+// the others check theirs have the same shapes; all of them then train on
+// the rows of the segment without any averaging.
+void FastText::shareParameters() {
+  auto slots = parameters();
+  std::vector<std::shared_ptr<Matrix>> params;
+  for (auto it = slots.cbegin(); it != slots.cend(); ++it) {
+    params.push_back(**it);
+  }
+  store_ = SharedStore::create(args_->shm, modelMeta(*args_, *dict_), params,
+                               dict_->fingerprint(), args_->workers);
+  if (!store_) {
+    store_ = SharedStore::attach(args_->shm, false, 60.0);
+    if (!store_) {
+      std::cerr << "Cannot attach the shared memory segment " << args_->shm
+                << "!" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    if (store_->fingerprint() != dict_->fingerprint() ||
+        !store_->sameShapes(params)) {
+      std::cerr << args_->shm << " holds the parameters of another model!"
+                << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (!store_->join(args_->rank)) {
+    std::cerr << args_->shm << " is left over from an earlier run, remove "
+              << "it first." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  std::vector<std::shared_ptr<Matrix>> views = store_->matrices();
+  for (size_t i = 0; i < slots.size(); i++) {
+    *slots[i] = views[i];
+  }
+}
+
+// Writes <output>.bin and .vec from the segment of a -shm run, which may
+// still be training: rows updated meanwhile are taken as they are.
+void FastText::snapshot(const std::string& name, const std::string& output) {
+  store_ = SharedStore::attach(name, true, 0.0);
+  if (!store_) {
+    std::cerr << "Cannot attach the shared memory segment " << name << "!"
+              << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  std::istringstream meta(store_->meta());
+  args_ = std::make_shared<Args>();
+  args_->load(meta);
+  dict_ = std::make_shared<Dictionary>(args_);
+  dict_->load(meta);
+  int senses;
+  meta.read((char*) &senses, sizeof(int));
+  auto slots = parameters();
+  std::vector<std::shared_ptr<Matrix>> views = store_->matrices();
+  for (size_t i = 0; i < slots.size(); i++) {
+    *slots[i] = views[i];
+  }
+  args_->multi = input2_ != nullptr;
+  args_->var = inputvar_ != nullptr;
+  args_->senses = senses;
+  args_->output = output;
+  saveModel();
+  if (args_->model != model_name::sup) {
+    saveVectors();
+  }
+}
+
+// Reads the shape of the matrix at the position of in and skips its rows.
+static void skipMatrix(std::istream& in, int64_t& m, int64_t& n) {
+  in.read((char*) &m, sizeof(int64_t));
+  in.read((char*) &n, sizeof(int64_t));
+  in.seekg(m * n * sizeof(real), std::ios_base::cur);
+}
+
+// Calls fn(begin, end) on one block of [0, n) per thread.
+static void parallelRows(int64_t n, int32_t threads,
+                         const std::function<void(int64_t, int64_t)>& fn) {
+  if (n <= 0) return;
+  int64_t block = (n + threads - 1) / threads;
+  std::vector<std::thread> pool;
+  for (int64_t b = 0; b < n; b += block) {
+    pool.push_back(std::thread(fn, b, std::min(n, b + block)));
+  }
+  for (auto it = pool.begin(); it != pool.end(); ++it) {
+    it->join();
+  }
+}
+
+// Combines models trained with the same args on disjoint shards of a
+// corpus. The dictionaries are merged, their counts summed and sorted
+// again. Every row is the mean of the rows of the shards, a word weighted
+// by its count in each and a char ngram bucket by the counts of the words
+// using it there. A sense a shard did not give a word is its first one,
+// as in training.
+void FastText::merge(const std::vector<std::string>& paths,
+                     const std::string& output, int32_t threads) {
+  const int32_t kMatrices = 8;
+  // the sense 0 matrix of each sense matrix, by parameters() slot
+  const int32_t kBase[] = {0, 1, 0, 1, 4, 4, 6, 6};
+  int32_t nshards = paths.size();
+  std::vector<std::shared_ptr<Dictionary>> dicts;
+  // rows of the eight matrices of each shard, -1 when absent
+  std::vector<std::vector<int64_t>> shapes;
+  int32_t senses = 1;
+  for (int32_t s = 0; s < nshards; s++) {
+    std::ifstream ifs(paths[s], std::ifstream::binary);
+    if (!ifs.is_open() || !checkModel(ifs)) {
+      std::cerr << paths[s] << " is not a model file!" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    std::shared_ptr<Args> args = std::make_shared<Args>();
+    args->load(ifs);
+    std::shared_ptr<Dictionary> dict = std::make_shared<Dictionary>(args);
+    dict->load(ifs);
+    bool quant, qout;
+    ifs.read((char*) &quant, sizeof(bool));
+    if (quant) {
+      std::cerr << "Cannot merge the quantized model " << paths[s] << "!"
+                << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    std::vector<int64_t> rows(kMatrices, -1);
+    int64_t cols;
+    skipMatrix(ifs, rows[0], cols);
+    ifs.read((char*) &qout, sizeof(bool));
+    skipMatrix(ifs, rows[1], cols);
+    int shardSenses = 1;
+    if (ifs.peek() != EOF) {
+      int saved;
+      ifs.read((char*) &saved, sizeof(int));
+      for (int32_t i = 2; i < kMatrices; i++) {
+        bool present;
+        ifs.read((char*) &present, sizeof(bool));
+        if (present) {
+          skipMatrix(ifs, rows[i], cols);
+        }
+      }
+      if (rows[2] >= 0) {
+        shardSenses = saved;
+      }
+    }
+    if (s == 0) {
+      args_ = args;
+      senses = shardSenses;
+    } else {
+      bool same = args->dim == args_->dim && args->model == args_->model &&
+                  args->loss == args_->loss && args->bucket == args_->bucket &&
+                  args->minn == args_->minn && args->maxn == args_->maxn &&
+                  args->wordNgrams == args_->wordNgrams &&
+                  shardSenses == senses;
+      for (int32_t i = 0; i < kMatrices; i++) {
+        same = same && (rows[i] >= 0) == (shapes[0][i] >= 0);
+      }
+      if (!same) {
+        std::cerr << paths[s] << " was not trained with the args of "
+                  << paths[0] << "!" << std::endl;
+        exit(EXIT_FAILURE);
+      }
+    }
+    dicts.push_back(dict);
+    shapes.push_back(rows);
+  }
+
+  args_->output = output;
+  dict_ = std::make_shared<Dictionary>(*dicts[0]);
+  for (int32_t s = 1; s < nshards; s++) {
+    dict_->merge(*dicts[s]);
+  }
+  dict_->sortByCount();
+  bool sup = args_->model == model_name::sup;
+  int32_t nwords = dict_->nwords();
+  int64_t dim = args_->dim;
+  int64_t bucket = args_->bucket;
+  // counts by entry id, words then labels
+  auto entryCounts = [](const Dictionary& dict) {
+    std::vector<int64_t> counts = dict.getCounts(entry_type::word);
+    std::vector<int64_t> labels = dict.getCounts(entry_type::label);
+    counts.insert(counts.end(), labels.begin(), labels.end());
+    return counts;
+  };
+  std::vector<int64_t> counts = entryCounts(*dict_);
+
+  // the id of every merged entry in each shard, and the weight of each
+  // shard in every bucket
+  std::vector<std::vector<int32_t>> ids(nshards);
+  std::vector<std::vector<real>> bucketWeights(nshards);
+  std::vector<double> usage(bucket, 0.0);
+  std::vector<std::vector<double>> shardUsage(nshards);
+  std::vector<int64_t> nsense2(nshards, 0);
+  int64_t mergedSense2 = 0;
+  bool allSense2 = true;
+  for (int32_t s = 0; s < nshards; s++) {
+    const Dictionary& dict = *dicts[s];
+    ids[s].resize(counts.size());
+    for (size_t e = 0; e < counts.size(); e++) {
+      ids[s][e] = dict.getId(dict_->getWord(e));
+    }
+    std::vector<int64_t> shardCounts = dict.getCounts(entry_type::word);
+    shardUsage[s].assign(bucket, 0.0);
+    for (int32_t w = 0; w < dict.nwords(); w++) {
+      const std::vector<int32_t>& ngrams = dict.getNgrams(w);
+      for (auto it = ngrams.cbegin(); it != ngrams.cend(); ++it) {
+        if (*it >= dict.nwords()) {
+          shardUsage[s][*it - dict.nwords()] += shardCounts[w];
+          usage[*it - dict.nwords()] += shardCounts[w];
+        }
+      }
+    }
+    if (senses > 1) {
+      nsense2[s] = shapes[s][2] / (senses - 1);
+      mergedSense2 = std::max(mergedSense2, nsense2[s]);
+      allSense2 = allSense2 && nsense2[s] == dict.nwords();
+    }
+  }
+  for (int32_t s = 0; s < nshards; s++) {
+    bucketWeights[s].resize(bucket);
+    for (int64_t b = 0; b < bucket; b++) {
+      bucketWeights[s][b] = usage[b] > 0 ? shardUsage[s][b] / usage[b]
+                                         : 1.0 / nshards;
+    }
+  }
+  if (senses > 1) {
+    mergedSense2 = allSense2 ? nwords : std::min<int64_t>(nwords, mergedSense2);
+  }
+
+  auto slots = parameters();
+  int64_t rows[] = {nwords + bucket,
+                    sup ? dict_->nlabels() : nwords,
+                    (senses - 1) * mergedSense2, (senses - 1) * mergedSense2,
+                    nwords, (senses - 1) * mergedSense2,
+                    nwords, (senses - 1) * mergedSense2};
+  for (int32_t i = 0; i < kMatrices; i++) {
+    slots[i]->reset();
+    if (shapes[0][i] >= 0) {
+      *slots[i] = std::make_shared<Matrix>(rows[i], dim);
+      (*slots[i])->zero(threads);
+    }
+  }
+  for (int32_t s = 0; s < nshards; s++) {
+    FastText shard;
+    shard.loadModel(paths[s]);
+    auto from = shard.parameters();
+    std::vector<int64_t> shardCounts = entryCounts(*dicts[s]);
+    int32_t shardWords = dicts[s]->nwords();
+    for (int32_t i = 0; i < kMatrices; i++) {
+      if (!*slots[i]) continue;
+      Matrix& to = **slots[i];
+      parallelRows(to.m_, threads, [&](int64_t begin, int64_t end) {
+        for (int64_t r = begin; r < end; r++) {
+          // the merged entry of row r, and the row of the shard
+          int64_t e = r;
+          int64_t k = 0;
+          if (i == 0 && r >= nwords) {
+            const real* src = (*from[0])->data_ + (shardWords + r - nwords) * dim;
+            real w = bucketWeights[s][r - nwords];
+            for (int64_t j = 0; j < dim; j++) {
+              to.data_[r * dim + j] += w * src[j];
+            }
+            continue;
+          }
+          if (i == 1 && sup) {
+            e = nwords + r;
+          } else if (kBase[i] != i) {
+            e = r % mergedSense2;
+            k = r / mergedSense2 + 1;
+          }
+          int32_t id = ids[s][e];
+          if (id < 0) continue;
+          const real* src;
+          if (k > 0 && id < nsense2[s]) {
+            src = (*from[i])->data_ + ((k - 1) * nsense2[s] + id) * dim;
+          } else {
+            int64_t row = i == 1 && sup ? id - shardWords : id;
+            src = (*from[kBase[i]])->data_ + row * dim;
+          }
+          real w = double(shardCounts[id]) / double(counts[e]);
+          for (int64_t j = 0; j < dim; j++) {
+            to.data_[r * dim + j] += w * src[j];
+          }
+        }
+      });
+    }
+  }
+  args_->multi = input2_ != nullptr;
+  args_->var = inputvar_ != nullptr;
+  args_->senses = senses;
+  saveModel();
+  if (!sup) {
+    saveVectors();
+  }
+  std::cerr << "Merged " << nshards << " models: " << nwords << " words, "
+            << dict_->nlabels() << " labels" << std::endl;
+}
+
+void FastText::setActiveThreads(int32_t count) {
+  {
+    std::lock_guard<std::mutex> lock(parkMutex_);
+    activeThreads_ = count;
+  }
+  parkCv_.notify_all();
+}
+
+// Once a thread is out of input the parked ones finish what they hold.
+void FastText::park(int32_t threadId) {
+  if (threadId < activeThreads_) {
+    return;
+  }
+  std::unique_lock<std::mutex> lock(parkMutex_);
+  parkCv_.wait(lock, [&]() {
+    return threadId < activeThreads_ || threadsDone_ > 0;
+  });
+}
+
+// -thread auto: trains with 1, 2, 4, ... of the threads and keeps the
+// count with the most words/sec. Past the best count, memory bandwidth
+// rather than cores limits the speed, so the first slower count ends the
+// search.
+void FastText::tuneThreads() {
+  std::vector<int32_t> counts;
+  for (int32_t c = 1; c < args_->thread; c *= 2) {
+    counts.push_back(c);
+  }
+  counts.push_back(args_->thread);
+  int32_t best = args_->thread;
+  double bestRate = 0.0;
+  std::ostringstream tried;
+  std::unique_lock<std::mutex> lock(trainingMutex_);
+  auto stopped = [&](double seconds) {
+    return trainingCv_.wait_for(lock, std::chrono::duration<double>(seconds),
+                                [&]() { return !training_; });
+  };
+  // the threads first set up their models
+  while (tokenCount == 0 && !stopped(0.05)) {}
+  for (auto it = counts.cbegin(); it != counts.cend() && training_; ++it) {
+    setActiveThreads(*it);
+    if (stopped(kTuneWarmup)) break;
+    int64_t tokens = tokenCount;
+    auto begin = std::chrono::steady_clock::now();
+    if (stopped(kTuneSeconds)) break;
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - begin;
+    double rate = (tokenCount - tokens) / elapsed.count();
+    tried << "  " << *it << ": " << int64_t(rate);
+    if (rate > bestRate) {
+      bestRate = rate;
+      best = *it;
+    } else {
+      break;
+    }
+  }
+  setActiveThreads(best);
+  if (args_->verbose > 0 && bestRate > 0.0) {
+    std::cerr << "\rWords/sec by threads:" << tried.str() << "  using "
+              << best << std::endl;
+  }
+}
+
+// The eight parameter matrices, null when the model does not have one.
+std::vector<std::shared_ptr<Matrix>*> FastText::parameters() {
+  return {&input_, &output_, &input2_, &output2_,
+          &inputvar_, &input2var_, &outputvar_, &output2var_};
+}
+
+std::string FastText::checkpointPath(int32_t delta) const {
+  std::string path = args_->output + ".ckpt";
+  return delta > 0 ? path + "." + std::to_string(delta) : path;
+}
+
+// The chunks done and the random state of every thread, taken before any
+// row is copied: the rows read afterwards hold at least their updates, and
+// a chunk finished meanwhile is simply trained again on resume.
+std::string FastText::checkpointProgress() {
+  std::ostringstream progress;
+  chunks_->save(progress);
+  std::lock_guard<std::mutex> lock(rngMutex_);
+  int32_t n = rngs_.size();
+  progress.write((char*) &n, sizeof(int32_t));
+  for (int32_t i = 0; i < n; i++) {
+    progress << rngs_[i] << '\0';
+  }
+  return progress.str();
+}
+
+// The first checkpoint is a full base holding what a model does and the
+// input files with the size of their text; the next ones are deltas with
+// the rows written since, until they add up to the size of the base.
+// The training threads go on while either is written.
+void FastText::saveCheckpoint() {
+  std::string progress = checkpointProgress();
+  if (deltas_ < 0 || deltaBytes_ >= baseBytes_) {
+    // stale deltas would undo rows of the new base
+    removeDeltas();
+    writeCheckpoint(progress);
   } else {
-    input2_ = std::make_shared<Matrix>(dict_->nwords(), args_->dim);
-    input2_->uniform(1.0 / args_->dim);
-    if (args_->multi && args_->var){
-      input2var_ = std::make_shared<Matrix>(dict_->nwords(), args_->dim);
-      input2var_->init(logvar);
+    writeDelta(progress);
+  }
+}
+
+void FastText::removeDeltas() {
+  for (int32_t i = 1; std::remove(checkpointPath(i).c_str()) == 0; i++) {}
+  deltas_ = 0;
+  deltaBytes_ = 0;
+}
+
+// Writes path through a temporary file, so that a crash keeps the old one.
+static bool commitFile(const std::string& path,
+                       const std::function<void(std::ostream&)>& fn,
+                       int64_t& bytes) {
+  std::ofstream ofs(path + ".tmp", std::ofstream::binary);
+  if (!ofs.is_open()) {
+    std::cerr << "Checkpoint file cannot be opened for saving!" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  fn(ofs);
+  bytes = ofs.tellp();
+  ofs.close();
+  if (!ofs || std::rename((path + ".tmp").c_str(), path.c_str()) != 0) {
+    std::cerr << "Checkpoint " << path << " could not be written!"
+              << std::endl;
+    return false;
+  }
+  return true;
+}
+
+void FastText::writeCheckpoint(const std::string& progress) {
+  std::string path = checkpointPath(0);
+  bool ok = commitFile(path, [&](std::ostream& out) {
+    signModel(out);
+    args_->save(out);
+    dict_->save(out);
+    int32_t nfiles = inputFiles_.size();
+    out.write((char*) &nfiles, sizeof(int32_t));
+    for (int32_t f = 0; f < nfiles; f++) {
+      out.write(inputFiles_[f].data(), inputFiles_[f].size() + 1);
+      out.write((char*) &textBytes_[f], sizeof(int64_t));
+    }
+    auto params = parameters();
+    for (auto it = params.begin(); it != params.end(); ++it) {
+      if (**it) (**it)->clearDirty();
     }
+    input_->save(out);
+    output_->save(out);
+    saveExtraMatrices(out);
+    out << progress;
+  }, baseBytes_);
+  if (ok && args_->verbose > 1) {
+    std::cerr << std::endl << "Checkpoint saved to " << path << std::endl;
   }
-  output2_ = std::make_shared<Matrix>(dict_->nwords(), args_->dim);
-  output2_->zero();
-  if (args_->multi && args_->var){
-    output2var_ = std::make_shared<Matrix>(dict_->nwords(), args_->dim);
-    output2var_->init(logvar);
+}
+
+void FastText::writeDelta(const std::string& progress) {
+  std::string path = checkpointPath(deltas_ + 1);
+  int64_t rows = 0;
+  int64_t bytes;
+  bool ok = commitFile(path, [&](std::ostream& out) {
+    signModel(out);
+    auto params = parameters();
+    for (auto it = params.begin(); it != params.end(); ++it) {
+      bool present = **it != nullptr;
+      out.write((char*) &present, sizeof(bool));
+      if (present) {
+        rows += (**it)->saveDirty(out);
+      }
+    }
+    out << progress;
+  }, bytes);
+  if (!ok) return;
+  deltas_++;
+  deltaBytes_ += bytes;
+  if (args_->verbose > 1) {
+    std::cerr << std::endl << "Checkpoint delta of " << rows
+              << " rows saved to " << path << std::endl;
   }
+}
 
-  start = clock();
-  tokenCount = 0;
-  if (args_->thread > 1) {
-    std::vector<std::thread> threads;
-    for (int32_t i = 0; i < args_->thread; i++) {
-      threads.push_back(std::thread([=]() { trainThread(i); }));
+// Applies the deltas after the base, and returns the last one, positioned
+// at its progress, or nullptr when there is none.
+std::unique_ptr<std::ifstream> FastText::loadDeltas() {
+  std::unique_ptr<std::ifstream> last;
+  deltas_ = 0;
+  deltaBytes_ = 0;
+  for (int32_t i = 1;; i++) {
+    std::unique_ptr<std::ifstream> in(
+        new std::ifstream(checkpointPath(i), std::ifstream::binary));
+    if (!in->is_open()) break;
+    if (!checkModel(*in)) {
+      std::cerr << checkpointPath(i) << " has wrong file format!" << std::endl;
+      exit(EXIT_FAILURE);
     }
-    for (auto it = threads.begin(); it != threads.end(); ++it) {
-      it->join();
+    auto params = parameters();
+    for (auto it = params.begin(); it != params.end(); ++it) {
+      bool present;
+      in->read((char*) &present, sizeof(bool));
+      if (present != (**it != nullptr)) {
+        std::cerr << checkpointPath(i) << " does not match the checkpoint!"
+                  << std::endl;
+        exit(EXIT_FAILURE);
+      }
+      if (present) {
+        (**it)->loadDirty(*in);
+      }
+    }
+    deltas_ = i;
+    int64_t pos = in->tellg();
+    deltaBytes_ += utils::size(*in);
+    utils::seek(*in, pos);
+    last = std::move(in);
+  }
+  return last;
+}
+
+// nullptr when -resume finds no checkpoint, which starts a new run.
+std::unique_ptr<std::ifstream> FastText::openCheckpoint() {
+  std::string path = checkpointPath(0);
+  std::unique_ptr<std::ifstream> in(
+      new std::ifstream(path, std::ifstream::binary));
+  if (!in->is_open()) {
+    std::cerr << "No checkpoint " << path << ", starting anew" << std::endl;
+    return nullptr;
+  }
+  if (!checkModel(*in)) {
+    std::cerr << path << " has wrong file format!" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  int64_t pos = in->tellg();
+  baseBytes_ = utils::size(*in);
+  utils::seek(*in, pos);
+  return in;
+}
+
+void FastText::loadInputFiles(std::istream& in) {
+  int32_t nfiles;
+  in.read((char*) &nfiles, sizeof(int32_t));
+  inputFiles_.assign(nfiles, "");
+  textBytes_.assign(nfiles, 0);
+  for (int32_t f = 0; f < nfiles; f++) {
+    std::getline(in, inputFiles_[f], '\0');
+    in.read((char*) &textBytes_[f], sizeof(int64_t));
+  }
+}
+
+// Reads the checkpoint up to its parameters. The settings fixed by them
+// override the command line, as for -init_model.
+void FastText::loadCheckpoint(std::istream& in,
+                              const std::vector<std::string>& files,
+                              std::vector<int64_t>& textBytes) {
+  std::cerr << "Resuming from " << checkpointPath(0) << std::endl;
+  Args saved;
+  saved.load(in);
+  if (saved.model != args_->model) {
+    std::cerr << "The checkpoint was trained with another model!" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  args_->dim = saved.dim;
+  args_->loss = saved.loss;
+  args_->bucket = saved.bucket;
+  args_->minn = saved.minn;
+  args_->maxn = saved.maxn;
+  args_->wordNgrams = saved.wordNgrams;
+  dict_ = std::make_shared<Dictionary>(args_);
+  dict_->load(in);
+  loadInputFiles(in);
+  if (inputFiles_ != files) {
+    std::cerr << "The checkpoint was written for other input files."
+              << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  textBytes = textBytes_;
+}
+
+void FastText::loadCheckpointParameters(std::istream& in) {
+  input_ = std::make_shared<Matrix>();
+  input_->load(in);
+  output_ = std::make_shared<Matrix>();
+  output_->load(in);
+  loadExtraMatrices(in);
+}
+
+// Folds the deltas of <output>.ckpt into a new base. The deltas are only
+// removed once it is in place: applied again they would change nothing.
+void FastText::compactCheckpoint(const std::string& output) {
+  args_ = std::make_shared<Args>();
+  args_->output = output;
+  std::unique_ptr<std::ifstream> base = openCheckpoint();
+  if (!base) {
+    exit(EXIT_FAILURE);
+  }
+  args_->load(*base);
+  dict_ = std::make_shared<Dictionary>(args_);
+  dict_->load(*base);
+  loadInputFiles(*base);
+  loadCheckpointParameters(*base);
+  std::unique_ptr<std::ifstream> last = loadDeltas();
+  if (!last) {
+    std::cerr << "No checkpoint deltas to fold into " << checkpointPath(0)
+              << std::endl;
+    return;
+  }
+  int32_t deltas = deltas_;
+  std::string progress((std::istreambuf_iterator<char>(*last)),
+                       std::istreambuf_iterator<char>());
+  writeCheckpoint(progress);
+  removeDeltas();
+  std::cerr << "Folded " << deltas << " deltas into " << checkpointPath(0)
+            << std::endl;
+}
+
+void FastText::train(std::shared_ptr<Args> args) {
+  args_ = args;
+  dict_ = std::make_shared<Dictionary>(args_);
+  bool streaming = args_->input == "-";
+  std::vector<std::string> files;
+  std::vector<int64_t> textBytes;
+  std::string text, carry;
+  std::unique_ptr<std::ifstream> checkpoint;
+  // rows of the input matrix before the char ngram buckets
+  int64_t wordRows;
+  if (streaming) {
+    if (args_->model == model_name::sup || args_->loss != loss_name::ns) {
+      std::cerr << "Training on stdin needs -loss ns with skipgram or cbow!"
+                << std::endl;
+      exit(EXIT_FAILURE);
     }
+    if (args_->readers > 0 || !args_->cache.empty() ||
+        !args_->pretrainedVectors.empty() || !args_->init_model.empty() ||
+        args_->checkpoint > 0 || args_->resume || args_->workers > 1 ||
+        !args_->shm.empty()) {
+      std::cerr << "-readers, -cache, -pretrainedVectors, -init_model, "
+                << "-checkpoint, -resume, -workers and -shm cannot be used "
+                << "with stdin!" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    readLines(std::cin, text, carry, int64_t(args_->warmup) << 20);
+    dict_->addText(text.data(), text.data() + text.size());
+    dict_->initVocab();
+    wordRows = reserveRows(dict_->nwords());
+    dict_->setWordRows(wordRows);
   } else {
-    trainThread(0);
+    if (!args_->init_model.empty() && !args_->pretrainedVectors.empty()) {
+      std::cerr << "-init_model and -pretrainedVectors cannot be used together!"
+                << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    if (args_->workers > 1 && (args_->checkpoint > 0 || args_->resume)) {
+      std::cerr << "-checkpoint and -resume cannot be used with -workers!"
+                << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    files = utils::expandPaths(args_->input);
+    if (args_->verbose > 0 && files.size() > 1) {
+      std::cerr << "Input files: " << files.size() << std::endl;
+    }
+    if (args_->resume) {
+      checkpoint = openCheckpoint();
+    }
+    if (checkpoint) {
+      loadCheckpoint(*checkpoint, files, textBytes);
+    } else {
+      textBytes = readVocabulary(files);
+    }
+    wordRows = dict_->nwords();
+  }
+  // spread the pages of the parameter matrices over all nodes
+  if (args_->numa) {
+    numaCpus_ = utils::numaNodeCpus();
+    nodeTokens_.reset(new std::atomic<int64_t>[numaCpus_.size()]);
+    cpuNodes_.clear();
+    for (size_t n = 0; n < numaCpus_.size(); n++) {
+      nodeTokens_[n] = 0;
+      if (!numaCpus_[n].empty()) {
+        cpuNodes_.push_back(n);
+      } else if (numaCpus_.size() > 1) {
+        std::cerr << "Warning: NUMA node " << n << " has no CPUs, no threads "
+                  << "run on it." << std::endl;
+      }
+    }
+    // no cpulists to read: one unpinned node
+    if (cpuNodes_.empty()) {
+      cpuNodes_.push_back(0);
+    }
+    std::cerr << "NUMA nodes: " << numaCpus_.size() << std::endl;
+    utils::setInterleave(numaCpus_.size());
+  }
+
+  if (checkpoint) {
+    loadCheckpointParameters(*checkpoint);
+    std::unique_ptr<std::ifstream> last = loadDeltas();
+    if (last) {
+      checkpoint = std::move(last);
+    }
+    args_->multi = input2_ != nullptr;
+    args_->var = inputvar_ != nullptr;
+  } else if (!args_->init_model.empty()) {
+    initFromModel();
+  } else {
+    initMatrices(wordRows);
+  }
+
+  if (args_->numa) {
+    utils::setInterleave(0);
+  }
+
+  if (streaming) {
+    start = clock();
+    tokenCount = 0;
+    trainStream(text, carry);
+  } else {
+    trainFiles(files, textBytes, checkpoint.get());
   }
   model_ = std::make_shared<Model>(input_, output_, input2_, output2_, inputvar_, input2var_, outputvar_, output2var_, args_, 0, dict_->nwords());
 
+  // the workers end with the same parameters, rank 0 writes them
+  if (args_->rank > 0) {
+    return;
+  }
   saveModel();
   if (args_->model != model_name::sup) {
     saveVectors();
@@ -821,6 +2345,181 @@ void FastText::train(std::shared_ptr<Args> args) {
     }
   }
   saveNgramVectors(args_->output);
+  if (args_->checkpoint > 0 || args_->resume) {
+    removeDeltas();
+    std::remove(checkpointPath(0).c_str());
+  }
+  if (store_) {
+    SharedStore::unlink(args_->shm);
+  }
+}
+
+// Sets up the chunks of the input and the state the training threads
+// share, for train() and the -retrain of quantize().
+void FastText::startChunks(const std::vector<std::string>& files,
+                           const std::vector<int64_t>& textBytes) {
+  // with -readers the chunks go to the reader threads instead
+  int32_t consumers = args_->readers > 0 ? args_->readers : args_->thread;
+  if (!args_->cache.empty()) {
+    if (IdCache::matches(args_->cache, dict_->fingerprint())) {
+      std::cerr << "Reading ids from " << args_->cache << std::endl;
+    } else {
+      std::cerr << "Writing ids to " << args_->cache << std::endl;
+      IdCache::write(args_->cache, files, *dict_);
+    }
+    idCache_ = std::make_shared<IdCache>(args_->cache);
+    int64_t bytes = idCache_->bytes();
+    chunks_ = std::make_shared<ChunkScheduler>(
+        idCache_->split(dict_->getId(Dictionary::EOS),
+                        ChunkScheduler::chunkSize(
+                            bytes, consumers * args_->workers)),
+        bytes, consumers, args_->epoch);
+  } else {
+    int64_t bytes = 0;
+    for (auto it = textBytes.cbegin(); it != textBytes.cend(); ++it) {
+      bytes += *it;
+    }
+    chunks_ = std::make_shared<ChunkScheduler>(
+        files, textBytes, consumers, args_->epoch,
+        ChunkScheduler::chunkSize(bytes, consumers * args_->workers));
+  }
+  if (args_->workers > 1) {
+    chunks_->shard(args_->rank, args_->workers);
+  }
+  if (args_->numa && args_->readers == 0) {
+    chunks_->setNodes(threadNodes());
+  }
+  resumed_ = false;
+  rngs_.assign(args_->thread + args_->readers, std::minstd_rand());
+  activeThreads_ = args_->thread;
+  threadsDone_ = 0;
+}
+
+void FastText::trainFiles(const std::vector<std::string>& files,
+                          const std::vector<int64_t>& textBytes,
+                          std::istream* checkpoint) {
+  startChunks(files, textBytes);
+  if (!args_->shm.empty()) {
+    shareParameters();
+  } else if (args_->workers > 1) {
+    if (!args_->outputShards.empty()) {
+      shardOutput();
+    }
+    std::vector<std::shared_ptr<Matrix>> params;
+    auto slots = parameters();
+    for (auto it = slots.cbegin(); it != slots.cend(); ++it) {
+      params.push_back(**it);
+    }
+    sync_.reset(new ParameterSync(args_, params, dict_->fingerprint()));
+  }
+  resumed_ = checkpoint != nullptr;
+  if (resumed_) {
+    chunks_->restore(*checkpoint);
+    int32_t n;
+    checkpoint->read((char*) &n, sizeof(int32_t));
+    rngs_.resize(n);
+    for (int32_t i = 0; i < n; i++) {
+      std::string state;
+      std::getline(*checkpoint, state, '\0');
+      std::istringstream(state) >> rngs_[i];
+    }
+    if (n != args_->thread + args_->readers) {
+      std::cerr << "The checkpoint was written with other -thread and "
+                << "-readers." << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    std::cerr << "Resuming at " << std::setprecision(1) << std::fixed
+              << 100 * chunks_->progress() << "%" << std::endl;
+  }
+  rngs_.resize(args_->thread + args_->readers);
+  inputFiles_ = files;
+  textBytes_ = textBytes;
+  if (args_->checkpoint > 0) {
+    if (!resumed_) {
+      deltas_ = -1;
+    }
+    auto params = parameters();
+    for (auto it = params.begin(); it != params.end(); ++it) {
+      if (**it) {
+        (**it)->trackDirty();
+        (**it)->clearDirty();
+      }
+    }
+  }
+  if (args_->readers > 0) {
+    lineQueue_.reset(new MpmcQueue<std::unique_ptr<LineBatch>>(
+        4 * (args_->readers + args_->thread)));
+    readersDone_ = 0;
+    readersClosed_ = false;
+  }
+
+  start = clock();
+  auto wallStart = std::chrono::steady_clock::now();
+  tokenCount = 0;
+  std::thread checkpointer, syncer, tuner;
+  training_ = true;
+  if (args_->checkpoint > 0) {
+    checkpointer = std::thread([this]() { checkpointThread(); });
+  }
+  if (sync_) {
+    syncer = std::thread([this]() { syncThread(); });
+  }
+  if (args_->thread_auto && args_->thread > 1) {
+    setActiveThreads(1);
+    tuner = std::thread([this]() { tuneThreads(); });
+  }
+  if (args_->thread > 1 || args_->readers > 0) {
+    std::vector<std::thread> threads;
+    for (int32_t i = 0; i < args_->readers; i++) {
+      threads.push_back(std::thread([=]() { readerThread(i); }));
+    }
+    for (int32_t i = 0; i < args_->thread; i++) {
+      threads.push_back(std::thread([=]() { trainThread(i); }));
+    }
+    for (auto it = threads.begin(); it != threads.end(); ++it) {
+      it->join();
+    }
+  } else {
+    trainThread(0);
+  }
+  {
+    std::lock_guard<std::mutex> lock(trainingMutex_);
+    training_ = false;
+  }
+  trainingCv_.notify_all();
+  if (checkpointer.joinable()) {
+    checkpointer.join();
+  }
+  if (tuner.joinable()) {
+    tuner.join();
+  }
+  if (syncer.joinable()) {
+    syncer.join();
+    if (args_->verbose > 0) {
+      std::cerr << "Averaging rounds: " << sync_->rounds()
+                << "  rows sent: " << sync_->rowsSent() << std::endl;
+    }
+  }
+  if (outputShard_) {
+    gatherOutput();
+  }
+  if (store_) {
+    store_->finish(args_->rank);
+    int32_t missing;
+    if (args_->rank == 0 && !store_->waitFinished(&missing)) {
+      std::cerr << "The worker of rank " << missing << " exited or never "
+                << "started, no model is written. Remove /dev/shm/"
+                << args_->shm << " before the next run." << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (args_->readers > 0 && args_->verbose > 0) {
+    printQueueInfo();
+  }
+  if (args_->numa && args_->verbose > 0) {
+    std::chrono::duration<double> wall = std::chrono::steady_clock::now() - wallStart;
+    printNodeInfo(wall.count());
+  }
 }
 
 }
@@ -20,15 +20,24 @@
 #include <time.h>
 
 #include <atomic>
+#include <condition_variable>
+#include <fstream>
 #include <memory>
+#include <mutex>
+#include <random>
 #include <set>
+#include <unordered_map>
 
 #include "args.h"
+#include "corpus.h"
 #include "dictionary.h"
 #include "matrix.h"
 #include "qmatrix.h"
 #include "model.h"
 #include "real.h"
+#include "shard.h"
+#include "shm.h"
+#include "sync.h"
 #include "utils.h"
 #include "vector.h"
 //#include "cnpy.h"
@@ -57,9 +66,115 @@ class FastText {
     std::shared_ptr<QMatrix> qoutput_;
 
     std::shared_ptr<Model> model_;
+    std::shared_ptr<ChunkScheduler> chunks_;
+    std::shared_ptr<IdCache> idCache_;
+    std::vector<int64_t> readVocabulary(const std::vector<std::string>&);
+    // -readers: tokenized batches on their way to the training threads
+    static const int64_t kReaderBatchTokens = 4096;
+    std::unique_ptr<MpmcQueue<std::unique_ptr<LineBatch>>> lineQueue_;
+    std::atomic<int32_t> readersDone_;
+    std::atomic<bool> readersClosed_;
+    void readerThread(int32_t);
+    void printQueueInfo() const;
+
+    void initMatrices(int64_t);
+    void initFromModel();
+    void saveExtraMatrices(std::ostream&);
+    void loadExtraMatrices(std::istream&);
+    void startChunks(const std::vector<std::string>&,
+                     const std::vector<int64_t>&);
+    void trainFiles(const std::vector<std::string>&,
+                    const std::vector<int64_t>&, std::istream*);
+
+    // the -checkpoint and -workers threads run until training_ is cleared
+    std::mutex trainingMutex_;
+    std::condition_variable trainingCv_;
+    bool training_;
+
+    // -thread auto: the training threads from activeThreads_ on wait at
+    // their next lr update, until tuneThreads() wants them or a thread ran
+    // out of input
+    std::atomic<int32_t> activeThreads_;
+    std::atomic<int32_t> threadsDone_;
+    std::mutex parkMutex_;
+    std::condition_variable parkCv_;
+    void setActiveThreads(int32_t);
+    void park(int32_t);
+    void tuneThreads();
+
+    // -workers: rounds of averaging with the other processes of the run
+    std::unique_ptr<ParameterSync> sync_;
+    void syncThread();
+
+    // -outputShards: the output rows this process owns, the host:port of
+    // every owner and the id range of each
+    std::shared_ptr<OutputShard> outputShard_;
+    std::vector<std::string> shardOwners_;
+    std::vector<int64_t> shardBounds_;
+    int32_t outputSenses() const;
+    real* outputPlaneRow(int32_t, int64_t);
+    void shardOutput();
+    void gatherOutput();
+
+    // -shm: the segment the parameter matrices live in
+    std::unique_ptr<SharedStore> store_;
+    void shareParameters();
+
+    // -checkpoint: written by a background thread while training goes on
+    std::vector<std::string> inputFiles_;
+    std::vector<int64_t> textBytes_;
+    // random state of each training thread, then of each reader thread
+    std::mutex rngMutex_;
+    std::vector<std::minstd_rand> rngs_;
+    bool resumed_;
+    // deltas written after the base, -1 before the base, and their sizes
+    int32_t deltas_;
+    int64_t baseBytes_;
+    int64_t deltaBytes_;
+    std::vector<std::shared_ptr<Matrix>*> parameters();
+    std::string checkpointPath(int32_t) const;
+    std::string checkpointProgress();
+    std::unique_ptr<std::ifstream> openCheckpoint();
+    void loadCheckpoint(std::istream&, const std::vector<std::string>&,
+                        std::vector<int64_t>&);
+    void loadInputFiles(std::istream&);
+    void loadCheckpointParameters(std::istream&);
+    std::unique_ptr<std::ifstream> loadDeltas();
+    void saveCheckpoint();
+    void writeCheckpoint(const std::string&);
+    void writeDelta(const std::string&);
+    void removeDeltas();
+    void checkpointThread();
+    void keepRng(int32_t, const std::minstd_rand&);
+
+    // -input -: the training threads park between rounds of stdin text
+    // while the main thread adds the words that reached -minCount
+    std::mutex streamMutex_;
+    std::condition_variable streamCv_;
+    int64_t streamRound_;
+    int32_t streamArrived_;
+    bool streamDone_;
+    std::vector<Model*> streamModels_;
+    std::vector<std::unordered_map<std::string, int64_t>> streamOov_;
+    std::unordered_map<std::string, int64_t> streamCandidates_;
+    int64_t streamPrune_;
+    real streamLoss_;
+    void trainStream(std::string&, std::string&);
+    void streamThread(int32_t);
+    void promoteWords();
+    void growWords(int64_t);
+    void growSenses(int64_t);
 
     std::atomic<int64_t> tokenCount;
     clock_t start;
+    // -numa: cpus of each node, and the tokens trained by its threads;
+    // the nodes the threads are spread over, those with cpus
+    std::vector<std::vector<int32_t>> numaCpus_;
+    std::unique_ptr<std::atomic<int64_t>[]> nodeTokens_;
+    std::vector<int32_t> cpuNodes_;
+    int32_t threadNode(int32_t) const;
+    std::vector<int32_t> threadNodes() const;
+    void printNodeInfo(double) const;
     void signModel(std::ostream&);
     bool checkModel(std::istream&);
 
@@ -76,10 +191,17 @@ class FastText {
     void loadModel(std::istream&);
     void loadModel(const std::string&);
     void loadModel(const std::string&, bool);
+    void compactCheckpoint(const std::string&);
+    void snapshot(const std::string&, const std::string&);
+    void merge(const std::vector<std::string>&, const std::string&, int32_t);
     void printInfo(real, real);
 
     void supervised(Model&, real, const std::vector<int32_t>&,
                     const std::vector<int32_t>&);
+    void supervisedBatch(Model&, real, const std::vector<int32_t>&,
+                         const std::vector<int32_t>&,
+                         std::vector<std::vector<int32_t>>&,
+                         std::vector<int32_t>&);
     void cbow(Model&, real, const std::vector<int32_t>&);
     void skipgram(Model&, real, const std::vector<int32_t>&);
     std::vector<int32_t> selectEmbeddings(int32_t) const;
@@ -105,6 +227,7 @@ class FastText {
     void analogies(int32_t);
     void trainThread(int32_t);
     void train(std::shared_ptr<Args>);
+    void tokenize(std::shared_ptr<Args>);
 
     void loadVectors(std::string);
     void saveNgramVectors(std::string);
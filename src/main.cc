@@ -8,10 +8,13 @@
  * of patent rights can be found in the PATENTS file in the same directory.
  */
 
+#include <algorithm>
 #include <iostream>
+#include <thread>
 
 #include "fasttext.h"
 #include "args.h"
+#include "sync.h"
 
 using namespace fasttext;
 
@@ -26,6 +29,11 @@ void printUsage() {
     << "  predict-prob            predict most likely labels with probabilities\n"
     << "  skipgram                train a skipgram model\n"
     << "  cbow                    train a cbow model\n"
+    << "  tokenize                write the binary id cache used by -cache\n"
+    << "  compact-checkpoint      fold the checkpoint deltas into the base\n"
+    << "  coordinator             average the parameters of a -workers run\n"
+    << "  snapshot                write the model of a -shm run as it trains\n"
+    << "  merge                   combine models trained on shards of a corpus\n"
     << "  print-word-vectors      print word vectors given a trained model\n"
     << "  print-sentence-vectors  print sentence vectors given a trained model\n"
     << "  nn                      query for nearest neighbors\n"
@@ -39,6 +47,47 @@ void printQuantizeUsage() {
     << std::endl;
 }
 
+void printTokenizeUsage() {
+  std::cerr
+    << "usage: fasttext tokenize <skipgram|cbow|supervised> <args>\n\n"
+    << "  writes <output>.ids, or the -cache path, for the dictionary the\n"
+    << "  same arguments would train with"
+    << std::endl;
+}
+
+void printCompactCheckpointUsage() {
+  std::cerr
+    << "usage: fasttext compact-checkpoint <output>\n\n"
+    << "  <output>     -output of the run, whose <output>.ckpt.N deltas are\n"
+    << "               folded into <output>.ckpt"
+    << std::endl;
+}
+
+void printCoordinatorUsage() {
+  std::cerr
+    << "usage: fasttext coordinator <port> <workers>\n\n"
+    << "  <port>       port the workers reach with -coordinator host:port\n"
+    << "  <workers>    number of processes in the run, its -workers"
+    << std::endl;
+}
+
+void printSnapshotUsage() {
+  std::cerr
+    << "usage: fasttext snapshot <name> <output>\n\n"
+    << "  <name>       -shm segment of the run\n"
+    << "  <output>     writes <output>.bin and, but for supervised, .vec"
+    << std::endl;
+}
+
+void printMergeUsage() {
+  std::cerr
+    << "usage: fasttext merge <output> <model> <model> ...\n\n"
+    << "  <output>     writes <output>.bin and, but for supervised, .vec\n"
+    << "  <model>      .bin models trained with the same args on disjoint\n"
+    << "               shards of a corpus"
+    << std::endl;
+}
+
 void printTestUsage() {
   std::cerr
     << "usage: fasttext test <model> <test-data> [<k>]\n\n"
@@ -290,6 +339,62 @@ void outputModel(int argc, char** argv) {
   exit(0);
 }
 
+void tokenize(int argc, char** argv) {
+  std::shared_ptr<Args> a = std::make_shared<Args>();
+  if (argc < 4) {
+    printTokenizeUsage();
+    a->printHelp();
+    exit(EXIT_FAILURE);
+  }
+  // the model command picks the dictionary defaults
+  a->parseArgs(argc - 1, argv + 1);
+  FastText fasttext;
+  fasttext.tokenize(a);
+  exit(0);
+}
+
+void compactCheckpoint(int argc, char** argv) {
+  if (argc != 3) {
+    printCompactCheckpointUsage();
+    exit(EXIT_FAILURE);
+  }
+  FastText fasttext;
+  fasttext.compactCheckpoint(std::string(argv[2]));
+  exit(0);
+}
+
+void coordinator(int argc, char** argv) {
+  if (argc != 4 || atoi(argv[3]) < 1) {
+    printCoordinatorUsage();
+    exit(EXIT_FAILURE);
+  }
+  SyncCoordinator coordinator(atoi(argv[2]), atoi(argv[3]));
+  coordinator.run();
+  exit(0);
+}
+
+void snapshot(int argc, char** argv) {
+  if (argc != 4) {
+    printSnapshotUsage();
+    exit(EXIT_FAILURE);
+  }
+  FastText fasttext;
+  fasttext.snapshot(std::string(argv[2]), std::string(argv[3]));
+  exit(0);
+}
+
+void merge(int argc, char** argv) {
+  if (argc < 5) {
+    printMergeUsage();
+    exit(EXIT_FAILURE);
+  }
+  std::vector<std::string> models(argv + 3, argv + argc);
+  int32_t threads = std::max(1u, std::thread::hardware_concurrency());
+  FastText fasttext;
+  fasttext.merge(models, std::string(argv[2]), threads);
+  exit(0);
+}
+
 int main(int argc, char** argv) {
   if (argc < 2) {
     printUsage();
@@ -298,6 +403,16 @@ int main(int argc, char** argv) {
   std::string command(argv[1]);
   if (command == "skipgram" || command == "cbow" || command == "supervised") {
     train(argc, argv);
+  } else if (command == "tokenize") {
+    tokenize(argc, argv);
+  } else if (command == "compact-checkpoint") {
+    compactCheckpoint(argc, argv);
+  } else if (command == "coordinator") {
+    coordinator(argc, argv);
+  } else if (command == "snapshot") {
+    snapshot(argc, argv);
+  } else if (command == "merge") {
+    merge(argc, argv);
   } else if (command == "test") {
     test(argc, argv);
   } else if (command == "quantize") {
@@ -12,7 +12,10 @@
 
 #include <assert.h>
 
+#include <algorithm>
 #include <random>
+#include <thread>
+#include <vector>
 
 #include "utils.h"
 #include "vector.h"
@@ -23,15 +26,25 @@ Matrix::Matrix() {
   m_ = 0;
   n_ = 0;
   data_ = nullptr;
+  owned_ = true;
 }
 
 Matrix::Matrix(int64_t m, int64_t n) {
   m_ = m;
   n_ = n;
   data_ = new real[m * n];
+  owned_ = true;
+}
+
+Matrix::Matrix(real* data, int64_t m, int64_t n) {
+  m_ = m;
+  n_ = n;
+  data_ = data;
+  owned_ = false;
 }
 
 Matrix::Matrix(const Matrix& other) {
+  owned_ = true;
   m_ = other.m_;
   n_ = other.n_;
   data_ = new real[m_ * n_];
@@ -45,33 +58,113 @@ Matrix& Matrix::operator=(const Matrix& other) {
   m_ = temp.m_;
   n_ = temp.n_;
   std::swap(data_, temp.data_);
+  std::swap(owned_, temp.owned_);
+  dirty_.reset();
   return *this;
 }
 
 Matrix::~Matrix() {
-  delete[] data_;
+  if (owned_) {
+    delete[] data_;
+  }
 }
 
-void Matrix::zero() {
-  for (int64_t i = 0; i < (m_ * n_); i++) {
-      data_[i] = 0.0;
+namespace {
+
+const int64_t kInitBlockRows = 4096;
+
+// Runs fn(begin, end, block) over blocks of kInitBlockRows rows, block b
+// going to thread b % threads.
+template <typename F>
+void forEachBlock(int64_t m, int64_t n, int32_t threads, F fn) {
+  int64_t nblocks = (m + kInitBlockRows - 1) / kInitBlockRows;
+  if (threads > nblocks) {
+    threads = nblocks;
+  }
+  auto work = [=](int32_t t) {
+    for (int64_t b = t; b < nblocks; b += threads) {
+      int64_t end = std::min(m, (b + 1) * kInitBlockRows);
+      fn(b * kInitBlockRows * n, end * n, b);
+    }
+  };
+  if (threads <= 1) {
+    work(0);
+    return;
+  }
+  std::vector<std::thread> pool;
+  for (int32_t t = 0; t < threads; t++) {
+    pool.push_back(std::thread(work, t));
+  }
+  for (auto it = pool.begin(); it != pool.end(); ++it) {
+    it->join();
   }
 }
 
-void Matrix::init(real val) {
-  for (int64_t i = 0; i < (m_ * n_); i++) {
-    data_[i] = val;
-  }
 }
 
-void Matrix::uniform(real a) {
-  std::minstd_rand rng(1);
+void Matrix::zero(int32_t threads) {
+  init(0.0, threads);
+}
+
+void Matrix::init(real val, int32_t threads) {
+  real* data = data_;
+  forEachBlock(m_, n_, threads, [=](int64_t begin, int64_t end, int64_t) {
+    std::fill(data + begin, data + end, val);
+  });
+}
+
+void Matrix::uniform(real a, uint64_t stream, int32_t threads) {
+  real* data = data_;
+  forEachBlock(m_, n_, threads, [=](int64_t begin, int64_t end, int64_t b) {
+    // (stream, block) mixed into an independent seed
+    uint64_t h = utils::mix64(utils::mix64(stream) ^ static_cast<uint64_t>(b));
+    std::minstd_rand rng(h % (std::minstd_rand::modulus - 1) + 1);
+    std::uniform_real_distribution<> uniform(-a, a);
+    for (int64_t i = begin; i < end; i++) {
+      data[i] = uniform(rng);
+    }
+  });
+}
+
+// Rows [begin, end) only, seeded from (stream, begin).
+void Matrix::uniformRows(real a, int64_t begin, int64_t end, uint64_t stream) {
+  uint64_t h = utils::mix64(utils::mix64(stream) ^ static_cast<uint64_t>(begin));
+  std::minstd_rand rng(h % (std::minstd_rand::modulus - 1) + 1);
   std::uniform_real_distribution<> uniform(-a, a);
-  for (int64_t i = 0; i < (m_ * n_); i++) {
+  for (int64_t i = begin * n_; i < end * n_; i++) {
     data_[i] = uniform(rng);
   }
 }
 
+void Matrix::initRows(real val, int64_t begin, int64_t end) {
+  std::fill(data_ + begin * n_, data_ + end * n_, val);
+}
+
+void Matrix::insertRows(int64_t at, int64_t count) {
+  assert(owned_);
+  assert(at >= 0 && at <= m_);
+  real* data = new real[(m_ + count) * n_];
+  std::copy(data_, data_ + at * n_, data);
+  std::fill(data + at * n_, data + (at + count) * n_, 0.0);
+  std::copy(data_ + at * n_, data_ + m_ * n_, data + (at + count) * n_);
+  delete[] data_;
+  data_ = data;
+  m_ += count;
+  if (dirty_) trackDirty();
+}
+
+void Matrix::eraseRows(int64_t at, int64_t count) {
+  assert(owned_);
+  assert(at >= 0 && at + count <= m_);
+  real* data = new real[(m_ - count) * n_];
+  std::copy(data_, data_ + at * n_, data);
+  std::copy(data_ + (at + count) * n_, data_ + m_ * n_, data + at * n_);
+  delete[] data_;
+  data_ = data;
+  m_ -= count;
+  if (dirty_) trackDirty();
+}
+
 real Matrix::dotRow(const Vector& vec, int64_t i) const {
   assert(i >= 0);
   assert(i < m_);
@@ -83,6 +176,31 @@ real Matrix::dotRow(const Vector& vec, int64_t i) const {
   return d;
 }
 
+// Scores kDotBlock rows per pass over vec, so each vec element is loaded
+// once per block and the row sums are independent accumulators.
+void Matrix::dotRows(const Vector& vec, real* out) const {
+  assert(vec.size() == n_);
+  const int64_t kDotBlock = 8;
+  const real* x = vec.data_;
+  int64_t i = 0;
+  for (; i + kDotBlock <= m_; i += kDotBlock) {
+    const real* r = data_ + i * n_;
+    real s[kDotBlock] = {0.0};
+    for (int64_t j = 0; j < n_; j++) {
+      real xj = x[j];
+      for (int64_t b = 0; b < kDotBlock; b++) {
+        s[b] += r[b * n_ + j] * xj;
+      }
+    }
+    for (int64_t b = 0; b < kDotBlock; b++) {
+      out[i + b] = s[b];
+    }
+  }
+  for (; i < m_; i++) {
+    out[i] = dotRow(vec, i);
+  }
+}
+
 void Matrix::addRow(const Vector& vec, int64_t i, real a) {
   assert(i >= 0);
   assert(i < m_);
@@ -90,6 +208,7 @@ void Matrix::addRow(const Vector& vec, int64_t i, real a) {
   for (int64_t j = 0; j < n_; j++) {
     data_[i * n_ + j] += a * vec.data_[j];
   }
+  markDirty(i);
 }
 
 void Matrix::multiplyRow(const Vector& nums, int64_t ib, int64_t ie) {
@@ -143,9 +262,65 @@ void Matrix::save(std::ostream& out) {
 void Matrix::load(std::istream& in) {
   in.read((char*) &m_, sizeof(int64_t));
   in.read((char*) &n_, sizeof(int64_t));
-  delete[] data_;
+  if (owned_) {
+    delete[] data_;
+  }
   data_ = new real[m_ * n_];
+  owned_ = true;
   in.read((char*) data_, m_ * n_ * sizeof(real));
+  dirty_.reset();
+}
+
+// Starts with every row flagged.
+void Matrix::trackDirty() {
+  dirty_.reset(new std::atomic<uint8_t>[m_]);
+  for (int64_t i = 0; i < m_; i++) {
+    dirty_[i] = 1;
+  }
+}
+
+void Matrix::clearDirty() {
+  for (int64_t i = 0; dirty_ && i < m_; i++) {
+    dirty_[i] = 0;
+  }
+}
+
+// The flagged rows in increasing order, their flags cleared.
+std::vector<int64_t> Matrix::takeDirty() {
+  std::vector<int64_t> rows;
+  for (int64_t i = 0; i < m_; i++) {
+    if (dirty_[i].exchange(0)) {
+      rows.push_back(i);
+    }
+  }
+  return rows;
+}
+
+// The flagged rows as (index, row) pairs after the shape and their count.
+int64_t Matrix::saveDirty(std::ostream& out) {
+  std::vector<int64_t> rows = takeDirty();
+  int64_t count = rows.size();
+  out.write((char*) &m_, sizeof(int64_t));
+  out.write((char*) &n_, sizeof(int64_t));
+  out.write((char*) &count, sizeof(int64_t));
+  for (auto it = rows.cbegin(); it != rows.cend(); ++it) {
+    out.write((char*) &*it, sizeof(int64_t));
+    out.write((char*) (data_ + *it * n_), n_ * sizeof(real));
+  }
+  return count;
+}
+
+void Matrix::loadDirty(std::istream& in) {
+  int64_t m, n, count;
+  in.read((char*) &m, sizeof(int64_t));
+  in.read((char*) &n, sizeof(int64_t));
+  in.read((char*) &count, sizeof(int64_t));
+  assert(m == m_ && n == n_);
+  for (int64_t k = 0; k < count; k++) {
+    int64_t i;
+    in.read((char*) &i, sizeof(int64_t));
+    in.read((char*) (data_ + i * n_), n_ * sizeof(real));
+  }
 }
 
 }
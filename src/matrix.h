@@ -11,9 +11,12 @@
 #ifndef FASTTEXT_MATRIX_H
 #define FASTTEXT_MATRIX_H
 
+#include <atomic>
 #include <cstdint>
 #include <istream>
+#include <memory>
 #include <ostream>
+#include <vector>
 
 #include "real.h"
 
@@ -22,6 +25,11 @@ namespace fasttext {
 class Vector;
 
 class Matrix {
+  private:
+    // one flag per row for -checkpoint deltas, null when not tracked
+    std::unique_ptr<std::atomic<uint8_t>[]> dirty_;
+    // false for a view on rows kept elsewhere, which are never freed
+    bool owned_;
 
   public:
     real* data_;
@@ -30,6 +38,9 @@ class Matrix {
 
     Matrix();
     Matrix(int64_t, int64_t);
+    // a view on m x n rows owned by the caller, e.g. a -shm segment; it
+    // cannot be resized or loaded into
+    Matrix(real*, int64_t, int64_t);
     Matrix(const Matrix&);
     Matrix& operator=(const Matrix&);
     ~Matrix();
@@ -38,9 +49,18 @@ class Matrix {
     inline real& at(int64_t i, int64_t j) {return data_[i * n_ + j];};
 
 
-    void zero();
-    void uniform(real);
+    // Initializers split the rows into fixed-size blocks and may fill them
+    // from several threads; uniform() seeds each block from (stream, block),
+    // so the result does not depend on the thread count.
+    void zero(int32_t threads = 1);
+    void uniform(real, uint64_t stream = 1, int32_t threads = 1);
+    void uniformRows(real, int64_t, int64_t, uint64_t);
+    void initRows(real, int64_t, int64_t);
+    // reallocate with count rows added (zeroed) or removed at a row index
+    void insertRows(int64_t, int64_t);
+    void eraseRows(int64_t, int64_t);
     real dotRow(const Vector&, int64_t) const;
+    void dotRows(const Vector&, real*) const;
     void addRow(const Vector&, int64_t, real);
 
     void multiplyRow(const Vector& nums, int64_t ib = 0, int64_t ie = -1);
@@ -51,7 +71,23 @@ class Matrix {
 
     void save(std::ostream&);
     void load(std::istream&);
-    void init(real);
+    void init(real, int32_t threads = 1);
+
+    // Writers flag a row after updating it; saveDirty() clears each flag
+    // before copying its row, so a concurrent update lands in the next one.
+    void trackDirty();
+    bool tracked() const {
+      return dirty_ != nullptr;
+    }
+    void markDirty(int64_t i) {
+      if (dirty_ && !dirty_[i].load(std::memory_order_relaxed)) {
+        dirty_[i].store(1, std::memory_order_relaxed);
+      }
+    }
+    void clearDirty();
+    std::vector<int64_t> takeDirty();
+    int64_t saveDirty(std::ostream&);
+    void loadDirty(std::istream&);
 };
 
 }
@@ -17,6 +17,7 @@
 #include <algorithm>
 #include <random>
 #include <cmath>
+#include <limits>
 
 namespace fasttext {
 
@@ -32,8 +33,9 @@ Model::Model(std::shared_ptr<Matrix> wi,
              std::shared_ptr<Args> args,
              int32_t seed,
              int32_t num_words)
-  : hidden_(args->dim), hidden2_(args->dim), output_(wo->m_),
-  grad_(args->dim), grad2_(args->dim), temp_(args->dim), gradvar_(args->dim),gradvar2_(args->dim), rng(seed), quant_(false)
+  : hidden_(args->dim), hidden2_(args->senses - 1, args->dim), output_(wo ? wo->m_ : 0),
+  grad_(args->dim), grad2_(args->senses - 1, args->dim), temp_(args->dim), gradvar_(args->dim),
+  gradvar2_(args->senses - 1, args->dim), rng(seed), quant_(false)
 {
   wi_ = wi;
   wo_ = wo;
@@ -45,10 +47,16 @@ Model::Model(std::shared_ptr<Matrix> wi,
   outvar_ = outvar;
   outvar2_ = outvar2;
 
+  this->num_words = num_words;
+  nsense2_ = (wi2 && args->senses > 1) ? wi2->m_ / (args->senses - 1) : 0;
+
   args_ = args;
-  osz_ = wo->m_;
+  osz_ = wo ? wo->m_ : 0;
   hsz_ = args->dim;
   negpos = 0;
+  outSenses_ = 1;
+  negAhead_ = 0;
+  negFlushes_ = 0;
   loss_ = 0.0;
   nexamples_ = 1;
   initSigmoid();
@@ -69,6 +77,90 @@ void Model::setQuantizePointer(std::shared_ptr<QMatrix> qwi,
   }
 }
 
+static inline real dotK(const real* a, const real* b, int32_t n) {
+  real d = 0.0;
+  for (int32_t i = 0; i < n; i++) {
+    d += a[i] * b[i];
+  }
+  return d;
+}
+
+static inline real sqdistK(const real* a, const real* b, int32_t n) {
+  real d = 0.0;
+  for (int32_t i = 0; i < n; i++) {
+    d += (a[i] - b[i]) * (a[i] - b[i]);
+  }
+  return d;
+}
+
+static inline void axpyK(real* y, const real* x, real a, int32_t n) {
+  for (int32_t i = 0; i < n; i++) {
+    y[i] += a * x[i];
+  }
+}
+
+bool Model::hasSense2(int32_t id) const {
+  return id < nsense2_;
+}
+
+// Words outside the multi-sense range have a single Gaussian; their other
+// output senses are the first one.
+real* Model::outRow(int32_t sense, int32_t id) const {
+  if (sense == 0 || !hasSense2(id)) {
+    if (outCache_) return outCache_->row(id);
+    return wo_->data_ + int64_t(id) * hsz_;
+  }
+  if (outCache_) return outCache_->row(id) + int64_t(sense) * hsz_;
+  return wo2_->data_ + (int64_t(sense - 1) * nsense2_ + id) * hsz_;
+}
+
+real* Model::outVarRow(int32_t sense, int32_t id) const {
+  if (sense == 0 || !hasSense2(id)) {
+    if (outCache_) return outCache_->row(id) + int64_t(outSenses_) * hsz_;
+    return outvar_->data_ + int64_t(id) * hsz_;
+  }
+  if (outCache_) {
+    return outCache_->row(id) + int64_t(outSenses_ + sense) * hsz_;
+  }
+  return outvar2_->data_ + (int64_t(sense - 1) * nsense2_ + id) * hsz_;
+}
+
+void Model::setOutputCache(std::unique_ptr<OutputCache> cache, int32_t rows,
+                           int32_t senses) {
+  outCache_ = std::move(cache);
+  osz_ = rows;
+  outSenses_ = senses;
+}
+
+// The possible targets of a line, pulled together before training on it.
+void Model::prefetchOutput(const std::vector<int32_t>& targets) {
+  outCache_->fetch(targets);
+}
+
+// Makes room for the rows one update may miss, and pulls the rows of the
+// next negatives a window at a time.
+void Model::prepareOutput(int32_t target) {
+  const int64_t kNegativeWindow = 512;
+  outCache_->reserve(2);
+  if (negAhead_ < 4 || negFlushes_ != outCache_->flushes()) {
+    std::vector<int32_t> ids;
+    for (int64_t i = 0; i < kNegativeWindow; i++) {
+      ids.push_back(negatives[(negpos + i) % negatives.size()]);
+    }
+    ids.push_back(target);
+    outCache_->fetch(ids);
+    negAhead_ = kNegativeWindow;
+    negFlushes_ = outCache_->flushes();
+  }
+}
+
+real* Model::inVarRow(int32_t sense, int32_t id) const {
+  if (sense == 0) {
+    return invar_->data_ + int64_t(id) * hsz_;
+  }
+  return invar2_->data_ + (int64_t(sense - 1) * nsense2_ + id) * hsz_;
+}
+
 real Model::binaryLogistic(int32_t target, bool label, real lr) {
   real score = sigmoid(wo_->dotRow(hidden_, target));
   real alpha = lr * (real(label) - score);
@@ -93,29 +185,31 @@ real Model::negativeSampling(int32_t target, real lr) {
   real sim2 = 0.0;
   real scale = lr/(args_->var_scale);
   int32_t negTarget = getNegative(target);
+  real* op = outRow(0, target);
+  real* on = outRow(0, negTarget);
 
   // We're not using the method ELK
 
-  hidden_.addRow(*wo_, target, -1.); // mu - v_out
+  axpyK(hidden_.data_, op, -1., hsz_); // mu - v_out
   sim1 = - (1./args_->var_scale)*(hidden_.normsq());
-  hidden_.addRow(*wo_, target, 1.); // mu
-  hidden_.addRow(*wo_, negTarget, -1.); // mu - v_out_neg
+  axpyK(hidden_.data_, op, 1., hsz_); // mu
+  axpyK(hidden_.data_, on, -1., hsz_); // mu - v_out_neg
   sim2 = - (1./args_->var_scale)*(hidden_.normsq());
-  hidden_.addRow(*wo_, negTarget, 1.); // mu
+  axpyK(hidden_.data_, on, 1., hsz_); // mu
 
   real loss = args_->margin - sim1 + sim2;
   if (loss > 0.0){
     // This is the only case where we would update the vectors
-    grad_.addRow(*wo_, target, scale);
-    grad_.addRow(*wo_, negTarget, -scale);
-    // Update wo_ itself
-    hidden_.addRow(*wo_, target, -1.); // mu - v_out
+    axpyK(grad_.data_, op, scale, hsz_);
+    axpyK(grad_.data_, on, -scale, hsz_);
+    // Update the output rows themselves
+    axpyK(hidden_.data_, op, -1., hsz_); // mu - v_out
     // calculate the loss based on the norm
-    wo_->addRow(hidden_, target, scale); // 
-    hidden_.addRow(*wo_, target, 1.); // mu
-    hidden_.addRow(*wo_, negTarget, -1.); // mu - v_out_neg
-    wo_->addRow(hidden_, negTarget, -scale);
-    hidden_.addRow(*wo_, negTarget, 1.); // mu
+    axpyK(op, hidden_.data_, scale, hsz_);
+    axpyK(hidden_.data_, op, 1., hsz_); // mu
+    axpyK(hidden_.data_, on, -1., hsz_); // mu - v_out_neg
+    axpyK(on, hidden_.data_, -scale, hsz_);
+    axpyK(hidden_.data_, on, 1., hsz_); // mu
   }
   return std::max((real) 0.0, loss);
 }
@@ -127,134 +221,35 @@ real Model::negativeSamplingSingleExpdot(int32_t target, real lr) {
   real sim2 = 0.0;
   real scale = lr/(args_->var_scale);
   int32_t negTarget = getNegative(target);
+  real* op = outRow(0, target);
+  real* on = outRow(0, negTarget);
 
-  sim1 = wo_->dotRow(hidden_, target);
-  sim2 = wo_->dotRow(hidden_, negTarget);
+  sim1 = dotK(op, hidden_.data_, hsz_);
+  sim2 = dotK(on, hidden_.data_, hsz_);
 
   real loss = args_->margin - sim1 + sim2;
   if (loss > 0.0){
-    grad_.addRow(*wo_, target, scale);
-    grad_.addRow(*wo_, negTarget, -scale);
+    axpyK(grad_.data_, op, scale, hsz_);
+    axpyK(grad_.data_, on, -scale, hsz_);
     
-    // Update wo_ itself
+    // Update the output rows themselves
     // calculate the loss based on the norm
-    wo_->addRow(hidden_, target, scale);
-    wo_->addRow(hidden_, negTarget, -scale);
+    axpyK(op, hidden_.data_, scale, hsz_);
+    axpyK(on, hidden_.data_, -scale, hsz_);
   }
   return std::max((real) 0.0, loss);
 }
 
 
-// This is for multiple prototype!
-real Model::partial_energy(Vector& hidden, Vector& grad, std::shared_ptr<Matrix> wo, int32_t target){
-  hidden.addRow(*wo, target, -1.); // mu - v_out
-  real sim = - (0.5/args_->var_scale)*(hidden.normsq());
-  hidden.addRow(*wo, target, 1.); // mu
-  return sim;
-}
-
-std::vector<float> Model::energy(int32_t target){
-  real sim = 0.0;
-  real sim00 = 0.0;
-  real sim01 = 0.0;
-  real sim10 = 0.0;
-  real sim11 = 0.0;
-
-  for(int i=0; i<2; i++){
-    for(int j=0; j<2; j++){
-      if (i==0 and j ==0){
-        sim00 = partial_energy(hidden_, grad_, wo_, target);
-      } else if (i==0 and j==1){ 
-        sim01 = partial_energy(hidden_, grad_, wo2_, target);
-      } else if (i==1 and j==0){
-        sim10 = partial_energy(hidden2_, grad2_, wo_, target);
-      } else if (i==1 and j==1){
-        sim11 = partial_energy(hidden2_, grad2_, wo2_, target);
-      }
-    }
-  }
-
-  std::vector<float> pes;
-  pes.push_back(sim00);
-  pes.push_back(sim01);
-  pes.push_back(sim10);
-  pes.push_back(sim11);
-  auto it = max_element(std::begin(pes), std::end(pes));
-  float max_pe = *it;
-  float sum_exp_diff = 0.0;
-  for (auto it = pes.begin(); it != pes.end(); ++it){
-    sum_exp_diff += std::exp( (*it) - max_pe);
-  }
-  // We return [max_partial_energy, sum of e(xi_ij - max_pe), the energy]
-  std::vector<float> result;
-  result.push_back(max_pe);
-  result.push_back(sum_exp_diff);
-  result.push_back(max_pe + std::log(sum_exp_diff)); // This is the loss
-  result.push_back(std::exp(sim00 - max_pe));
-  result.push_back(std::exp(sim01 - max_pe));
-  result.push_back(std::exp(sim10 - max_pe));
-  result.push_back(std::exp(sim11 - max_pe));
-  return result;
-}
-
-// partial energy expdot
-real Model::partial_energy_expdot(Vector& hidden, Vector& grad, std::shared_ptr<Matrix> wo, int32_t target){
-  real sim = wo->dotRow(hidden, target);
-  return args_->var_scale*sim;
-}
-
-// This should be the same as the energy expdot actually
-std::vector<float> Model::energy_expdot(int32_t target){
-  real sim = 0.0;
-  real sim00 = 0.0;
-  real sim01 = 0.0;
-  real sim10 = 0.0;
-  real sim11 = 0.0;
-
-  for(int i=0; i<2; i++){
-    for(int j=0; j<2; j++){
-      if (i==0 and j ==0){
-        sim00 = partial_energy_expdot(hidden_, grad_, wo_, target);
-      } else if (i==0 and j==1){ 
-        sim01 = partial_energy_expdot(hidden_, grad_, wo2_, target);
-      } else if (i==1 and j==0){
-        sim10 = partial_energy_expdot(hidden2_, grad2_, wo_, target);
-      } else if (i==1 and j==1){
-        sim11 = partial_energy_expdot(hidden2_, grad2_, wo2_, target);
-      }
-    }
-  }
-
-  std::vector<float> pes;
-  pes.push_back(sim00);
-  pes.push_back(sim01);
-  pes.push_back(sim10);
-  pes.push_back(sim11);
-  auto it = max_element(std::begin(pes), std::end(pes));
-  float max_pe = *it;
-  float sum_exp_diff = 0.0;
-  for (auto it = pes.begin(); it != pes.end(); ++it){
-    sum_exp_diff += std::exp( (*it) - max_pe);
-  }
-  // We return [max_partial_energy, sum of e(xi_ij - max_pe), the energy]
-  std::vector<float> result;
-  result.push_back(max_pe);
-  result.push_back(sum_exp_diff);
-  result.push_back(max_pe + std::log(sum_exp_diff)); // This is the loss
-  result.push_back(std::exp(sim00 - max_pe));
-  result.push_back(std::exp(sim01 - max_pe));
-  result.push_back(std::exp(sim10 - max_pe));
-  result.push_back(std::exp(sim11 - max_pe));
-  return result;
-}
-
-// partial energy expdot
-real Model::partial_energy_vecvar(Vector& hidden_vec, Vector& grad_vec_unused, std::shared_ptr<Matrix> wo, int32_t wordidx, int32_t target, std::shared_ptr<Matrix> varin, std::shared_ptr<Matrix> varout){
+real Model::partial_energy_vecvar(Vector& hidden_vec, int32_t wordidx, int32_t target){
+    const real* o = outRow(0, target);
+    const real* ov = outVarRow(0, target);
+    const real* iv = inVarRow(0, wordidx);
     temp_.zero(); 
-    for (int64_t j = 0; j < varin->n_; j++){
-        temp_.data_[j] = exp(varin->at(wordidx, j)) + exp(varout->at(target, j));
+    for (int64_t j = 0; j < hsz_; j++){
+        temp_.data_[j] = exp(iv[j]) + exp(ov[j]);
     }
-    hidden_vec.addRow(*wo, target, -1.0); 
+    axpyK(hidden_vec.data_, o, -1.0, hsz_); 
 
     real sim = 0.0;
     for (int64_t i = 0; i < temp_.m_; i++) {
@@ -263,644 +258,361 @@ real Model::partial_energy_vecvar(Vector& hidden_vec, Vector& grad_vec_unused, s
     }
     sim *= -0.5; 
 
-    hidden_vec.addRow(*wo, target, 1.0); 
+    axpyK(hidden_vec.data_, o, 1.0, hsz_); 
 
     return sim;
 }
-// This should be the same as the energy expdot actually
-std::vector<float> Model::energy_vecvar(int32_t wordidx, int32_t target){
-    // Calculate individual energy contributions (sim_ij where i=prototype, j=output matrix)
-    // Prototype 1 (hidden_) with output matrices wo_ and wo2_
-    real sim00 = partial_energy_vecvar(hidden_, grad_, wo_, wordidx, target, invar_, outvar_);
-    real sim01 = partial_energy_vecvar(hidden_, grad_, wo2_, wordidx, target, invar_, outvar2_);
-
-    // Prototype 2 (hidden2_) with output matrices wo_ and wo2_
-    real sim10 = partial_energy_vecvar(hidden2_, grad2_, wo_, wordidx, target, invar2_, outvar_);
-    real sim11 = partial_energy_vecvar(hidden2_, grad2_, wo2_, wordidx, target, invar2_, outvar2_);
-
-    // Compute individual prototype energies for the positive sample
-    // This assumes each prototype's relevance is a sum of its interactions with different output matrices
-    real energy_proto1_pos = sim00 + sim01;
-    real energy_proto2_pos = sim10 + sim11;
-
-    // Compute the combined energy using Log-Sum-Exp for numerical stability.
-    // This value (eplus_result.at(2)) will be used directly in the loss calculation.
-    real sum_exp_individual_proto_energies = std::exp(energy_proto1_pos) + std::exp(energy_proto2_pos);
-    real combined_energy_pos = std::log(1e-8 + sum_exp_individual_proto_energies);
-
-    // Calculate xi values (proportional contributions from each specific interaction).
-    // These act as attention weights or scaling factors for gradients.
-    // They are computed based on the individual 'sim' values before they are summed into proto energies.
-    real norm_factor_for_xi = (1e-8 + std::exp(sim00) + std::exp(sim01) + std::exp(sim10) + std::exp(sim11));
-
-    real xi_plus_0_0 = std::exp(sim00) / norm_factor_for_xi; // Proto1 (hidden_) interacting with WO1 (wo_)
-    real xi_plus_0_1 = std::exp(sim01) / norm_factor_for_xi; // Proto1 (hidden_) interacting with WO2 (wo2_)
-    real xi_plus_1_0 = std::exp(sim10) / norm_factor_for_xi; // Proto2 (hidden2_) interacting with WO1 (wo_)
-    real xi_plus_1_1 = std::exp(sim11) / norm_factor_for_xi; // Proto2 (hidden2_) interacting with WO2 (wo2_)
-
-    // Return the results in the exact vector format expected by negativeSamplingMultiVecVar
-    std::vector<float> result;
-    result.push_back(energy_proto1_pos);    // eplus_result.at(0): Individual energy for hidden_
-    result.push_back(energy_proto2_pos);    // eplus_result.at(1): Individual energy for hidden2_
-    result.push_back(combined_energy_pos);  // eplus_result.at(2): Log-Sum-Exp of individual proto energies
-    result.push_back(xi_plus_0_0);          // eplus_result.at(3)
-    result.push_back(xi_plus_0_1);          // eplus_result.at(4)
-    result.push_back(xi_plus_1_0);          // eplus_result.at(5)
-    result.push_back(xi_plus_1_1);          // eplus_result.at(6)
-
-    return result;
-}
-
-
-
-real Model::negativeSamplingMulti(int32_t target, real lr){
+// Single Gaussian with diagonal covariance, used for words without a second
+// component. Same energy as partial_energy_vecvar.
+real Model::negativeSamplingVecVar(int32_t wordidx, int32_t target, real lr) {
   grad_.zero();
-  grad2_.zero();
-  // 1. we compute sim1 and sim2 and see if we need to update
-  std::vector<float> eplus_result = energy(target);
+  gradvar_.zero();
   int32_t negTarget = getNegative(target);
-  std::vector<float> eminus_result = energy(negTarget);
-  real loss = args_->margin - eplus_result.at(2) + eminus_result.at(2);
-  if (loss > 0.0){
-    // 2. The goal is to update grad_ and grad2_
-    real inv_sum_eplus = lr*(1./eplus_result.at(1))*(-1./args_->var_scale); // plus
-    real inv_sum_eminus = lr*(1./eminus_result.at(1))*(-1./args_->var_scale); // minus
-    
-    std::vector< std::vector<real> > xi_plus;
-    std::vector<real> vp1;
-    std::vector<real> vp2;
-    vp1.push_back(eplus_result.at(3));
-    vp1.push_back(eplus_result.at(4));
-    vp2.push_back(eplus_result.at(5));
-    vp2.push_back(eplus_result.at(6));
-    xi_plus.push_back(vp1);
-    xi_plus.push_back(vp2);
-    
-    std::vector< std::vector<real> > xi_minus;
-    std::vector<real> vm1;
-    std::vector<real> vm2;
-    vm1.push_back(eminus_result.at(3));
-    vm1.push_back(eminus_result.at(4));
-    vm2.push_back(eminus_result.at(5));
-    vm2.push_back(eminus_result.at(6));
-    xi_minus.push_back(vm1);
-    xi_minus.push_back(vm2);
-
-    // (1) Update grad_
-    // Do it for context j+
-    // j=0
-    grad_.addVector(hidden_, xi_plus.at(0).at(0)*inv_sum_eplus);
-    grad_.addRow(*wo_, target, -xi_plus.at(0).at(0)*inv_sum_eplus);
-    // j=1
-    grad_.addVector(hidden_, xi_plus.at(0).at(1)*inv_sum_eplus);
-    grad_.addRow(*wo2_, target, -xi_plus.at(0).at(1)*inv_sum_eplus);
-
-    // Do it for context j-
-    grad_.addVector(hidden_, -xi_minus.at(0).at(0)*inv_sum_eminus);
-    grad_.addRow(*wo_, negTarget, xi_minus.at(0).at(0)*inv_sum_eminus);
-    // j=1
-    grad_.addVector(hidden_, -xi_minus.at(0).at(1)*inv_sum_eminus);
-    grad_.addRow(*wo2_, negTarget, xi_minus.at(0).at(1)*inv_sum_eminus);
-
-    // (2) Update grad2_
-    grad2_.addVector(hidden2_, xi_plus.at(1).at(0)*inv_sum_eplus);
-    grad2_.addRow(*wo_, target, -xi_plus.at(1).at(0)*inv_sum_eplus);
-    // j=1
-    grad2_.addVector(hidden2_, xi_plus.at(1).at(1)*inv_sum_eplus);
-    grad2_.addRow(*wo2_, target, -xi_plus.at(1).at(1)*inv_sum_eplus);
-
-    // Do it for context j-   
-    grad2_.addVector(hidden2_, -xi_minus.at(1).at(0)*inv_sum_eminus);
-    grad2_.addRow(*wo_, negTarget, xi_minus.at(1).at(0)*inv_sum_eminus);
-    // j=1
-    grad2_.addVector(hidden2_, -xi_minus.at(1).at(1)*inv_sum_eminus);
-    grad2_.addRow(*wo2_, negTarget, xi_minus.at(1).at(1)*inv_sum_eminus);
-
-    ///////////////////////////////
-    // (3) Update wo_[target]     --- this involves eplus
-    temp_.zero();
-    // from i=0
-    temp_.addVector(hidden_, -xi_plus.at(0).at(0));
-    temp_.addRow(*wo_, target, xi_plus.at(0).at(0));
-    // from i=1
-    temp_.addVector(hidden2_, -xi_plus.at(1).at(0));
-    temp_.addRow(*wo_, target, xi_plus.at(1).at(0));
-    wo_->addRow(temp_, target, inv_sum_eplus);
-    
-    // (4) Update wo2[target]     --- this involves eplus
-    temp_.zero();
-    // from i=0
-    temp_.addVector(hidden_, -xi_plus.at(0).at(1));
-    temp_.addRow(*wo2_, target, xi_plus.at(0).at(1));
-    // from i=1
-    temp_.addVector(hidden2_, -xi_plus.at(1).at(1));
-    temp_.addRow(*wo2_, target, xi_plus.at(1).at(1));
-    wo2_->addRow(temp_, target, inv_sum_eplus);
-
-    // (5) Update wo_[negTarget]  --- this involves eminus
-    temp_.zero();
-    // from i=0
-    temp_.addVector(hidden_, -xi_minus.at(0).at(0));
-    temp_.addRow(*wo_, negTarget, xi_minus.at(0).at(0));
-    // from i=1
-    temp_.addVector(hidden2_, -xi_minus.at(1).at(0));
-    temp_.addRow(*wo_, negTarget, xi_minus.at(1).at(0));
-    wo_->addRow(temp_, negTarget, -inv_sum_eminus);
-    
-    // (6) Update wo2_[negTarget] --- this involves eminus
-    temp_.zero();
-    // from i=0
-    temp_.addVector(hidden_, -xi_minus.at(0).at(1));
-    temp_.addRow(*wo2_, negTarget, xi_minus.at(0).at(1));
-    // from i=1
-    temp_.addVector(hidden2_, -xi_minus.at(1).at(1));
-    temp_.addRow(*wo2_, negTarget, xi_minus.at(1).at(1));
-    wo2_->addRow(temp_, negTarget, -inv_sum_eminus);
+  real eplus = partial_energy_vecvar(hidden_, wordidx, target);
+  real eminus = partial_energy_vecvar(hidden_, wordidx, negTarget);
+  real loss = args_->margin - eplus + eminus;
+  if (loss > 0.0) {
+    for (int32_t k = 0; k < 2; k++) {
+      int32_t id = (k == 0) ? target : negTarget;
+      real sign = (k == 0) ? 1.0 : -1.0;
+      real* o = outRow(0, id);
+      real* ov = outVarRow(0, id);
+      temp_.zero();
+      for (int64_t ii = 0; ii < temp_.m_; ii++) {
+        real ein = exp(invar_->at(wordidx, ii));
+        real eout = exp(ov[ii]);
+        real invsumd = 1. / (1e-8 + ein + eout);
+        real diff = hidden_.data_[ii] - o[ii];
+        real dvar = 0.5 * (-invsumd + invsumd * invsumd * diff * diff);
+        grad_.data_[ii] -= sign * lr * invsumd * diff;
+        gradvar_.data_[ii] += sign * lr * ein * dvar;
+        temp_.data_[ii] = sign * lr * invsumd * diff;
+        ov[ii] += sign * lr * eout * dvar;
+      }
+      axpyK(o, temp_.data_, 1.0, hsz_);
+    }
   }
   return std::max((real) 0.0, loss);
 }
 
-real Model::negativeSamplingMultiVec2(int32_t target, real lr){
-  grad_.zero();
-  grad2_.zero();
-  // 1. we compute sim1 and sim2 and see if we need to update
-  std::vector<float> eplus_result = energy(target);
-  int32_t negTarget = getNegative(target);
-  std::vector<float> eminus_result = energy(negTarget);
-  real loss = args_->margin - eplus_result.at(2) + eminus_result.at(2);
-  if (loss > 0.0){
-    // 2. The goal is to update grad_ and grad2_
-    real inv_sum_eplus = lr*(1./eplus_result.at(1))*(-1./args_->var_scale); // plus
-    real inv_sum_eminus = lr*(1./eminus_result.at(1))*(-1./args_->var_scale); // minus
-    
-    std::vector< std::vector<real> > xi_plus;
-    std::vector<real> vp1;
-    std::vector<real> vp2;
-    vp1.push_back(eplus_result.at(3));
-    vp1.push_back(eplus_result.at(4));
-    vp2.push_back(eplus_result.at(5));
-    vp2.push_back(eplus_result.at(6));
-    xi_plus.push_back(vp1);
-    xi_plus.push_back(vp2);
-    
-    std::vector< std::vector<real> > xi_minus;
-    std::vector<real> vm1;
-    std::vector<real> vm2;
-    vm1.push_back(eminus_result.at(3));
-    vm1.push_back(eminus_result.at(4));
-    vm2.push_back(eminus_result.at(5));
-    vm2.push_back(eminus_result.at(6));
-    xi_minus.push_back(vm1);
-    xi_minus.push_back(vm2);
-
-    // (1) Update grad_
-    // Do it for context j+
-    // j=0
-    grad_.addVector(hidden_, xi_plus.at(0).at(0)*inv_sum_eplus);
-    grad_.addRow(*wo_, target, -xi_plus.at(0).at(0)*inv_sum_eplus);
-    // j=1
-    grad_.addVector(hidden_, xi_plus.at(0).at(1)*inv_sum_eplus);
-    grad_.addRow(*wo2_, target, -xi_plus.at(0).at(1)*inv_sum_eplus);
-
-    // Do it for context j-
-    grad_.addVector(hidden_, -xi_minus.at(0).at(0)*inv_sum_eminus);
-    grad_.addRow(*wo_, negTarget, xi_minus.at(0).at(0)*inv_sum_eminus);
-    // j=1
-    grad_.addVector(hidden_, -xi_minus.at(0).at(1)*inv_sum_eminus);
-    grad_.addRow(*wo2_, negTarget, xi_minus.at(0).at(1)*inv_sum_eminus);
-
-    // (2) Update grad2_
-    grad2_.addVector(hidden2_, xi_plus.at(1).at(0)*inv_sum_eplus);
-    grad2_.addRow(*wo_, target, -xi_plus.at(1).at(0)*inv_sum_eplus);
-    // j=1
-    grad2_.addVector(hidden2_, xi_plus.at(1).at(1)*inv_sum_eplus);
-    grad2_.addRow(*wo2_, target, -xi_plus.at(1).at(1)*inv_sum_eplus);
-
-    // Do it for context j-   
-    grad2_.addVector(hidden2_, -xi_minus.at(1).at(0)*inv_sum_eminus);
-    grad2_.addRow(*wo_, negTarget, xi_minus.at(1).at(0)*inv_sum_eminus);
-    // j=1
-    grad2_.addVector(hidden2_, -xi_minus.at(1).at(1)*inv_sum_eminus);
-    grad2_.addRow(*wo2_, negTarget, xi_minus.at(1).at(1)*inv_sum_eminus);
-
-    ///////////////////////////////
-    // (3) Update wo_[target]     --- this involves eplus
-    temp_.zero();
-    // from i=0
-    temp_.addVector(hidden_, -xi_plus.at(0).at(0));
-    temp_.addRow(*wo_, target, xi_plus.at(0).at(0));
-    // from i=1
-    temp_.addVector(hidden2_, -xi_plus.at(1).at(0));
-    temp_.addRow(*wo_, target, xi_plus.at(1).at(0));
-    wo_->addRow(temp_, target, inv_sum_eplus);
-    
-    // (4) Update wo2[target]     --- this involves eplus
-    temp_.zero();
-    // from i=0
-    temp_.addVector(hidden_, -xi_plus.at(0).at(1));
-    temp_.addRow(*wo2_, target, xi_plus.at(0).at(1));
-    // from i=1
-    temp_.addVector(hidden2_, -xi_plus.at(1).at(1));
-    temp_.addRow(*wo2_, target, xi_plus.at(1).at(1));
-    wo2_->addRow(temp_, target, inv_sum_eplus);
-
-    // (5) Update wo_[negTarget]  --- this involves eminus
-    temp_.zero();
-    // from i=0
-    temp_.addVector(hidden_, -xi_minus.at(0).at(0));
-    temp_.addRow(*wo_, negTarget, xi_minus.at(0).at(0));
-    // from i=1
-    temp_.addVector(hidden2_, -xi_minus.at(1).at(0));
-    temp_.addRow(*wo_, negTarget, xi_minus.at(1).at(0));
-    wo_->addRow(temp_, negTarget, -inv_sum_eminus);
-    
-    // (6) Update wo2_[negTarget] --- this involves eminus
-    temp_.zero();
-    // from i=0
-    temp_.addVector(hidden_, -xi_minus.at(0).at(1));
-    temp_.addRow(*wo2_, negTarget, xi_minus.at(0).at(1));
-    // from i=1
-    temp_.addVector(hidden2_, -xi_minus.at(1).at(1));
-    temp_.addRow(*wo2_, negTarget, xi_minus.at(1).at(1));
-    wo2_->addRow(temp_, negTarget, -inv_sum_eminus);
+// Mixture of K Gaussians per word. Sense 0 lives in wi_/wo_, senses 1..K-1
+// are stacked in wi2_/wo2_ as (K-1) blocks of nsense2_ rows. The K x K
+// kernels below take K as a template parameter so that the sense loops are
+// unrolled by the compiler.
+
+template <int K>
+real Model::mixtureEnergy(const real* const* h, real* const* o,
+                          real (&xi)[K][K], real& sum) const {
+  real sim[K][K];
+  real max_pe = -std::numeric_limits<real>::infinity();
+  for (int i = 0; i < K; i++) {
+    for (int j = 0; j < K; j++) {
+      if (args_->expdot) {
+        sim[i][j] = args_->var_scale * dotK(h[i], o[j], hsz_);
+      } else {
+        sim[i][j] = -(0.5 / args_->var_scale) * sqdistK(h[i], o[j], hsz_);
+      }
+      max_pe = std::max(max_pe, sim[i][j]);
+    }
   }
-  return std::max((real) 0.0, loss);
+  sum = 0.0;
+  for (int i = 0; i < K; i++) {
+    for (int j = 0; j < K; j++) {
+      xi[i][j] = std::exp(sim[i][j] - max_pe);
+      sum += xi[i][j];
+    }
+  }
+  return max_pe + std::log(sum);
 }
 
-real Model::negativeSamplingMultiVecExpdot(int32_t target, real lr){
+template <int K>
+real Model::negativeSamplingMixture(int32_t target, real lr) {
   grad_.zero();
   grad2_.zero();
-  // 1. we compute sim1 and sim2 and see if we need to update
-  std::vector<float> eplus_result = energy_expdot(target);
+  const real* h[K];
+  real* g[K];
+  h[0] = hidden_.data_;
+  g[0] = grad_.data_;
+  for (int i = 1; i < K; i++) {
+    h[i] = hidden2_.data_ + (i - 1) * hsz_;
+    g[i] = grad2_.data_ + (i - 1) * hsz_;
+  }
   int32_t negTarget = getNegative(target);
-  std::vector<float> eminus_result = energy_expdot(negTarget);
-  real loss = args_->margin - eplus_result.at(2) + eminus_result.at(2);
-  if (loss > 0.0){
-    // 2. The goal is to update grad_ and grad2_
-    real inv_sum_eplus = lr*(1./eplus_result.at(1))*(-1./args_->var_scale); // plus
-    real inv_sum_eminus = lr*(1./eminus_result.at(1))*(-1./args_->var_scale); // minus
-    
-    std::vector< std::vector<real> > xi_plus;
-    std::vector<real> vp1;
-    std::vector<real> vp2;
-    vp1.push_back(eplus_result.at(3));
-    vp1.push_back(eplus_result.at(4));
-    vp2.push_back(eplus_result.at(5));
-    vp2.push_back(eplus_result.at(6));
-    xi_plus.push_back(vp1);
-    xi_plus.push_back(vp2);
-    
-    std::vector< std::vector<real> > xi_minus;
-    std::vector<real> vm1;
-    std::vector<real> vm2;
-    vm1.push_back(eminus_result.at(3));
-    vm1.push_back(eminus_result.at(4));
-    vm2.push_back(eminus_result.at(5));
-    vm2.push_back(eminus_result.at(6));
-    xi_minus.push_back(vm1);
-    xi_minus.push_back(vm2);
-
-    // (1) Update grad_
-    // Do it for context j+
-    // j=0
-    grad_.addRow(*wo_, target, -xi_plus.at(0).at(0)*inv_sum_eplus);
-
-    // j=1
-    grad_.addRow(*wo2_, target, -xi_plus.at(0).at(1)*inv_sum_eplus);
-
-    // Do it for context j-
-    grad_.addRow(*wo_, negTarget, xi_minus.at(0).at(0)*inv_sum_eminus);
-    // j=1
-    grad_.addRow(*wo2_, negTarget, xi_minus.at(0).at(1)*inv_sum_eminus);
-
-    // (2) Update grad2_
-    grad2_.addRow(*wo_, target, -xi_plus.at(1).at(0)*inv_sum_eplus);
-    // j=1
-    grad2_.addRow(*wo2_, target, -xi_plus.at(1).at(1)*inv_sum_eplus);
-
-    // Do it for context j-   
-    grad2_.addRow(*wo_, negTarget, xi_minus.at(1).at(0)*inv_sum_eminus);
-    // j=1
-    grad2_.addRow(*wo2_, negTarget, xi_minus.at(1).at(1)*inv_sum_eminus);
-
-    ///////////////////////////////
-    // (3) Update wo_[target]     --- this involves eplus
-    temp_.zero();
-    // from i=0
-    temp_.addVector(hidden_, -xi_plus.at(0).at(0));
-    // from i=1
-    temp_.addVector(hidden2_, -xi_plus.at(1).at(0));
-    wo_->addRow(temp_, target, inv_sum_eplus);
-    
-    // (4) Update wo2[target]     --- this involves eplus
-    temp_.zero();
-    // from i=0
-    temp_.addVector(hidden_, -xi_plus.at(0).at(1));
-    // from i=1
-    temp_.addVector(hidden2_, -xi_plus.at(1).at(1));
-    wo2_->addRow(temp_, target, inv_sum_eplus);
-
-    // (5) Update wo_[negTarget]  --- this involves eminus
-    temp_.zero();
-    // from i=0
-    temp_.addVector(hidden_, -xi_minus.at(0).at(0));
-    // from i=1
-    temp_.addVector(hidden2_, -xi_minus.at(1).at(0));
-    wo_->addRow(temp_, negTarget, -inv_sum_eminus);
-    
-    // (6) Update wo2_[negTarget] --- this involves eminus
-    temp_.zero();
-    // from i=0
-    temp_.addVector(hidden_, -xi_minus.at(0).at(1));
-    // from i=1
-    temp_.addVector(hidden2_, -xi_minus.at(1).at(1));
-    wo2_->addRow(temp_, negTarget, -inv_sum_eminus);
+  real* op[K];
+  real* on[K];
+  for (int j = 0; j < K; j++) {
+    op[j] = outRow(j, target);
+    on[j] = outRow(j, negTarget);
   }
-  return std::max((real) 0.0, loss);
-}
-// Feb6 TODO
-real Model::negativeSamplingMultiVecVar(int32_t wordidx, int32_t target, real lr) {
-    grad_.zero();
-    grad2_.zero();
-    gradvar_.zero();
-    gradvar2_.zero();
-
-    real dot_product = 0.0;
-    real norm_hidden = 0.0;
-    real norm_hidden2 = 0.0;
-    real current_cosine_sim = 0.0;
-
-    std::vector<float> eplus_result = energy_vecvar(wordidx, target);
-    int32_t negTarget = getNegative(target);
-    std::vector<float> eminus_result = energy_vecvar(wordidx, negTarget);
-
-    // Calculate margin-based loss component
-    real margin_loss = args_->margin - eplus_result.at(2) + eminus_result.at(2);
-
-    // Initialize diversity penalty
-    real diversity_penalty = 0.0;
-
-    if (args_->multi) {
-        // DEBUG: Check if multi-sense is active
-        // std::cout << "DEBUG: args_->multi is TRUE." << std::endl;
-
-        for (int64_t i = 0; i < hidden_.m_; i++) {
-            dot_product += hidden_.data_[i] * hidden2_.data_[i];
-            norm_hidden += hidden_.data_[i] * hidden_.data_[i];
-            norm_hidden2 += hidden2_.data_[i] * hidden2_.data_[i];
-        }
-        current_cosine_sim = dot_product / (std::sqrt(norm_hidden + 1e-8) * std::sqrt(norm_hidden2 + 1e-8));
-        diversity_penalty = args_->diversity_weight * (current_cosine_sim * current_cosine_sim);
-
-        // DEBUG: Print cosine similarity and penalty
-        // std::cout << "DEBUG: Cosine Sim: " << current_cosine_sim << ", Diversity Penalty: " << diversity_penalty << std::endl;
+  real xp[K][K], xn[K][K];
+  real sump, sumn;
+  real eplus = mixtureEnergy<K>(h, op, xp, sump);
+  real eminus = mixtureEnergy<K>(h, on, xn, sumn);
+  real loss = args_->margin - eplus + eminus;
+  if (loss > 0.0) {
+    real cp = lr * (1. / sump) * (-1. / args_->var_scale);
+    real cn = lr * (1. / sumn) * (-1. / args_->var_scale);
+
+    // (1) gradient of each input sense
+    for (int i = 0; i < K; i++) {
+      for (int j = 0; j < K; j++) {
+        if (!args_->expdot) axpyK(g[i], h[i], xp[i][j] * cp, hsz_);
+        axpyK(g[i], op[j], -xp[i][j] * cp, hsz_);
+      }
+      for (int j = 0; j < K; j++) {
+        if (!args_->expdot) axpyK(g[i], h[i], -xn[i][j] * cn, hsz_);
+        axpyK(g[i], on[j], xn[i][j] * cn, hsz_);
+      }
     }
 
-    // Total loss is the sum of both components (if they are positive)
-    real total_loss = std::max((real)0.0, margin_loss) + std::max((real)0.0, diversity_penalty);
-
-    // We apply gradients for the margin loss only if it's positive
-    // and gradients for diversity loss only if it's positive.
-    // The real 'lr' needs to be handled carefully here, it's global for both.
-    // Let's modify the gradient calculation based on *which* component is positive.
-
-    real effective_lr_margin = 0.0;
-    if (margin_loss > 0.0) {
-        effective_lr_margin = lr;
+    // (2) output senses of the target, then of the negative
+    for (int j = 0; j < K; j++) {
+      temp_.zero();
+      for (int i = 0; i < K; i++) {
+        axpyK(temp_.data_, h[i], -xp[i][j], hsz_);
+        if (!args_->expdot) axpyK(temp_.data_, op[j], xp[i][j], hsz_);
+      }
+      axpyK(op[j], temp_.data_, cp, hsz_);
     }
-
-    real effective_lr_diversity = 0.0;
-    if (diversity_penalty > 0.0 && args_->multi) { // Only apply diversity gradients if the penalty is active and positive
-        effective_lr_diversity = lr;
+    for (int j = 0; j < K; j++) {
+      temp_.zero();
+      for (int i = 0; i < K; i++) {
+        axpyK(temp_.data_, h[i], -xn[i][j], hsz_);
+        if (!args_->expdot) axpyK(temp_.data_, on[j], xn[i][j], hsz_);
+      }
+      axpyK(on[j], temp_.data_, -cn, hsz_);
     }
+  }
+  return std::max((real) 0.0, loss);
+}
 
-    // --- Start of updates (re-organize to handle independent gradients) ---
-
-    // These values are needed regardless of whether margin_loss > 0 or diversity_penalty > 0
-    real sum_exp_eplus = std::exp(eplus_result.at(2));
-    real sum_exp_eminus = std::exp(eminus_result.at(2));
-
-    real inv_sum_eplus = effective_lr_margin * (1. / (1e-8 + sum_exp_eplus));
-    real inv_sum_eminus = effective_lr_margin * (1. / (1e-8 + sum_exp_eminus));
-
-    std::vector<std::vector<real>> xi_plus;
-    xi_plus.push_back({eplus_result.at(3), eplus_result.at(4)}); // {xi_plus_0_0, xi_plus_0_1}
-    xi_plus.push_back({eplus_result.at(5), eplus_result.at(6)}); // {xi_plus_1_0, xi_plus_1_1}
+// Diagonal covariance version. The energy of input sense i is the sum of its
+// partial energies over the output senses and the energies are combined with
+// a log-sum-exp; only the input sense with the highest energy on the positive
+// pair receives the positive gradient.
+template <int K>
+real Model::mixtureEnergyVar(real* const* iv, const real* const* h,
+                             real* const* o, real* const* ov,
+                             real (&pe)[K], real (&xi)[K][K]) const {
+  real sim[K][K];
+  real sum_pe = 0.0;
+  real norm = 1e-8;
+  for (int i = 0; i < K; i++) {
+    pe[i] = 0.0;
+    for (int j = 0; j < K; j++) {
+      real s = 0.0;
+      for (int32_t d = 0; d < hsz_; d++) {
+        real var = exp(iv[i][d]) + exp(ov[j][d]);
+        s += pow(h[i][d] - o[j][d], 2.0) / (1e-8 + var);
+        s += log(1e-8 + var);
+      }
+      sim[i][j] = -0.5 * s;
+      pe[i] += sim[i][j];
+      norm += std::exp(sim[i][j]);
+    }
+    sum_pe += std::exp(pe[i]);
+  }
+  for (int i = 0; i < K; i++) {
+    for (int j = 0; j < K; j++) {
+      xi[i][j] = std::exp(sim[i][j]) / norm;
+    }
+  }
+  return std::log(1e-8 + sum_pe);
+}
 
-    std::vector<std::vector<real>> xi_minus;
-    xi_minus.push_back({eminus_result.at(3), eminus_result.at(4)}); // {xi_minus_0_0, xi_minus_0_1}
-    xi_minus.push_back({eminus_result.at(5), eminus_result.at(6)}); // {xi_minus_1_0, xi_minus_1_1}
+template <int K>
+real Model::negativeSamplingMixtureVar(int32_t wordidx, int32_t target, real lr) {
+  grad_.zero();
+  grad2_.zero();
+  gradvar_.zero();
+  gradvar2_.zero();
+  const real* h[K];
+  real* g[K];
+  real* gv[K];
+  real* iv[K];
+  h[0] = hidden_.data_;
+  g[0] = grad_.data_;
+  gv[0] = gradvar_.data_;
+  iv[0] = inVarRow(0, wordidx);
+  for (int i = 1; i < K; i++) {
+    h[i] = hidden2_.data_ + (i - 1) * hsz_;
+    g[i] = grad2_.data_ + (i - 1) * hsz_;
+    gv[i] = gradvar2_.data_ + (i - 1) * hsz_;
+    iv[i] = inVarRow(i, wordidx);
+  }
+  real* op[K];
+  real* ovp[K];
+  real* on[K];
+  real* ovn[K];
+  for (int j = 0; j < K; j++) {
+    op[j] = outRow(j, target);
+    ovp[j] = outVarRow(j, target);
+  }
+  real pp[K], pn[K], xp[K][K], xn[K][K];
+  real eplus = mixtureEnergyVar<K>(iv, h, op, ovp, pp, xp);
+  int32_t negTarget = getNegative(target);
+  for (int j = 0; j < K; j++) {
+    on[j] = outRow(j, negTarget);
+    ovn[j] = outVarRow(j, negTarget);
+  }
+  real eminus = mixtureEnergyVar<K>(iv, h, on, ovn, pn, xn);
 
-    bool update_proto1_for_positive = false;
-    bool update_proto2_for_positive = false;
+  real margin_loss = args_->margin - eplus + eminus;
 
-    if (eplus_result.at(0) >= eplus_result.at(1)) {
-        update_proto1_for_positive = true;
-    } else {
-        update_proto2_for_positive = true;
+  // Diversity penalty: squared cosine between every pair of input senses
+  real norms[K];
+  real cosine[K][K];
+  real diversity_penalty = 0.0;
+  for (int i = 0; i < K; i++) {
+    norms[i] = dotK(h[i], h[i], hsz_);
+  }
+  for (int i = 0; i < K; i++) {
+    for (int l = i + 1; l < K; l++) {
+      cosine[i][l] = dotK(h[i], h[l], hsz_) /
+        (std::sqrt(norms[i] + 1e-8) * std::sqrt(norms[l] + 1e-8));
+      diversity_penalty += args_->diversity_weight * cosine[i][l] * cosine[i][l];
     }
+  }
+  real total_loss = std::max((real)0.0, margin_loss) + std::max((real)0.0, diversity_penalty);
 
-    // --- Variance Updates (if args_->var is true) ---
-    // These updates are solely based on the energy/margin loss components.
-    // They should only happen if margin_loss > 0.
-    if (args_->var && margin_loss > 0.0) { // Conditioned on margin_loss being positive
-        // Updating gradvar_ (for invar_)
-        temp_.zero();
-        if (update_proto1_for_positive) {
-            for (int64_t ii = 0; ii < temp_.m_; ii++) {
-                real invsumd = 1. / (1e-8 + exp(invar_->at(wordidx, ii)) + exp(outvar_->at(target, ii)));
-                temp_.data_[ii] += 0.5 * inv_sum_eplus * xi_plus.at(0).at(0) * (-invsumd + pow(invsumd, 2.) * pow(hidden_.data_[ii] - wo_->at(target, ii), 2.));
-            }
-            for (int64_t ii = 0; ii < temp_.m_; ii++) {
-                real invsumd = 1. / (1e-8 + exp(invar_->at(wordidx, ii)) + exp(outvar2_->at(target, ii)));
-                temp_.data_[ii] += 0.5 * inv_sum_eplus * xi_plus.at(0).at(1) * (-invsumd + pow(invsumd, 2.) * pow(hidden_.data_[ii] - wo2_->at(target, ii), 2.));
-            }
-        }
-        for (int64_t ii = 0; ii < temp_.m_; ii++) {
-            real invsumd = 1. / (1e-8 + exp(invar_->at(wordidx, ii)) + exp(outvar_->at(negTarget, ii)));
-            temp_.data_[ii] += -0.5 * inv_sum_eminus * xi_minus.at(0).at(0) * (-invsumd + pow(invsumd, 2.) * pow(hidden_.data_[ii] - wo_->at(negTarget, ii), 2.));
-        }
-        for (int64_t ii = 0; ii < temp_.m_; ii++) {
-            real invsumd = 1. / (1e-8 + exp(invar_->at(wordidx, ii)) + exp(outvar2_->at(negTarget, ii)));
-            temp_.data_[ii] += -0.5 * inv_sum_eminus * xi_minus.at(0).at(1) * (-invsumd + pow(invsumd, 2.) * pow(hidden_.data_[ii] - wo2_->at(negTarget, ii), 2.));
-        }
-        for (int64_t ii = 0; ii < temp_.m_; ii++) {
-            gradvar_.data_[ii] = exp(invar_->at(wordidx, ii)) * temp_.data_[ii];
-        }
+  real effective_lr_margin = (margin_loss > 0.0) ? lr : 0.0;
+  real effective_lr_diversity = (diversity_penalty > 0.0) ? lr : 0.0;
+  real inv_sum_eplus = effective_lr_margin * (1. / (1e-8 + std::exp(eplus)));
+  real inv_sum_eminus = effective_lr_margin * (1. / (1e-8 + std::exp(eminus)));
 
-        // Updating gradvar2_ (for invar2_)
-        temp_.zero();
-        if (update_proto2_for_positive) {
-            for (int64_t ii = 0; ii < temp_.m_; ii++) {
-                real invsumd = 1. / (1e-8 + exp(invar2_->at(wordidx, ii)) + exp(outvar_->at(target, ii)));
-                temp_.data_[ii] += 0.5 * inv_sum_eplus * xi_plus.at(1).at(0) * (-invsumd + pow(invsumd, 2.) * pow(hidden2_.data_[ii] - wo_->at(target, ii), 2.));
-            }
-            for (int64_t ii = 0; ii < temp_.m_; ii++) {
-                real invsumd = 1. / (1e-8 + exp(invar2_->at(wordidx, ii)) + exp(outvar2_->at(target, ii)));
-                temp_.data_[ii] += 0.5 * inv_sum_eplus * xi_plus.at(1).at(1) * (-invsumd + pow(invsumd, 2.) * pow(hidden2_.data_[ii] - wo2_->at(target, ii), 2.));
-            }
-        }
-        for (int64_t ii = 0; ii < temp_.m_; ii++) {
-            real invsumd = 1. / (1e-8 + exp(invar2_->at(wordidx, ii)) + exp(outvar_->at(negTarget, ii)));
-            temp_.data_[ii] += -0.5 * inv_sum_eminus * xi_minus.at(1).at(0) * (-invsumd + pow(invsumd, 2.) * pow(hidden2_.data_[ii] - wo_->at(negTarget, ii), 2.));
-        }
-        for (int64_t ii = 0; ii < temp_.m_; ii++) {
-            real invsumd = 1. / (1e-8 + exp(invar2_->at(wordidx, ii)) + exp(outvar2_->at(negTarget, ii)));
-            temp_.data_[ii] += -0.5 * inv_sum_eminus * xi_minus.at(1).at(1) * (-invsumd + pow(invsumd, 2.) * pow(hidden2_.data_[ii] - wo2_->at(negTarget, ii), 2.));
-        }
-        for (int64_t ii = 0; ii < temp_.m_; ii++) {
-            gradvar2_.data_[ii] = exp(invar2_->at(wordidx, ii)) * temp_.data_[ii];
-        }
+  int best = 0;
+  for (int i = 1; i < K; i++) {
+    if (pp[i] > pp[best]) best = i;
+  }
 
-        // Update outvar_[target]
-        temp_.zero();
-        if (update_proto1_for_positive) {
-            for (int64_t ii = 0; ii < temp_.m_; ii++) {
-                real invsumd = 1. / (1e-8 + exp(invar_->at(wordidx, ii)) + exp(outvar_->at(target, ii)));
-                temp_.data_[ii] += -0.5 * inv_sum_eplus * xi_plus.at(0).at(0) * (-invsumd + pow(invsumd, 2.) * pow(hidden_.data_[ii] - wo_->at(target, ii), 2.));
-            }
-        }
-        for (int64_t ii = 0; ii < temp_.m_; ii++) {
-            real invsumd1 = 1. / (1e-8 + exp(invar_->at(wordidx, ii)) + exp(outvar_->at(negTarget, ii)));
-            real invsumd2 = 1. / (1e-8 + exp(invar2_->at(wordidx, ii)) + exp(outvar_->at(negTarget, ii)));
-            temp_.data_[ii] += 0.5 * inv_sum_eminus * xi_minus.at(0).at(0) * (-invsumd1 + pow(invsumd1, 2.) * pow(hidden_.data_[ii] - wo_->at(negTarget, ii), 2.));
-            temp_.data_[ii] += 0.5 * inv_sum_eminus * xi_minus.at(1).at(0) * (-invsumd2 + pow(invsumd2, 2.) * pow(hidden2_.data_[ii] - wo_->at(negTarget, ii), 2.));
-        }
-        temp_.mulExpRow(*outvar_, target);
-        outvar_->addRow(temp_, target, 1.);
-
-        // Update outvar2_[target]
-        temp_.zero();
-        if (update_proto2_for_positive) {
-            for (int64_t ii = 0; ii < temp_.m_; ii++) {
-                real invsumd = 1. / (1e-8 + exp(invar2_->at(wordidx, ii)) + exp(outvar2_->at(target, ii)));
-                temp_.data_[ii] += -0.5 * inv_sum_eplus * xi_plus.at(1).at(1) * (-invsumd + pow(invsumd, 2.) * pow(hidden2_.data_[ii] - wo2_->at(target, ii), 2.));
-            }
-        }
-        for (int64_t ii = 0; ii < temp_.m_; ii++) {
-            real invsumd1 = 1. / (1e-8 + exp(invar_->at(wordidx, ii)) + exp(outvar2_->at(negTarget, ii)));
-            real invsumd2 = 1. / (1e-8 + exp(invar2_->at(wordidx, ii)) + exp(outvar2_->at(negTarget, ii)));
-            temp_.data_[ii] += 0.5 * inv_sum_eminus * xi_minus.at(0).at(1) * (-invsumd1 + pow(invsumd1, 2.) * pow(hidden_.data_[ii] - wo2_->at(negTarget, ii), 2.));
-            temp_.data_[ii] += 0.5 * inv_sum_eminus * xi_minus.at(1).at(1) * (-invsumd2 + pow(invsumd2, 2.) * pow(hidden2_.data_[ii] - wo2_->at(negTarget, ii), 2.));
-        }
-        temp_.mulExpRow(*outvar2_, target);
-        outvar2_->addRow(temp_, target, 1.);
-    } // End if (args_->var && margin_loss > 0.0)
-
-    // --- Gradient Updates for Embeddings (grad_ and grad2_) ---
-    // Apply margin-based gradients if margin_loss > 0
-    if (margin_loss > 0.0) {
-        // (1) Update grad_ (for prototype 1, hidden_)
-        if (update_proto1_for_positive) {
-            for (int64_t ii = 0; ii < grad_.m_; ii++) {
-                real invsumd = 1. / (1e-8 + exp(invar_->at(wordidx, ii)) + exp(outvar_->at(target, ii)));
-                grad_.data_[ii] += inv_sum_eplus * xi_plus.at(0).at(0) * (-invsumd * (hidden_.data_[ii] - wo_->at(target, ii)));
-            }
-            for (int64_t ii = 0; ii < grad_.m_; ii++) {
-                real invsumd = 1. / (1e-8 + exp(invar_->at(wordidx, ii)) + exp(outvar2_->at(target, ii)));
-                grad_.data_[ii] += inv_sum_eplus * xi_plus.at(0).at(1) * (-invsumd * (hidden_.data_[ii] - wo2_->at(target, ii)));
-            }
+  if (margin_loss > 0.0) {
+    // gradvar of each input sense
+    for (int i = 0; i < K; i++) {
+      temp_.zero();
+      if (i == best) {
+        for (int j = 0; j < K; j++) {
+          for (int32_t d = 0; d < hsz_; d++) {
+            real invsumd = 1. / (1e-8 + exp(iv[i][d]) + exp(ovp[j][d]));
+            temp_.data_[d] += 0.5 * inv_sum_eplus * xp[i][j] * (-invsumd + pow(invsumd, 2.) * pow(h[i][d] - op[j][d], 2.));
+          }
         }
-        for (int64_t ii = 0; ii < grad_.m_; ii++) {
-            real invsumd_wo = 1. / (1e-8 + exp(invar_->at(wordidx, ii)) + exp(outvar_->at(negTarget, ii)));
-            real invsumd_wo2 = 1. / (1e-8 + exp(invar_->at(wordidx, ii)) + exp(outvar2_->at(negTarget, ii)));
-            grad_.data_[ii] += -inv_sum_eminus * xi_minus.at(0).at(0) * (-invsumd_wo * (hidden_.data_[ii] - wo_->at(negTarget, ii)));
-            grad_.data_[ii] += -inv_sum_eminus * xi_minus.at(0).at(1) * (-invsumd_wo2 * (hidden_.data_[ii] - wo2_->at(negTarget, ii)));
+      }
+      for (int j = 0; j < K; j++) {
+        for (int32_t d = 0; d < hsz_; d++) {
+          real invsumd = 1. / (1e-8 + exp(iv[i][d]) + exp(ovn[j][d]));
+          temp_.data_[d] += -0.5 * inv_sum_eminus * xn[i][j] * (-invsumd + pow(invsumd, 2.) * pow(h[i][d] - on[j][d], 2.));
         }
+      }
+      for (int32_t d = 0; d < hsz_; d++) {
+        gv[i][d] = exp(iv[i][d]) * temp_.data_[d];
+      }
+    }
 
-        // (2) Update grad2_ (for prototype 2, hidden2_)
-        if (update_proto2_for_positive) {
-            for (int64_t ii = 0; ii < grad2_.m_; ii++) {
-                real invsumd = 1. / (1e-8 + exp(invar2_->at(wordidx, ii)) + exp(outvar_->at(target, ii)));
-                grad2_.data_[ii] += inv_sum_eplus * xi_plus.at(1).at(0) * (-invsumd * (hidden2_.data_[ii] - wo_->at(target, ii)));
-            }
-            for (int64_t ii = 0; ii < grad2_.m_; ii++) {
-                real invsumd = 1. / (1e-8 + exp(invar2_->at(wordidx, ii)) + exp(outvar2_->at(target, ii)));
-                grad2_.data_[ii] += inv_sum_eplus * xi_plus.at(1).at(1) * (-invsumd * (hidden2_.data_[ii] - wo2_->at(target, ii)));
-            }
+    // output variances of the target
+    for (int j = 0; j < K; j++) {
+      temp_.zero();
+      if (j == best) {
+        for (int32_t d = 0; d < hsz_; d++) {
+          real invsumd = 1. / (1e-8 + exp(iv[j][d]) + exp(ovp[j][d]));
+          temp_.data_[d] += -0.5 * inv_sum_eplus * xp[j][j] * (-invsumd + pow(invsumd, 2.) * pow(h[j][d] - op[j][d], 2.));
         }
-        for (int64_t ii = 0; ii < grad2_.m_; ii++) {
-            real invsumd_wo = 1. / (1e-8 + exp(invar2_->at(wordidx, ii)) + exp(outvar_->at(negTarget, ii)));
-            real invsumd_wo2 = 1. / (1e-8 + exp(invar2_->at(wordidx, ii)) + exp(outvar2_->at(negTarget, ii)));
-            grad2_.data_[ii] += -inv_sum_eminus * xi_minus.at(1).at(0) * (-invsumd_wo * (hidden2_.data_[ii] - wo_->at(negTarget, ii)));
-            grad2_.data_[ii] += -inv_sum_eminus * xi_minus.at(1).at(1) * (-invsumd_wo2 * (hidden2_.data_[ii] - wo2_->at(negTarget, ii)));
+      }
+      for (int32_t d = 0; d < hsz_; d++) {
+        for (int i = 0; i < K; i++) {
+          real invsumd = 1. / (1e-8 + exp(iv[i][d]) + exp(ovn[j][d]));
+          temp_.data_[d] += 0.5 * inv_sum_eminus * xn[i][j] * (-invsumd + pow(invsumd, 2.) * pow(h[i][d] - on[j][d], 2.));
         }
+      }
+      for (int32_t d = 0; d < hsz_; d++) {
+        ovp[j][d] += temp_.data_[d] * exp(ovp[j][d]);
+      }
+    }
 
-        ///////////////////////////////////
-        // (3) Update wo_[target]
-        temp_.zero();
-        if (update_proto1_for_positive) {
-            for (int64_t ii = 0; ii < temp_.m_; ii++) {
-                real invsumd = 1. / (1e-8 + exp(invar_->at(wordidx, ii)) + exp(outvar_->at(target, ii)));
-                temp_[ii] += xi_plus.at(0).at(0) * invsumd * (hidden_.data_[ii] - wo_->at(target, ii));
-            }
+    // gradient of each input sense
+    for (int i = 0; i < K; i++) {
+      if (i == best) {
+        for (int j = 0; j < K; j++) {
+          for (int32_t d = 0; d < hsz_; d++) {
+            real invsumd = 1. / (1e-8 + exp(iv[i][d]) + exp(ovp[j][d]));
+            g[i][d] += inv_sum_eplus * xp[i][j] * (-invsumd * (h[i][d] - op[j][d]));
+          }
         }
-        wo_->addRow(temp_, target, inv_sum_eplus);
-
-        // (4) Update wo2[target]
-        temp_.zero();
-        if (update_proto2_for_positive) {
-            for (int64_t ii = 0; ii < temp_.m_; ii++) {
-                real invsumd = 1. / (1e-8 + exp(invar2_->at(wordidx, ii)) + exp(outvar2_->at(target, ii)));
-                temp_[ii] += xi_plus.at(1).at(1) * invsumd * (hidden2_.data_[ii] - wo2_->at(target, ii));
-            }
+      }
+      for (int32_t d = 0; d < hsz_; d++) {
+        for (int j = 0; j < K; j++) {
+          real invsumd = 1. / (1e-8 + exp(iv[i][d]) + exp(ovn[j][d]));
+          g[i][d] += -inv_sum_eminus * xn[i][j] * (-invsumd * (h[i][d] - on[j][d]));
         }
-        wo2_->addRow(temp_, target, inv_sum_eplus);
+      }
+    }
 
-        // (5) Update wo_[negTarget]
-        temp_.zero();
-        for (int64_t ii = 0; ii < temp_.m_; ii++) {
-            real invsumd = 1. / (1e-8 + exp(invar_->at(wordidx, ii)) + exp(outvar_->at(negTarget, ii)));
-            temp_[ii] += xi_minus.at(0).at(0) * invsumd * (hidden_.data_[ii] - wo_->at(negTarget, ii));
+    // output senses of the target, then of the negative
+    for (int j = 0; j < K; j++) {
+      temp_.zero();
+      if (j == best) {
+        for (int32_t d = 0; d < hsz_; d++) {
+          real invsumd = 1. / (1e-8 + exp(iv[j][d]) + exp(ovp[j][d]));
+          temp_[d] += xp[j][j] * invsumd * (h[j][d] - op[j][d]);
         }
-        for (int64_t ii = 0; ii < temp_.m_; ii++) {
-            real invsumd = 1. / (1e-8 + exp(invar2_->at(wordidx, ii)) + exp(outvar_->at(negTarget, ii)));
-            temp_[ii] += xi_minus.at(1).at(0) * invsumd * (hidden2_.data_[ii] - wo_->at(negTarget, ii));
+      }
+      axpyK(op[j], temp_.data_, inv_sum_eplus, hsz_);
+    }
+    for (int j = 0; j < K; j++) {
+      temp_.zero();
+      for (int i = 0; i < K; i++) {
+        for (int32_t d = 0; d < hsz_; d++) {
+          real invsumd = 1. / (1e-8 + exp(iv[i][d]) + exp(ovn[j][d]));
+          temp_[d] += xn[i][j] * invsumd * (h[i][d] - on[j][d]);
         }
-        wo_->addRow(temp_, negTarget, -inv_sum_eminus);
+      }
+      axpyK(on[j], temp_.data_, -inv_sum_eminus, hsz_);
+    }
+  }
 
-        // (6) Update wo2_[negTarget]
-        temp_.zero();
-        for (int64_t ii = 0; ii < temp_.m_; ii++) {
-            real invsumd = 1. / (1e-8 + exp(invar_->at(wordidx, ii)) + exp(outvar2_->at(negTarget, ii)));
-            temp_[ii] += xi_minus.at(0).at(1) * invsumd * (hidden_.data_[ii] - wo2_->at(negTarget, ii));
-        }
-        for (int64_t ii = 0; ii < temp_.m_; ii++) {
-            real invsumd = 1. / (1e-8 + exp(invar2_->at(wordidx, ii)) + exp(outvar2_->at(negTarget, ii)));
-            temp_[ii] += xi_minus.at(1).at(1) * invsumd * (hidden2_.data_[ii] - wo2_->at(negTarget, ii));
+  if (diversity_penalty > 0.0) {
+    for (int i = 0; i < K; i++) {
+      for (int l = i + 1; l < K; l++) {
+        real c = cosine[i][l];
+        real scale = effective_lr_diversity * args_->diversity_weight * 2 * c;
+        real denom = std::sqrt(norms[i] + 1e-8) * std::sqrt(norms[l] + 1e-8);
+        for (int32_t d = 0; d < hsz_; d++) {
+          g[i][d] -= scale * (h[l][d] / denom - h[i][d] * c / (norms[i] + 1e-8));
         }
-        wo2_->addRow(temp_, negTarget, -inv_sum_eminus);
-    } // End if (margin_loss > 0.0)
-
-    // Apply diversity gradients if diversity_penalty > 0
-    if (args_->multi && diversity_penalty > 0.0) {
-        // Gradient for hidden_ from diversity penalty
-        for (int64_t ii = 0; ii < grad_.m_; ii++) {
-            real term1 = hidden2_.data_[ii] / (std::sqrt(norm_hidden + 1e-8) * std::sqrt(norm_hidden2 + 1e-8));
-            real term2 = hidden_.data_[ii] * current_cosine_sim / (norm_hidden + 1e-8);
-            // Multiply by 2 * current_cosine_sim because of the square in the loss term
-            grad_.data_[ii] -= effective_lr_diversity * args_->diversity_weight * 2 * current_cosine_sim * (term1 - term2);
-        }
-
-        // Gradient for hidden2_ from diversity penalty
-        for (int64_t ii = 0; ii < grad2_.m_; ii++) {
-            real term1 = hidden_.data_[ii] / (std::sqrt(norm_hidden + 1e-8) * std::sqrt(norm_hidden2 + 1e-8));
-            real term2 = hidden2_.data_[ii] * current_cosine_sim / (norm_hidden2 + 1e-8);
-            // Multiply by 2 * current_cosine_sim because of the square in the loss term
-            grad2_.data_[ii] -= effective_lr_diversity * args_->diversity_weight * 2 * current_cosine_sim * (term1 - term2);
+        for (int32_t d = 0; d < hsz_; d++) {
+          g[l][d] -= scale * (h[i][d] / denom - h[l][d] * c / (norms[l] + 1e-8));
         }
+      }
     }
+  }
 
-    return total_loss; // Return the total loss
+  return total_loss;
+}
+
+template <int K>
+real Model::negativeSamplingSenses(const std::vector<int32_t>& input,
+                                   int32_t wordidx, int32_t target, real lr) {
+  if (K == 1) {
+    if (args_->var) {
+      return negativeSamplingVecVar(wordidx, target, lr);
+    }
+    if (args_->expdot) {
+      return negativeSamplingSingleExpdot(target, lr);
+    }
+    return negativeSampling(target, lr);
+  }
+  computeHidden2_mv(input, hidden2_);
+  if (args_->var) {
+    return negativeSamplingMixtureVar<K>(wordidx, target, lr);
+  }
+  return negativeSamplingMixture<K>(target, lr);
 }
 
 real Model::hierarchicalSoftmax(int32_t target, real lr) {
   real loss = 0.0;
   grad_.zero();
-  const std::vector<bool>& binaryCode = codes[target];
-  const std::vector<int32_t>& pathToRoot = paths[target];
-  for (int32_t i = 0; i < pathToRoot.size(); i++) {
-    loss += binaryLogistic(pathToRoot[i], binaryCode[i], lr);
+  for (int32_t i = pathOffsets[target]; i < pathOffsets[target + 1]; i++) {
+    bool code = (codeBits[i >> 6] >> (i & 63)) & 1;
+    loss += binaryLogistic(pathNodes[i], code, lr);
   }
   return loss;
 }
@@ -919,8 +631,9 @@ void Model::computeOutputSoftmax(Vector& hidden, Vector& output) const {
     output[i] = exp(output[i] - max);
     z += output[i];
   }
+  real invz = 1.0 / z;
   for (int32_t i = 0; i < osz_; i++) {
-    output[i] /= z;
+    output[i] *= invz;
   }
 }
 
@@ -983,70 +696,26 @@ void Model::computeHidden(const std::vector<int32_t>& input, Vector& hidden, boo
   }
 }
 
-void Model::computeHidden2(const std::vector<int32_t>& input, Vector& hidden, bool dropout_dict, bool dropout_sub) const {
-  assert(hidden.size() == hsz_);
+void Model::computeHidden2_mv(const std::vector<int32_t>& input, Matrix& hidden) const {
+  // one row per extra sense, from the word vector only
   hidden.zero();
-  int jjj = 0;
-  for (auto it = input.cbegin(); it != input.cend(); ++it) {
-    if(quant_) {
-      hidden.addRow(*qwi_, *it);
-    } else {
-      if (!(args_->include_dictemb) && (jjj == 0)){
-        // if include_dictemb is false, then also do the adding
-        // if jjj != 0, do the adding (later)
-      } else {
-        if (!dropout_sub){
-          hidden.addRow(*wi2_, *it);
-        }
+  for (int64_t s = 0; s < hidden.m_; s++) {
+    real* h = hidden.data_ + s * hsz_;
+    int32_t count = 0;
+    for (auto it = input.cbegin(); it != input.cend(); ++it) {
+      if (hasSense2(*it)) {
+        axpyK(h, wi2_->data_ + (s * nsense2_ + *it) * hsz_, 1.0, hsz_);
+        count++;
       }
     }
-    jjj++;
-  }
-  if (!(args_->include_dictemb) and input.size() > 1) {
-    // make sure we're not dividing by zero
-    hidden.mul(1.0 / (input.size() - 1));
-  } else {
-    hidden.mul(1.0 / input.size());
-  }
-
-  // if adding dictemb outside, add the first element of input (ngrams)
-  if (args_->add_dictemb){
-    for (auto it = input.cbegin(); it!= input.cend(); ++it){
-      hidden.addRow(*wi2_, *it);
-      break;
+    if (count > 0) {
+      for (int32_t d = 0; d < hsz_; d++) {
+        h[d] /= count;
+      }
     }
   }
 }
 
-// void Model::computeHidden2_mv(const std::vector<int32_t>& input, Vector& hidden) const {
-//   // Just using the vector for component 2
-//   assert(hidden.size() == hsz_);
-//   hidden.zero();
-//   int jjj = 0;
-//   for (auto it = input.cbegin(); it != input.cend(); ++it) {
-//     hidden.addRow(*wi2_, *it);
-//     break;
-//   }
-// }
-
-// In model.cc
-
-void Model::computeHidden2_mv(const std::vector<int32_t>& input, Vector& hidden) const {
-  assert(hidden.size() == hsz_);
-  hidden.zero();
-  int32_t count = 0; 
-
-  for (auto it = input.cbegin(); it != input.cend(); ++it) {
-    if (*it < num_words) { 
-      hidden.addRow(*wi2_, *it);
-      count++; 
-    }
-  }
-
-  if (count > 0) { 
-      hidden.mul(1.0 / count);
-  }
-}
 bool Model::comparePairs(const std::pair<real, int32_t> &l,
                          const std::pair<real, int32_t> &r) {
   return l.first > r.first;
@@ -1059,7 +728,7 @@ void Model::predict(const std::vector<int32_t>& input, int32_t k,
   heap.reserve(k + 1);
   computeHidden(input, hidden);
   if (args_->loss == loss_name::hs) {
-    dfs(k, 2 * osz_ - 2, 0.0, heap, hidden);
+    findKBestTree(k, heap, hidden);
   } else {
     findKBest(k, heap, hidden, output);
   }
@@ -1071,48 +740,157 @@ void Model::predict(const std::vector<int32_t>& input, int32_t k,
   predict(input, k, heap, hidden_, output_);
 }
 
+// Selects the top k on the raw logits, then turns only the winners into
+// log-probabilities with a single online log-sum-exp pass over the labels.
 void Model::findKBest(int32_t k, std::vector<std::pair<real, int32_t>>& heap,
                       Vector& hidden, Vector& output) const {
-  computeOutputSoftmax(hidden, output);
+  if (quant_ && args_->qout) {
+    output.mul(*qwo_, hidden);
+  } else {
+    output.mul(*wo_, hidden);
+  }
+  real max = output[0], z = 0.0;
   for (int32_t i = 0; i < osz_; i++) {
-    if (heap.size() == k && log(output[i]) < heap.front().first) {
+    real x = output[i];
+    if (x > max) {
+      z = z * std::exp(max - x) + 1.0;
+      max = x;
+    } else {
+      z += std::exp(x - max);
+    }
+    if (heap.size() == k && x < heap.front().first) {
       continue;
     }
-    heap.push_back(std::make_pair(log(output[i]), i));
+    heap.push_back(std::make_pair(x, i));
     std::push_heap(heap.begin(), heap.end(), comparePairs);
     if (heap.size() > k) {
       std::pop_heap(heap.begin(), heap.end(), comparePairs);
       heap.pop_back();
     }
   }
+  real lse = max + std::log(z);
+  for (auto it = heap.begin(); it != heap.end(); ++it) {
+    it->first -= lse;
+  }
+}
+
+// Best-first search from the root. Scores only decrease along a path, so
+// leaves come off the frontier in score order and the first k are the best.
+void Model::findKBestTree(int32_t k,
+                          std::vector<std::pair<real, int32_t>>& heap,
+                          Vector& hidden) const {
+  std::vector<std::pair<real, int32_t>> frontier;
+  frontier.push_back(std::make_pair(0.0, 2 * osz_ - 2));
+  while (!frontier.empty() && heap.size() < k) {
+    std::pop_heap(frontier.begin(), frontier.end());
+    real score = frontier.back().first;
+    int32_t node = frontier.back().second;
+    frontier.pop_back();
+
+    if (tree[node].left == -1 && tree[node].right == -1) {
+      heap.push_back(std::make_pair(score, node));
+      std::push_heap(heap.begin(), heap.end(), comparePairs);
+      continue;
+    }
+
+    real f;
+    if (quant_ && args_->qout) {
+      f= sigmoid(qwo_->dotRow(hidden, node - osz_));
+    } else {
+      f= sigmoid(wo_->dotRow(hidden, node - osz_));
+    }
+
+    frontier.push_back(std::make_pair(score + log(1.0 - f), tree[node].left));
+    std::push_heap(frontier.begin(), frontier.end());
+    frontier.push_back(std::make_pair(score + log(f), tree[node].right));
+    std::push_heap(frontier.begin(), frontier.end());
+  }
 }
 
-void Model::dfs(int32_t k, int32_t node, real score,
-                std::vector<std::pair<real, int32_t>>& heap,
-                Vector& hidden) const {
-  if (heap.size() == k && score < heap.front().first) {
-    return;
+// Softmax update for a batch of supervised examples. The B hidden vectors
+// are scored against wo_ in one pass over its rows, and each row of wo_
+// receives the rank-B update while it is still in cache.
+void Model::updateBatch(const std::vector<std::vector<int32_t>>& inputs,
+                        const std::vector<int32_t>& targets, real lr) {
+  assert(args_->loss == loss_name::softmax);
+  int64_t B = inputs.size();
+  if (B == 0) return;
+  if (hiddenB_.m_ != B) {
+    hiddenB_ = Matrix(B, hsz_);
+    hiddenT_ = Matrix(hsz_, B);
+    outputB_ = Matrix(B, osz_);
+    gradB_ = Matrix(B, hsz_);
+  }
+  for (int64_t b = 0; b < B; b++) {
+    assert(targets[b] >= 0);
+    assert(targets[b] < osz_);
+    computeHidden(inputs[b], hidden_);
+    for (int32_t j = 0; j < hsz_; j++) {
+      hiddenB_.at(b, j) = hidden_[j];
+      hiddenT_.at(j, b) = hidden_[j];
+    }
   }
+  gradB_.zero();
 
-  if (tree[node].left == -1 && tree[node].right == -1) {
-    heap.push_back(std::make_pair(score, node));
-    std::push_heap(heap.begin(), heap.end(), comparePairs);
-    if (heap.size() > k) {
-      std::pop_heap(heap.begin(), heap.end(), comparePairs);
-      heap.pop_back();
+  // the transposed tile keeps the inner loop over examples contiguous
+  std::vector<real> scores(B);
+  for (int32_t i = 0; i < osz_; i++) {
+    const real* w = wo_->data_ + int64_t(i) * hsz_;
+    std::fill(scores.begin(), scores.end(), 0.0);
+    for (int32_t j = 0; j < hsz_; j++) {
+      const real* h = hiddenT_.data_ + int64_t(j) * B;
+      real wj = w[j];
+      for (int64_t b = 0; b < B; b++) {
+        scores[b] += h[b] * wj;
+      }
+    }
+    for (int64_t b = 0; b < B; b++) {
+      outputB_.at(b, i) = scores[b];
+    }
+  }
+  for (int64_t b = 0; b < B; b++) {
+    real* out = outputB_.data_ + b * osz_;
+    real max = out[0], z = 0.0;
+    for (int32_t i = 0; i < osz_; i++) {
+      max = std::max(out[i], max);
+    }
+    for (int32_t i = 0; i < osz_; i++) {
+      out[i] = exp(out[i] - max);
+      z += out[i];
+    }
+    real invz = 1.0 / z;
+    for (int32_t i = 0; i < osz_; i++) {
+      out[i] *= invz;
+    }
+    loss_ += -log(out[targets[b]]);
+    // turn the probabilities into the per-label step sizes
+    for (int32_t i = 0; i < osz_; i++) {
+      out[i] = lr * ((i == targets[b] ? 1.0 : 0.0) - out[i]);
     }
-    return;
   }
 
-  real f;
-  if (quant_ && args_->qout) {
-    f= sigmoid(qwo_->dotRow(hidden, node - osz_));
-  } else {
-    f= sigmoid(wo_->dotRow(hidden, node - osz_));
+  for (int32_t i = 0; i < osz_; i++) {
+    real* w = wo_->data_ + int64_t(i) * hsz_;
+    for (int64_t b = 0; b < B; b++) {
+      axpyK(gradB_.data_ + b * hsz_, w, outputB_.at(b, i), hsz_);
+    }
+    for (int64_t b = 0; b < B; b++) {
+      axpyK(w, hiddenB_.data_ + b * hsz_, outputB_.at(b, i), hsz_);
+    }
   }
 
-  dfs(k, tree[node].left, score + log(1.0 - f), heap, hidden);
-  dfs(k, tree[node].right, score + log(f), heap, hidden);
+  for (int64_t b = 0; b < B; b++) {
+    real* g = gradB_.data_ + b * hsz_;
+    real scale = 1.0 / inputs[b].size();
+    for (auto it = inputs[b].cbegin(); it != inputs[b].cend(); ++it) {
+      axpyK(wi_->data_ + int64_t(*it) * hsz_, g, scale, hsz_);
+      wi_->markDirty(*it);
+    }
+  }
+  for (int32_t i = 0; wo_->tracked() && i < osz_; i++) {
+    wo_->markDirty(i);
+  }
+  nexamples_ += B;
 }
 
 float probRand() {
@@ -1133,29 +911,19 @@ void Model::update(const std::vector<int32_t>& input, int32_t target, real lr) {
     break;
   }
   
+  // only frequent words get the mixture, the tail takes the single-sense path
+  int32_t senses = hasSense2(wordidx) ? args_->senses : 1;
+  drawn_.clear();
+  if (outCache_) {
+    prepareOutput(target);
+  }
   computeHidden(input, hidden_, false, false);
-  computeHidden2_mv(input, hidden2_);
   if (args_->loss == loss_name::ns) {
-    if (args_->multi){
-      if (args_->var) {
-        loss_ += negativeSamplingMultiVecVar(wordidx, target, lr);
-      } else{
-      if (args_->expdot) {
-        loss_ += negativeSamplingMultiVecExpdot(target, lr);
-      } else {
-        loss_ += negativeSamplingMultiVec2(target, lr);
-      }
-      }
-    } else {
-      if (args_->var) {
-        // not using this version
-      } else {
-      if (args_->expdot) {
-        loss_ += negativeSamplingSingleExpdot(target, lr);
-      } else {
-        loss_ += negativeSampling(target, lr);
-      }
-      }
+    switch (senses) {
+      case 1: loss_ += negativeSamplingSenses<1>(input, wordidx, target, lr); break;
+      case 2: loss_ += negativeSamplingSenses<2>(input, wordidx, target, lr); break;
+      case 3: loss_ += negativeSamplingSenses<3>(input, wordidx, target, lr); break;
+      case 4: loss_ += negativeSamplingSenses<4>(input, wordidx, target, lr); break;
     }
   } else if (args_->loss == loss_name::hs) {
     // not using
@@ -1175,17 +943,51 @@ void Model::update(const std::vector<int32_t>& input, int32_t target, real lr) {
     wi_->addRow(grad_, *it, 1.0);
   }
 
-  // MV mode - use only vector representation for cluster 2
-  for (auto it = input.cbegin(); it != input.cend(); ++it) {
-    if (*it < num_words) { 
-      wi2_->addRow(grad2_, *it, 1.0);
+  // MV mode - use only vector representation for the other senses
+  for (int32_t k = 1; k < senses; k++) {
+    const real* g = grad2_.data_ + (k - 1) * hsz_;
+    for (auto it = input.cbegin(); it != input.cend(); ++it) {
+      if (hasSense2(*it)) {
+        axpyK(wi2_->data_ + (int64_t(k - 1) * nsense2_ + *it) * hsz_, g, 1.0, hsz_);
+      }
     }
-    // break;
   }
   // update var
   if (args_->var){
     invar_->addRow(gradvar_, wordidx, 1.0);
-    invar2_->addRow(gradvar2_, wordidx, 1.0);
+    for (int32_t k = 1; k < senses; k++) {
+      axpyK(inVarRow(k, wordidx), gradvar2_.data_ + (k - 1) * hsz_, 1.0, hsz_);
+    }
+  }
+  if (wi_->tracked()) {
+    markDirty(input, wordidx, target, senses);
+  }
+}
+
+// Flags the rows written through raw pointers by update(); Matrix::addRow
+// flags its own. The rows of a negative are flagged even when the margin
+// left them unchanged. With -outputShards there is no wo_ and only the
+// input side is flagged, the shards keeping the output rows.
+void Model::markDirty(const std::vector<int32_t>& input, int32_t wordidx,
+                      int32_t target, int32_t senses) {
+  drawn_.push_back(target);
+  for (auto it = drawn_.cbegin(); wo_ && it != drawn_.cend(); ++it) {
+    wo_->markDirty(*it);
+    if (outvar_) outvar_->markDirty(*it);
+    if (!hasSense2(*it)) continue;
+    for (int32_t k = 1; k < senses; k++) {
+      int64_t row = int64_t(k - 1) * nsense2_ + *it;
+      wo2_->markDirty(row);
+      if (outvar2_) outvar2_->markDirty(row);
+    }
+  }
+  for (int32_t k = 1; k < senses; k++) {
+    for (auto it = input.cbegin(); it != input.cend(); ++it) {
+      if (hasSense2(*it)) {
+        wi2_->markDirty(int64_t(k - 1) * nsense2_ + *it);
+      }
+    }
+    if (invar2_) invar2_->markDirty(int64_t(k - 1) * nsense2_ + wordidx);
   }
 }
 
@@ -1243,12 +1045,41 @@ void Model::initTableNegatives(const std::vector<int64_t>& counts) {
   std::shuffle(negatives.begin(), negatives.end(), rng);
 }
 
+// Adds the targets from `first` on to the table without rebuilding it:
+// each new entry goes to a random position, so the table stays shuffled.
+// The output and sense matrices may have grown since, counts covers all
+// the output rows.
+void Model::addNegatives(const std::vector<int64_t>& counts, int32_t first) {
+  osz_ = wo_->m_;
+  if (wi2_ && args_->senses > 1) {
+    nsense2_ = wi2_->m_ / (args_->senses - 1);
+  }
+  assert(counts.size() == osz_);
+  real z = 0.0;
+  for (size_t i = 0; i < counts.size(); i++) {
+    z += pow(counts[i], 0.5);
+  }
+  for (size_t i = first; i < counts.size(); i++) {
+    real c = pow(counts[i], 0.5);
+    for (size_t j = 0; j < c * NEGATIVE_TABLE_SIZE / z; j++) {
+      negatives.push_back(i);
+      std::uniform_int_distribution<size_t> uniform(0, negatives.size() - 1);
+      std::swap(negatives.back(), negatives[uniform(rng)]);
+    }
+  }
+}
+
 int32_t Model::getNegative(int32_t target) {
   int32_t negative;
   do {
     negative = negatives[negpos];
     negpos = (negpos + 1) % negatives.size();
   } while (target == negative);
+  if (outCache_) {
+    negAhead_--;
+  } else if (wo_->tracked()) {
+    drawn_.push_back(negative);
+  }
   return negative;
 }
 
@@ -1282,17 +1113,22 @@ void Model::buildTree(const std::vector<int64_t>& counts) {
     tree[mini[1]].parent = i;
     tree[mini[1]].binary = true;
   }
+  pathOffsets.assign(osz_ + 1, 0);
+  pathNodes.clear();
   for (int32_t i = 0; i < osz_; i++) {
-    std::vector<int32_t> path;
-    std::vector<bool> code;
-    int32_t j = i;
-    while (tree[j].parent != -1) {
-      path.push_back(tree[j].parent - osz_);
-      code.push_back(tree[j].binary);
-      j = tree[j].parent;
+    for (int32_t j = i; tree[j].parent != -1; j = tree[j].parent) {
+      pathNodes.push_back(tree[j].parent - osz_);
+    }
+    pathOffsets[i + 1] = pathNodes.size();
+  }
+  codeBits.assign((pathNodes.size() + 63) / 64, 0);
+  for (int32_t i = 0; i < osz_; i++) {
+    int64_t pos = pathOffsets[i];
+    for (int32_t j = i; tree[j].parent != -1; j = tree[j].parent, pos++) {
+      if (tree[j].binary) {
+        codeBits[pos >> 6] |= uint64_t(1) << (pos & 63);
+      }
     }
-    paths.push_back(path);
-    codes.push_back(code);
   }
 }
 
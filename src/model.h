@@ -21,6 +21,7 @@
 #include "vector.h"
 #include "qmatrix.h"
 #include "real.h"
+#include "shard.h"
 
 #define SIGMOID_TABLE_SIZE 512
 #define MAX_SIGMOID 8
@@ -48,18 +49,26 @@ class Model {
     std::shared_ptr<Matrix> outvar2_;
 
     std::int32_t num_words;
+    // words with id < nsense2_ carry args_->senses Gaussian components
+    int32_t nsense2_;
 
     std::shared_ptr<QMatrix> qwi_;
     std::shared_ptr<QMatrix> qwo_;
     std::shared_ptr<Args> args_;
     Vector hidden_;
-    Vector hidden2_;
+    // senses 1..K-1, one row each
+    Matrix hidden2_;
     Vector output_;
     Vector grad_;
-    Vector grad2_;
+    Matrix grad2_;
     Vector temp_;
     Vector gradvar_;
-    Vector gradvar2_;
+    Matrix gradvar2_;
+    // used for mini-batch softmax: one row per example
+    Matrix hiddenB_;
+    Matrix hiddenT_;
+    Matrix outputB_;
+    Matrix gradB_;
     int32_t hsz_;
     int32_t osz_;
     real loss_;
@@ -69,15 +78,48 @@ class Model {
     // used for negative sampling:
     std::vector<int32_t> negatives;
     size_t negpos;
-    // used for hierarchical softmax:
-    std::vector< std::vector<int32_t> > paths;
-    std::vector< std::vector<bool> > codes;
+    // negatives drawn by the current update, for the dirty rows
+    std::vector<int32_t> drawn_;
+    // -outputShards: the output rows come from this cache instead of wo_,
+    // wo2_, outvar_ and outvar2_, the planes of a word being its outSenses_
+    // senses and then their variances
+    std::unique_ptr<OutputCache> outCache_;
+    int32_t outSenses_;
+    // negatives whose rows were pulled ahead, valid until the next flush
+    int64_t negAhead_;
+    int64_t negFlushes_;
+    // used for hierarchical softmax: the path of label i is
+    // pathNodes[pathOffsets[i] .. pathOffsets[i + 1]), with the matching
+    // codes packed one bit per position in codeBits
+    std::vector<int32_t> pathOffsets;
+    std::vector<int32_t> pathNodes;
+    std::vector<uint64_t> codeBits;
     std::vector<Node> tree;
 
     static bool comparePairs(const std::pair<real, int32_t>&,
                              const std::pair<real, int32_t>&);
 
     int32_t getNegative(int32_t target);
+    bool hasSense2(int32_t) const;
+    real* outRow(int32_t, int32_t) const;
+    real* outVarRow(int32_t, int32_t) const;
+    real* inVarRow(int32_t, int32_t) const;
+    void markDirty(const std::vector<int32_t>&, int32_t, int32_t, int32_t);
+    void prepareOutput(int32_t);
+
+    template <int K>
+    real mixtureEnergy(const real* const*, real* const*,
+                       real (&)[K][K], real&) const;
+    template <int K>
+    real mixtureEnergyVar(real* const*, const real* const*, real* const*,
+                          real* const*, real (&)[K], real (&)[K][K]) const;
+    template <int K>
+    real negativeSamplingMixture(int32_t, real);
+    template <int K>
+    real negativeSamplingMixtureVar(int32_t, int32_t, real);
+    template <int K>
+    real negativeSamplingSenses(const std::vector<int32_t>&, int32_t,
+                                int32_t, real);
     void initSigmoid();
     void initLog();
 
@@ -109,21 +151,25 @@ class Model {
                  Vector&, Vector&) const;
     void predict(const std::vector<int32_t>&, int32_t,
                  std::vector<std::pair<real, int32_t>>&);
-    void dfs(int32_t, int32_t, real,
-             std::vector<std::pair<real, int32_t>>&,
-             Vector&) const;
+    void findKBestTree(int32_t, std::vector<std::pair<real, int32_t>>&,
+                       Vector&) const;
     void findKBest(int32_t, std::vector<std::pair<real, int32_t>>&,
                    Vector&, Vector&) const;
     void update(const std::vector<int32_t>&, int32_t, real);
+    void updateBatch(const std::vector<std::vector<int32_t>>&,
+                     const std::vector<int32_t>&, real);
     void computeHidden(const std::vector<int32_t>&, Vector&) const;
     void computeHidden(const std::vector<int32_t>&, Vector&, bool, bool) const;
-    void computeHidden2(const std::vector<int32_t>&, Vector&, bool, bool) const;
-    void computeHidden2_mv(const std::vector<int32_t>&, Vector&) const;
+    void computeHidden2_mv(const std::vector<int32_t>&, Matrix&) const;
     void computeOutputSoftmax(Vector&, Vector&) const;
     void computeOutputSoftmax();
 
+    void setOutputCache(std::unique_ptr<OutputCache>, int32_t, int32_t);
+    void prefetchOutput(const std::vector<int32_t>&);
+
     void setTargetCounts(const std::vector<int64_t>&);
     void initTableNegatives(const std::vector<int64_t>&);
+    void addNegatives(const std::vector<int64_t>&, int32_t);
     void buildTree(const std::vector<int64_t>&);
     real getLoss() const;
     real sigmoid(real) const;
@@ -136,17 +182,8 @@ class Model {
     real groupSparsityRegularization(double, int32_t);
 
     real elk(int32_t, bool, real);
-    real negativeSamplingMulti(int32_t, real);
-    real negativeSamplingMultiVec2(int32_t, real);
-    real negativeSamplingMultiVecExpdot(int32_t, real);
-    std::vector<float> energy(int32_t);
-    real partial_energy(Vector& , Vector& , std::shared_ptr<Matrix> , int32_t );
-    std::vector<float> energy_expdot(int32_t);
-    real partial_energy_expdot(Vector& , Vector& , std::shared_ptr<Matrix> , int32_t );
-
-    real negativeSamplingMultiVecVar(int32_t, int32_t, real);
-    real partial_energy_vecvar(Vector& , Vector& , std::shared_ptr<Matrix>, int32_t, int32_t, std::shared_ptr<Matrix>, std::shared_ptr<Matrix>);
-    std::vector<float> energy_vecvar(int32_t, int32_t);
+    real negativeSamplingVecVar(int32_t, int32_t, real);
+    real partial_energy_vecvar(Vector&, int32_t, int32_t);
 };
 
 }
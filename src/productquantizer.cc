@@ -162,6 +162,34 @@ real ProductQuantizer::mulcode(const Vector& x, const uint8_t* codes,
   return res * alpha;
 }
 
+void ProductQuantizer::mulcodeTable(const Vector& x,
+                                    std::vector<real>& table) const {
+  table.assign(nsubq_ * ksub_, 0.0);
+  auto d = dsub_;
+  for (auto m = 0; m < nsubq_; m++) {
+    if (m == nsubq_ - 1) {d = lastdsub_;}
+    for (auto k = 0; k < ksub_; k++) {
+      const real* c = get_centroids(m, k);
+      real res = 0.0;
+      for (auto n = 0; n < d; n++) {
+        res += x[m * dsub_ + n] * c[n];
+      }
+      table[m * ksub_ + k] = res;
+    }
+  }
+}
+
+real ProductQuantizer::mulcodeLookup(const std::vector<real>& table,
+                                     const uint8_t* codes,
+                                     int32_t t, real alpha) const {
+  real res = 0.0;
+  const uint8_t* code = codes + nsubq_ * t;
+  for (auto m = 0; m < nsubq_; m++) {
+    res += table[m * ksub_ + code[m]];
+  }
+  return res * alpha;
+}
+
 void ProductQuantizer::addcode(Vector& x, const uint8_t* codes,
                                int32_t t, real alpha) const {
   auto d = dsub_;
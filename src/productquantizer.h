@@ -55,6 +55,9 @@ class ProductQuantizer {
     void train(int, const real*);
 
     real mulcode(const Vector&, const uint8_t*, int32_t, real) const;
+    void mulcodeTable(const Vector&, std::vector<real>&) const;
+    real mulcodeLookup(const std::vector<real>&, const uint8_t*,
+                       int32_t, real) const;
     void addcode(Vector&, const uint8_t*, int32_t, real) const;
     void compute_code(const real*, uint8_t*)  const;
     void compute_codes(const real*, uint8_t*, int32_t)  const;
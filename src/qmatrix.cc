@@ -16,7 +16,7 @@
 
 namespace fasttext {
 
-QMatrix::QMatrix() : qnorm_(false),
+QMatrix::QMatrix() : codes_(nullptr), norm_codes_(nullptr), qnorm_(false),
   m_(0), n_(0), codesize_(0) {}
 
 QMatrix::QMatrix(const Matrix& mat, int32_t dsub, bool qnorm)
@@ -78,6 +78,28 @@ real QMatrix::dotRow(const Vector& vec, int64_t i) const {
   return pq_->mulcode(vec, codes_, i, norm);
 }
 
+// Scores every row from one table of vec . centroid per subquantizer, so a
+// row costs nsubq lookups instead of a full dot product. Building the table
+// costs about as much as 256 direct rows, smaller matrices skip it.
+void QMatrix::dotRows(const Vector& vec, real* out) const {
+  assert(vec.size() == n_);
+  if (m_ <= 256) {
+    for (int64_t i = 0; i < m_; i++) {
+      out[i] = dotRow(vec, i);
+    }
+    return;
+  }
+  std::vector<real> table;
+  pq_->mulcodeTable(vec, table);
+  for (int64_t i = 0; i < m_; i++) {
+    real norm = 1;
+    if (qnorm_) {
+      norm = npq_->get_centroids(0, norm_codes_[i])[0];
+    }
+    out[i] = pq_->mulcodeLookup(table, codes_, i, norm);
+  }
+}
+
 int64_t QMatrix::getM() const {
   return m_;
 }
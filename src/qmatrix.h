@@ -56,6 +56,7 @@ class QMatrix {
 
     void addToVector(Vector& x, int32_t t) const;
     real dotRow(const Vector&, int64_t) const;
+    void dotRows(const Vector&, real*) const;
 
     void save(std::ostream&);
     void load(std::istream&);
@@ -0,0 +1,102 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ *               2018-present, Ben Athiwaratkun
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "scanner.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace fasttext {
+
+static inline bool isSpace(char c) {
+  return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\v' ||
+         c == '\f' || c == '\0';
+}
+
+// \t \n \v \f \r are the bytes 9 to 13: one unsigned range test on c - 9,
+// plus equality tests for the space and the NUL byte.
+static void classify(const char* p, uint64_t& space, uint64_t& newline) {
+#if defined(__AVX2__)
+  space = 0;
+  newline = 0;
+  for (int32_t h = 0; h < 64; h += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + h));
+    __m256i x = _mm256_sub_epi8(v, _mm256_set1_epi8(9));
+    __m256i ctrl = _mm256_cmpeq_epi8(_mm256_min_epu8(x, _mm256_set1_epi8(4)), x);
+    __m256i sp = _mm256_or_si256(
+        _mm256_or_si256(ctrl, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '))),
+        _mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+    __m256i nl = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'));
+    space |= uint64_t(uint32_t(_mm256_movemask_epi8(sp))) << h;
+    newline |= uint64_t(uint32_t(_mm256_movemask_epi8(nl))) << h;
+  }
+#elif defined(__SSE2__)
+  space = 0;
+  newline = 0;
+  for (int32_t h = 0; h < 64; h += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + h));
+    __m128i x = _mm_sub_epi8(v, _mm_set1_epi8(9));
+    __m128i ctrl = _mm_cmpeq_epi8(_mm_min_epu8(x, _mm_set1_epi8(4)), x);
+    __m128i sp = _mm_or_si128(
+        _mm_or_si128(ctrl, _mm_cmpeq_epi8(v, _mm_set1_epi8(' '))),
+        _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+    __m128i nl = _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'));
+    space |= uint64_t(_mm_movemask_epi8(sp)) << h;
+    newline |= uint64_t(_mm_movemask_epi8(nl)) << h;
+  }
+#else
+  space = 0;
+  newline = 0;
+  for (int32_t i = 0; i < 64; i++) {
+    space |= uint64_t(isSpace(p[i])) << i;
+    newline |= uint64_t(p[i] == '\n') << i;
+  }
+#endif
+}
+
+TextScanner::TextScanner()
+  : ptr_(nullptr), end_(nullptr), block_(nullptr), space_(0), newline_(0) {}
+
+TextScanner::TextScanner(const char* begin, const char* end) {
+  reset(begin, end);
+}
+
+void TextScanner::reset(const char* begin, const char* end) {
+  ptr_ = begin;
+  end_ = end;
+  block_ = begin;
+  space_ = ~0ULL;
+  newline_ = 0;
+  if (begin < end) {
+    load(begin);
+  }
+}
+
+// The last partial block of the buffer is classified byte by byte rather
+// than reading past the end of the mapping.
+void TextScanner::load(const char* p) {
+  block_ = p;
+  if (end_ - p >= BLOCK) {
+    classify(p, space_, newline_);
+    return;
+  }
+  int32_t n = end_ - p;
+  space_ = ~0ULL << n;
+  newline_ = 0;
+  for (int32_t i = 0; i < n; i++) {
+    space_ |= uint64_t(isSpace(p[i])) << i;
+    newline_ |= uint64_t(p[i] == '\n') << i;
+  }
+}
+
+}
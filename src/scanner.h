@@ -0,0 +1,98 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ *               2018-present, Ben Athiwaratkun
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#ifndef FASTTEXT_SCANNER_H
+#define FASTTEXT_SCANNER_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace fasttext {
+
+// Splits a text buffer on the readWord delimiters (space, \n, \r, \t, \v,
+// \f and \0). The buffer is classified 64 bytes at a time into delimiter
+// and newline bitmasks, with AVX2 or SSE2 when the compiler targets them,
+// and token boundaries are then read off the masks with count-trailing-zeros.
+class TextScanner {
+  private:
+    static const int32_t BLOCK = 64;
+
+    const char* ptr_;
+    const char* end_;
+    // first byte described by the masks; bytes past end_ count as
+    // delimiters so that every search stops at end_
+    const char* block_;
+    uint64_t space_;
+    uint64_t newline_;
+
+    void load(const char*);
+
+    // bit of p in the masks, reclassifying when p has left the block
+    int32_t offset(const char* p) {
+      if (p >= block_ + BLOCK) load(p);
+      return p - block_;
+    }
+
+  public:
+    TextScanner();
+    TextScanner(const char*, const char*);
+
+    void reset(const char*, const char*);
+
+    // Same tokens as Dictionary::readWord. A newline met before any
+    // character is returned as an empty token, a newline ending a word is
+    // left for the next call.
+    bool next(const char*& word, size_t& len) {
+      while (ptr_ < end_) {
+        int32_t i = offset(ptr_);
+        uint64_t start = ~space_ & (~0ULL << i);
+        uint64_t nl = newline_ & (~0ULL << i);
+        if (nl != 0 && (start == 0 ||
+                        __builtin_ctzll(nl) < __builtin_ctzll(start))) {
+          ptr_ = block_ + __builtin_ctzll(nl) + 1;
+          word = ptr_ - 1;
+          len = 0;
+          return true;
+        }
+        if (start != 0) {
+          ptr_ = block_ + __builtin_ctzll(start);
+          word = ptr_;
+          for (;;) {
+            int32_t j = offset(ptr_);
+            uint64_t stop = space_ & (~0ULL << j);
+            if (stop != 0) {
+              ptr_ = block_ + __builtin_ctzll(stop);
+              break;
+            }
+            ptr_ = block_ + BLOCK;
+          }
+          len = ptr_ - word;
+          if (ptr_ < end_ && *ptr_ != '\n') {
+            ptr_++;
+          }
+          return true;
+        }
+        ptr_ = block_ + BLOCK < end_ ? block_ + BLOCK : end_;
+      }
+      return false;
+    }
+
+    bool done() const {
+      return ptr_ >= end_;
+    }
+
+    const char* position() const {
+      return ptr_;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,352 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ *               2018-present, Ben Athiwaratkun
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "shard.h"
+
+#include <assert.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+namespace fasttext {
+
+// A request is the op, the id count and the ids, then the moves of a push.
+// A pull is answered with the rows, a push and a release with nothing.
+static const int32_t kPull = 1;
+static const int32_t kPush = 2;
+static const int32_t kRelease = 3;
+
+// ids read back per request by gather()
+static const int64_t kGatherRows = 16384;
+
+static std::string request(int32_t op, const std::vector<int32_t>& ids,
+                           const real* values, int64_t width) {
+  std::string buf;
+  int64_t n = ids.size();
+  buf.append((const char*) &op, sizeof(int32_t));
+  buf.append((const char*) &n, sizeof(int64_t));
+  buf.append((const char*) ids.data(), n * sizeof(int32_t));
+  if (values != nullptr) {
+    buf.append((const char*) values, n * width * sizeof(real));
+  }
+  return buf;
+}
+
+static void call(SyncChannel& channel, const std::string& message,
+                 std::string& reply) {
+  if (!channel.send(message) || !channel.receive(reply)) {
+    std::cerr << "Lost the owner of some output rows!" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+}
+
+OutputShard::OutputShard(int64_t begin, int64_t end, int64_t width)
+  : begin_(begin), end_(end), width_(width),
+    rows_((end - begin) * width, 0.0), listener_(-1), released_(false) {}
+
+OutputShard::~OutputShard() {
+  if (listener_ >= 0) {
+    SyncChannel::stop(listener_);
+    acceptor_.join();
+  }
+  for (auto it = connections_.begin(); it != connections_.end(); ++it) {
+    it->join();
+  }
+}
+
+// Contiguous ranges of ids, as even as the count allows.
+std::vector<int64_t> OutputShard::bounds(int64_t nrows, int32_t nshards) {
+  std::vector<int64_t> bounds;
+  for (int32_t r = 0; r <= nshards; r++) {
+    bounds.push_back(nrows * r / nshards);
+  }
+  return bounds;
+}
+
+int64_t OutputShard::begin() const {
+  return begin_;
+}
+
+int64_t OutputShard::end() const {
+  return end_;
+}
+
+int64_t OutputShard::width() const {
+  return width_;
+}
+
+real* OutputShard::row(int64_t id) {
+  return rows_.data() + (id - begin_) * width_;
+}
+
+void OutputShard::pull(const std::vector<int32_t>& ids, real* out) {
+  for (size_t i = 0; i < ids.size(); i++) {
+    const real* r = row(ids[i]);
+    std::copy(r, r + width_, out + i * width_);
+  }
+}
+
+void OutputShard::push(const std::vector<int32_t>& ids, const real* moves) {
+  for (size_t i = 0; i < ids.size(); i++) {
+    real* r = row(ids[i]);
+    const real* m = moves + i * width_;
+    for (int64_t j = 0; j < width_; j++) {
+      r[j] += m[j];
+    }
+  }
+}
+
+void OutputShard::listen(int32_t port) {
+  listener_ = SyncChannel::listen(port);
+  if (listener_ < 0) {
+    std::cerr << "Cannot listen on port " << port << "!" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  acceptor_ = std::thread([this]() { accept(); });
+}
+
+// One thread per connection, until the listener is stopped.
+void OutputShard::accept() {
+  for (;;) {
+    std::unique_ptr<SyncChannel> channel = SyncChannel::accept(listener_);
+    if (!channel) {
+      return;
+    }
+    SyncChannel* c = channel.release();
+    std::lock_guard<std::mutex> lock(mutex_);
+    connections_.push_back(std::thread([this, c]() { serve(c); }));
+  }
+}
+
+void OutputShard::serve(SyncChannel* c) {
+  std::unique_ptr<SyncChannel> channel(c);
+  std::string message;
+  std::vector<int32_t> ids;
+  std::vector<real> rows;
+  while (channel->receive(message)) {
+    int32_t op;
+    int64_t n;
+    if (message.size() < sizeof(int32_t) + sizeof(int64_t)) break;
+    std::memcpy(&op, message.data(), sizeof(int32_t));
+    std::memcpy(&n, message.data() + sizeof(int32_t), sizeof(int64_t));
+    size_t pos = sizeof(int32_t) + sizeof(int64_t);
+    size_t size = pos + n * sizeof(int32_t);
+    if (op == kPush) size += n * width_ * sizeof(real);
+    if (n < 0 || message.size() != size) break;
+    ids.resize(n);
+    std::memcpy(ids.data(), message.data() + pos, n * sizeof(int32_t));
+    bool valid = true;
+    for (auto it = ids.cbegin(); it != ids.cend(); ++it) {
+      valid = valid && *it >= begin_ && *it < end_;
+    }
+    if (!valid) break;
+    std::string reply;
+    if (op == kPull) {
+      rows.resize(n * width_);
+      pull(ids, rows.data());
+      reply.assign((const char*) rows.data(), rows.size() * sizeof(real));
+    } else if (op == kPush) {
+      pos += n * sizeof(int32_t);
+      rows.resize(n * width_);
+      std::memcpy(rows.data(), message.data() + pos,
+                  rows.size() * sizeof(real));
+      push(ids, rows.data());
+    } else if (op == kRelease) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      released_ = true;
+      releasedCv_.notify_all();
+    }
+    if (!channel->send(reply)) break;
+  }
+}
+
+void OutputShard::waitReleased() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  releasedCv_.wait(lock, [this]() { return released_; });
+}
+
+// Reads every row back into rows, in id order, and releases the owners.
+void OutputShard::gather(std::shared_ptr<OutputShard> local, int32_t rank,
+                         const std::vector<std::string>& owners,
+                         const std::vector<int64_t>& bounds,
+                         std::vector<real>& rows) {
+  int64_t width = local->width();
+  rows.assign(bounds.back() * width, 0.0);
+  for (int32_t r = 0; r < owners.size(); r++) {
+    if (r == rank) {
+      std::copy(local->row(local->begin()), local->row(local->end()),
+                rows.data() + local->begin() * width);
+      continue;
+    }
+    std::unique_ptr<SyncChannel> channel =
+        SyncChannel::connect(owners[r], 60.0);
+    if (!channel) {
+      std::cerr << "Cannot reach the owner of output rows at " << owners[r]
+                << "!" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    std::string reply;
+    std::vector<int32_t> ids;
+    for (int64_t b = bounds[r]; b < bounds[r + 1]; b += kGatherRows) {
+      int64_t e = std::min(b + kGatherRows, bounds[r + 1]);
+      ids.clear();
+      for (int64_t id = b; id < e; id++) {
+        ids.push_back(id);
+      }
+      call(*channel, request(kPull, ids, nullptr, width), reply);
+      std::memcpy(rows.data() + b * width, reply.data(), reply.size());
+    }
+    call(*channel, request(kRelease, std::vector<int32_t>(), nullptr, width),
+         reply);
+  }
+}
+
+OutputCache::OutputCache(std::shared_ptr<OutputShard> local,
+                         const std::vector<int64_t>& bounds,
+                         const std::vector<std::string>& owners,
+                         int64_t capacity)
+  : local_(local), bounds_(bounds), owners_(owners),
+    channels_(owners.size()), rank_(-1), width_(local->width()),
+    capacity_(capacity), values_((capacity + kSlack) * width_),
+    pulled_((capacity + kSlack) * width_), flushes_(0) {
+  if (local->end() > local->begin()) {
+    rank_ = owner(local->begin());
+  }
+}
+
+OutputCache::~OutputCache() {
+  flush();
+}
+
+int32_t OutputCache::owner(int32_t id) const {
+  return std::upper_bound(bounds_.begin(), bounds_.end(), id) -
+         bounds_.begin() - 1;
+}
+
+SyncChannel& OutputCache::channel(int32_t r) {
+  if (!channels_[r]) {
+    channels_[r] = SyncChannel::connect(owners_[r], 60.0);
+    if (!channels_[r]) {
+      std::cerr << "Cannot reach the owner of output rows at " << owners_[r]
+                << "!" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+  return *channels_[r];
+}
+
+// Gives the ids the next slots and pulls them, one request per owner.
+void OutputCache::load(const std::vector<int32_t>& ids) {
+  std::vector<std::vector<int32_t>> byOwner(owners_.size());
+  for (auto it = ids.cbegin(); it != ids.cend(); ++it) {
+    slots_[*it] = ids_.size();
+    ids_.push_back(*it);
+    byOwner[owner(*it)].push_back(*it);
+  }
+  std::string reply;
+  std::vector<real> rows;
+  for (int32_t r = 0; r < owners_.size(); r++) {
+    if (byOwner[r].empty()) continue;
+    const real* pulled;
+    if (r == rank_) {
+      rows.resize(byOwner[r].size() * width_);
+      local_->pull(byOwner[r], rows.data());
+      pulled = rows.data();
+    } else {
+      call(channel(r), request(kPull, byOwner[r], nullptr, width_), reply);
+      pulled = (const real*) reply.data();
+    }
+    for (size_t i = 0; i < byOwner[r].size(); i++) {
+      int64_t slot = slots_[byOwner[r][i]];
+      std::copy(pulled + i * width_, pulled + (i + 1) * width_,
+                values_.data() + slot * width_);
+      std::copy(pulled + i * width_, pulled + (i + 1) * width_,
+                pulled_.data() + slot * width_);
+    }
+  }
+}
+
+// A miss inside an update takes one of the slack slots, which reserve()
+// keeps free at the start of every update.
+real* OutputCache::row(int32_t id) {
+  auto it = slots_.find(id);
+  if (it == slots_.end()) {
+    assert(ids_.size() < capacity_ + kSlack);
+    load(std::vector<int32_t>(1, id));
+    it = slots_.find(id);
+  }
+  return values_.data() + int64_t(it->second) * width_;
+}
+
+void OutputCache::fetch(const std::vector<int32_t>& ids) {
+  std::vector<int32_t> missing;
+  for (auto it = ids.cbegin(); it != ids.cend(); ++it) {
+    if (slots_.count(*it) == 0) missing.push_back(*it);
+  }
+  std::sort(missing.begin(), missing.end());
+  missing.erase(std::unique(missing.begin(), missing.end()), missing.end());
+  if (missing.empty()) {
+    return;
+  }
+  if (ids_.size() + missing.size() > capacity_) {
+    flush();
+    missing = ids;
+    std::sort(missing.begin(), missing.end());
+    missing.erase(std::unique(missing.begin(), missing.end()), missing.end());
+    if (missing.size() > capacity_) {
+      capacity_ = missing.size();
+      values_.resize((capacity_ + kSlack) * width_);
+      pulled_.resize((capacity_ + kSlack) * width_);
+    }
+  }
+  load(missing);
+}
+
+void OutputCache::reserve(int64_t n) {
+  if (ids_.size() + n > capacity_ + kSlack) {
+    flush();
+  }
+}
+
+// Pushes the moved rows back to their owners and empties the cache.
+void OutputCache::flush() {
+  std::vector<std::vector<int32_t>> byOwner(owners_.size());
+  std::vector<std::vector<real>> moves(owners_.size());
+  for (size_t slot = 0; slot < ids_.size(); slot++) {
+    const real* v = values_.data() + slot * width_;
+    const real* p = pulled_.data() + slot * width_;
+    if (std::equal(v, v + width_, p)) continue;
+    int32_t r = owner(ids_[slot]);
+    byOwner[r].push_back(ids_[slot]);
+    for (int64_t j = 0; j < width_; j++) {
+      moves[r].push_back(v[j] - p[j]);
+    }
+  }
+  std::string reply;
+  for (int32_t r = 0; r < owners_.size(); r++) {
+    if (byOwner[r].empty()) continue;
+    if (r == rank_) {
+      local_->push(byOwner[r], moves[r].data());
+    } else {
+      call(channel(r), request(kPush, byOwner[r], moves[r].data(), width_),
+           reply);
+    }
+  }
+  slots_.clear();
+  ids_.clear();
+  flushes_++;
+}
+
+int64_t OutputCache::flushes() const {
+  return flushes_;
+}
+
+}
@@ -0,0 +1,119 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ *               2018-present, Ben Athiwaratkun
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#ifndef FASTTEXT_SHARD_H
+#define FASTTEXT_SHARD_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "real.h"
+#include "sync.h"
+
+namespace fasttext {
+
+// -outputShards: the output side of the model split by word id over the
+// processes of a -workers run, process r owning the ids in
+// [bounds[r], bounds[r + 1]). The rows of a word are kept together as
+// planes of dim reals: one per output sense, then one per output variance
+// when the model has them.
+
+// The rows a process owns, served to the training threads of every
+// process. Pushed moves are added without locks, as in the local matrices.
+class OutputShard {
+  private:
+    int64_t begin_;
+    int64_t end_;
+    int64_t width_;
+    std::vector<real> rows_;
+
+    int listener_;
+    std::thread acceptor_;
+    std::mutex mutex_;
+    std::vector<std::thread> connections_;
+    std::condition_variable releasedCv_;
+    bool released_;
+
+    void accept();
+    void serve(SyncChannel*);
+
+  public:
+    OutputShard(int64_t, int64_t, int64_t);
+    ~OutputShard();
+
+    static std::vector<int64_t> bounds(int64_t, int32_t);
+
+    int64_t begin() const;
+    int64_t end() const;
+    int64_t width() const;
+    real* row(int64_t);
+    void pull(const std::vector<int32_t>&, real*);
+    void push(const std::vector<int32_t>&, const real*);
+
+    void listen(int32_t);
+    // returns once rank 0 has read the rows back
+    void waitReleased();
+
+    // every row from the owners, rank 0 at the end of training
+    static void gather(std::shared_ptr<OutputShard>, int32_t,
+                       const std::vector<std::string>&,
+                       const std::vector<int64_t>&,
+                       std::vector<real>&);
+};
+
+// The output rows one training thread works on: pulled from their owners a
+// line at a time, updated in place by the loss, and pushed back as the
+// difference to what was pulled when the cache is full or destroyed. A row
+// written elsewhere meanwhile is only seen after the next flush.
+class OutputCache {
+  private:
+    // rows that can still be pulled one at a time inside an update
+    static const int64_t kSlack = 64;
+
+    std::shared_ptr<OutputShard> local_;
+    std::vector<int64_t> bounds_;
+    std::vector<std::string> owners_;
+    std::vector<std::unique_ptr<SyncChannel>> channels_;
+    // rank of the local rows, -1 when this process owns none
+    int32_t rank_;
+    int64_t width_;
+    int64_t capacity_;
+    std::unordered_map<int32_t, int32_t> slots_;
+    std::vector<int32_t> ids_;
+    std::vector<real> values_;
+    std::vector<real> pulled_;
+    int64_t flushes_;
+
+    int32_t owner(int32_t) const;
+    SyncChannel& channel(int32_t);
+    void load(const std::vector<int32_t>&);
+
+  public:
+    OutputCache(std::shared_ptr<OutputShard>, const std::vector<int64_t>&,
+                const std::vector<std::string>&, int64_t);
+    ~OutputCache();
+
+    real* row(int32_t);
+    // fetch() and reserve() may flush: no row pointer may be held across
+    void fetch(const std::vector<int32_t>&);
+    void reserve(int64_t);
+    void flush();
+    int64_t flushes() const;
+};
+
+}
+
+#endif
@@ -0,0 +1,282 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ *               2018-present, Ben Athiwaratkun
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "shm.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <thread>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace fasttext {
+
+static const int32_t kShmMagic = 0x4d485346;
+static const int32_t kShmVersion = 2;
+static const int32_t kShmMatrices = 8;
+static const int64_t kShmAlign = 64;
+// how long rank 0 waits, once done itself, for a worker that never joined
+static const double kShmJoinGrace = 60.0;
+
+// One per rank, right after the header: pid is 0 until the worker joins.
+struct SharedSlot {
+  std::atomic<int32_t> pid;
+  std::atomic<int32_t> finished;
+};
+
+// rows[i] is -1 when the model has no matrix i; offsets are from the start
+// of the segment. ready is set once the creator has filled it.
+struct SharedHeader {
+  int32_t magic;
+  int32_t version;
+  uint64_t fingerprint;
+  int32_t workers;
+  std::atomic<int32_t> ready;
+  std::atomic<int32_t> attached;
+  std::atomic<int32_t> finished;
+  int64_t bytes;
+  int64_t metaOffset;
+  int64_t metaBytes;
+  int64_t rows[kShmMatrices];
+  int64_t cols[kShmMatrices];
+  int64_t offsets[kShmMatrices];
+};
+
+static int64_t aligned(int64_t n) {
+  return (n + kShmAlign - 1) / kShmAlign * kShmAlign;
+}
+
+// shm_open() wants a single leading slash
+static std::string segmentName(const std::string& name) {
+  return name[0] == '/' ? name : "/" + name;
+}
+
+SharedStore::SharedStore(void* base, size_t bytes)
+  : base_(base), bytes_(bytes) {}
+
+SharedStore::~SharedStore() {
+#ifndef _WIN32
+  munmap(base_, bytes_);
+#endif
+}
+
+SharedHeader* SharedStore::header() const {
+  return (SharedHeader*) base_;
+}
+
+SharedSlot* SharedStore::slot(int32_t rank) const {
+  return (SharedSlot*) (header() + 1) + rank;
+}
+
+std::unique_ptr<SharedStore> SharedStore::create(
+    const std::string& name, const std::string& meta,
+    const std::vector<std::shared_ptr<Matrix>>& matrices,
+    uint64_t fingerprint, int32_t workers) {
+#ifndef _WIN32
+  int64_t bytes = aligned(sizeof(SharedHeader) + workers * sizeof(SharedSlot));
+  int64_t metaOffset = bytes;
+  bytes = aligned(bytes + meta.size());
+  int64_t offsets[kShmMatrices];
+  for (int32_t i = 0; i < kShmMatrices; i++) {
+    offsets[i] = bytes;
+    if (matrices[i]) {
+      bytes = aligned(bytes + matrices[i]->m_ * matrices[i]->n_ * sizeof(real));
+    }
+  }
+  int fd = shm_open(segmentName(name).c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0 && errno == EEXIST) {
+    return nullptr;
+  }
+  if (fd < 0 || ftruncate(fd, bytes) != 0) {
+    std::cerr << "Cannot create the shared memory segment " << name << "!"
+              << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  void* base = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    std::cerr << "Cannot map the shared memory segment " << name << "!"
+              << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  SharedHeader* h = new (base) SharedHeader();
+  h->magic = kShmMagic;
+  h->version = kShmVersion;
+  h->fingerprint = fingerprint;
+  h->workers = workers;
+  h->attached = 0;
+  h->finished = 0;
+  for (int32_t i = 0; i < workers; i++) {
+    SharedSlot* slot = new ((SharedSlot*) (h + 1) + i) SharedSlot();
+    slot->pid = 0;
+    slot->finished = 0;
+  }
+  h->bytes = bytes;
+  h->metaOffset = metaOffset;
+  h->metaBytes = meta.size();
+  std::memcpy((char*) base + metaOffset, meta.data(), meta.size());
+  for (int32_t i = 0; i < kShmMatrices; i++) {
+    h->rows[i] = matrices[i] ? matrices[i]->m_ : -1;
+    h->cols[i] = matrices[i] ? matrices[i]->n_ : 0;
+    h->offsets[i] = offsets[i];
+    if (matrices[i]) {
+      std::memcpy((char*) base + offsets[i], matrices[i]->data_,
+                  matrices[i]->m_ * matrices[i]->n_ * sizeof(real));
+    }
+  }
+  h->ready.store(1, std::memory_order_release);
+  return std::unique_ptr<SharedStore>(new SharedStore(base, bytes));
+#else
+  std::cerr << "-shm is only available on POSIX systems!" << std::endl;
+  exit(EXIT_FAILURE);
+#endif
+}
+
+std::unique_ptr<SharedStore> SharedStore::attach(const std::string& name,
+                                                 bool readOnly,
+                                                 double timeout) {
+#ifndef _WIN32
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::duration<double>(timeout);
+  int fd = -1;
+  struct stat st;
+  // the creator may not have sized the segment yet
+  for (;;) {
+    if (fd < 0) {
+      fd = shm_open(segmentName(name).c_str(), readOnly ? O_RDONLY : O_RDWR, 0);
+    }
+    if (fd >= 0 && fstat(fd, &st) == 0 &&
+        st.st_size >= (off_t) sizeof(SharedHeader)) {
+      break;
+    }
+    if (std::chrono::steady_clock::now() >= deadline) {
+      if (fd >= 0) close(fd);
+      return nullptr;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  }
+  void* base = mmap(nullptr, st.st_size,
+                    readOnly ? PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED,
+                    fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    return nullptr;
+  }
+  std::unique_ptr<SharedStore> store(new SharedStore(base, st.st_size));
+  SharedHeader* h = store->header();
+  while (h->ready.load(std::memory_order_acquire) == 0) {
+    if (std::chrono::steady_clock::now() >= deadline) {
+      return nullptr;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  }
+  if (h->magic != kShmMagic || h->version != kShmVersion ||
+      h->bytes != st.st_size) {
+    std::cerr << name << " is not a segment of this version of multift!"
+              << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  return store;
+#else
+  return nullptr;
+#endif
+}
+
+void SharedStore::unlink(const std::string& name) {
+#ifndef _WIN32
+  shm_unlink(segmentName(name).c_str());
+#endif
+}
+
+uint64_t SharedStore::fingerprint() const {
+  return header()->fingerprint;
+}
+
+std::string SharedStore::meta() const {
+  SharedHeader* h = header();
+  return std::string((const char*) base_ + h->metaOffset, h->metaBytes);
+}
+
+bool SharedStore::sameShapes(
+    const std::vector<std::shared_ptr<Matrix>>& matrices) const {
+  SharedHeader* h = header();
+  for (int32_t i = 0; i < kShmMatrices; i++) {
+    int64_t rows = matrices[i] ? matrices[i]->m_ : -1;
+    int64_t cols = matrices[i] ? matrices[i]->n_ : 0;
+    if (h->rows[i] != rows || h->cols[i] != cols) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::vector<std::shared_ptr<Matrix>> SharedStore::matrices() const {
+  SharedHeader* h = header();
+  std::vector<std::shared_ptr<Matrix>> matrices(kShmMatrices);
+  for (int32_t i = 0; i < kShmMatrices; i++) {
+    if (h->rows[i] >= 0) {
+      matrices[i] = std::make_shared<Matrix>(
+          (real*) ((char*) base_ + h->offsets[i]), h->rows[i], h->cols[i]);
+    }
+  }
+  return matrices;
+}
+
+bool SharedStore::join(int32_t rank) {
+  if (rank >= header()->workers ||
+      header()->attached.fetch_add(1) >= header()->workers) {
+    return false;
+  }
+#ifndef _WIN32
+  slot(rank)->pid.store(getpid());
+#endif
+  return true;
+}
+
+void SharedStore::finish(int32_t rank) {
+  slot(rank)->finished.store(1);
+  header()->finished.fetch_add(1);
+}
+
+bool SharedStore::waitFinished(int32_t* missing) {
+#ifndef _WIN32
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::duration<double>(kShmJoinGrace);
+  while (header()->finished.load() < header()->workers) {
+    for (int32_t i = 0; i < header()->workers; i++) {
+      if (slot(i)->finished.load()) {
+        continue;
+      }
+      int32_t pid = slot(i)->pid.load();
+      bool gone = pid == 0 ? std::chrono::steady_clock::now() >= deadline
+                           : kill(pid, 0) != 0 && errno == ESRCH;
+      // it may have finished between the two loads
+      if (gone && !slot(i)->finished.load()) {
+        *missing = i;
+        return false;
+      }
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  }
+#endif
+  return true;
+}
+
+}
@@ -0,0 +1,72 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ *               2018-present, Ben Athiwaratkun
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#ifndef FASTTEXT_SHM_H
+#define FASTTEXT_SHM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "matrix.h"
+
+namespace fasttext {
+
+struct SharedHeader;
+struct SharedSlot;
+
+// -shm: the parameter matrices in a named POSIX shared memory segment
+// (/dev/shm/<name> on Linux), trained on Hogwild-style by the processes of
+// a run on one host and read by the snapshot command. The segment holds a
+// header describing its layout, the args and dictionary of the model, then
+// the matrices, each starting on a cache line.
+class SharedStore {
+  private:
+    void* base_;
+    size_t bytes_;
+
+    SharedStore(void*, size_t);
+    SharedHeader* header() const;
+    SharedSlot* slot(int32_t) const;
+
+  public:
+    ~SharedStore();
+
+    // the segment for these matrices (null ones absent), filled with them;
+    // nullptr when another process created it first
+    static std::unique_ptr<SharedStore> create(
+        const std::string&, const std::string&,
+        const std::vector<std::shared_ptr<Matrix>>&, uint64_t, int32_t);
+    // waits up to timeout seconds for the segment to be filled
+    static std::unique_ptr<SharedStore> attach(const std::string&, bool,
+                                               double);
+    static void unlink(const std::string&);
+
+    uint64_t fingerprint() const;
+    std::string meta() const;
+    bool sameShapes(const std::vector<std::shared_ptr<Matrix>>&) const;
+    // views on the rows of the segment, null for the absent matrices
+    std::vector<std::shared_ptr<Matrix>> matrices() const;
+
+    // the trainer of this rank joining the run; false when the segment
+    // already saw all the workers of its run, or was made for fewer, i.e.
+    // it is left over from an earlier one
+    bool join(int32_t);
+    void finish(int32_t);
+    // returns true once every worker has called finish(), false with the
+    // rank of a worker that exited without it or never joined at all
+    bool waitFinished(int32_t*);
+};
+
+}
+
+#endif
@@ -0,0 +1,581 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ *               2018-present, Ben Athiwaratkun
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#include "sync.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+#ifndef _WIN32
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace fasttext {
+
+static const int32_t kSyncMagic = 0x434e5953;
+static const int32_t kSyncVersion = 1;
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+SyncChannel::SyncChannel(int fd) : fd_(fd) {}
+
+SyncChannel::~SyncChannel() {
+#ifndef _WIN32
+  close(fd_);
+#endif
+}
+
+#ifndef _WIN32
+static void noDelay(int fd) {
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+#endif
+
+std::unique_ptr<SyncChannel> SyncChannel::connect(const std::string& address,
+                                                  double timeout) {
+#ifndef _WIN32
+  size_t colon = address.rfind(':');
+  if (colon == std::string::npos) {
+    return nullptr;
+  }
+  std::string host = address.substr(0, colon);
+  std::string port = address.substr(colon + 1);
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::duration<double>(timeout);
+  do {
+    struct addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* found = nullptr;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &found) == 0) {
+      for (struct addrinfo* a = found; a != nullptr; a = a->ai_next) {
+        int fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd < 0) continue;
+        if (::connect(fd, a->ai_addr, a->ai_addrlen) == 0) {
+          freeaddrinfo(found);
+          noDelay(fd);
+          return std::unique_ptr<SyncChannel>(new SyncChannel(fd));
+        }
+        close(fd);
+      }
+      freeaddrinfo(found);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  } while (std::chrono::steady_clock::now() < deadline);
+#endif
+  return nullptr;
+}
+
+int SyncChannel::listen(int32_t port) {
+#ifndef _WIN32
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+  if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0 ||
+      ::listen(fd, 64) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+#else
+  return -1;
+#endif
+}
+
+std::unique_ptr<SyncChannel> SyncChannel::accept(int listener) {
+#ifndef _WIN32
+  int fd = ::accept(listener, nullptr, nullptr);
+  if (fd >= 0) {
+    noDelay(fd);
+    return std::unique_ptr<SyncChannel>(new SyncChannel(fd));
+  }
+#endif
+  return nullptr;
+}
+
+void SyncChannel::stop(int listener) {
+#ifndef _WIN32
+  shutdown(listener, SHUT_RDWR);
+  close(listener);
+#endif
+}
+
+bool SyncChannel::send(const std::string& message) {
+#ifndef _WIN32
+  int64_t size = message.size();
+  std::string framed((char*) &size, sizeof(int64_t));
+  framed += message;
+  const char* p = framed.data();
+  size_t left = framed.size();
+  while (left > 0) {
+    ssize_t n = ::send(fd_, p, left, MSG_NOSIGNAL);
+    if (n <= 0) return false;
+    p += n;
+    left -= n;
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool SyncChannel::receive(std::string& message) {
+#ifndef _WIN32
+  auto readAll = [this](char* p, size_t left) {
+    while (left > 0) {
+      ssize_t n = recv(fd_, p, left, 0);
+      if (n <= 0) return false;
+      p += n;
+      left -= n;
+    }
+    return true;
+  };
+  int64_t size;
+  if (!readAll((char*) &size, sizeof(int64_t)) || size < 0) {
+    return false;
+  }
+  message.resize(size);
+  return readAll(&message[0], size);
+#else
+  return false;
+#endif
+}
+
+template <typename T>
+static void put(std::string& buf, const T& value) {
+  buf.append((const char*) &value, sizeof(T));
+}
+
+template <typename T>
+static bool get(const std::string& buf, size_t& pos, T* values, size_t n) {
+  if (pos + n * sizeof(T) > buf.size()) return false;
+  std::memcpy(values, buf.data() + pos, n * sizeof(T));
+  pos += n * sizeof(T);
+  return true;
+}
+
+// nsections, then per section the matrix, the row count, the row indices
+// and the rows.
+static void writeRows(std::string& buf, const std::vector<SyncRows>& rows) {
+  put<int32_t>(buf, rows.size());
+  for (auto it = rows.cbegin(); it != rows.cend(); ++it) {
+    put<int32_t>(buf, it->matrix);
+    put<int64_t>(buf, it->rows.size());
+    buf.append((const char*) it->rows.data(),
+               it->rows.size() * sizeof(int64_t));
+    buf.append((const char*) it->values.data(),
+               it->values.size() * sizeof(real));
+  }
+}
+
+static bool readRows(const std::string& buf, size_t& pos,
+                     const std::vector<int64_t>& cols,
+                     std::vector<SyncRows>& rows) {
+  int32_t n;
+  if (!get(buf, pos, &n, 1)) return false;
+  rows.resize(n);
+  for (int32_t i = 0; i < n; i++) {
+    int64_t count;
+    if (!get(buf, pos, &rows[i].matrix, 1) || !get(buf, pos, &count, 1) ||
+        rows[i].matrix < 0 || rows[i].matrix >= cols.size() || count < 0) {
+      return false;
+    }
+    rows[i].rows.resize(count);
+    rows[i].values.resize(count * cols[rows[i].matrix]);
+    if (!get(buf, pos, rows[i].rows.data(), count) ||
+        !get(buf, pos, rows[i].values.data(), rows[i].values.size())) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// magic, version, rank, workers, dictionary fingerprint and the shape of
+// every matrix, 0 x 0 for a missing one
+static std::string hello(int32_t rank, int32_t workers, uint64_t fingerprint,
+                         const std::vector<std::shared_ptr<Matrix>>& params) {
+  std::string buf;
+  put(buf, kSyncMagic);
+  put(buf, kSyncVersion);
+  put(buf, rank);
+  put(buf, workers);
+  put(buf, fingerprint);
+  put<int32_t>(buf, params.size());
+  for (auto it = params.cbegin(); it != params.cend(); ++it) {
+    put<int64_t>(buf, *it ? (*it)->m_ : 0);
+    put<int64_t>(buf, *it ? (*it)->n_ : 0);
+  }
+  return buf;
+}
+
+SyncCoordinator::SyncCoordinator(int32_t port, int32_t workers)
+  : workers_(workers), channels_(workers) {
+  int listener = SyncChannel::listen(port);
+  if (listener < 0) {
+    std::cerr << "Cannot listen on port " << port << "!" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  std::cerr << "Waiting for " << workers << " workers on port " << port
+            << std::endl;
+  for (int32_t i = 0; i < workers; i++) {
+    std::unique_ptr<SyncChannel> channel = SyncChannel::accept(listener);
+    std::string message;
+    int32_t header[4];
+    size_t pos = 0;
+    if (!channel || !channel->receive(message) ||
+        !get(message, pos, header, 4) || header[0] != kSyncMagic ||
+        header[1] != kSyncVersion) {
+      std::cerr << "A connection that is not a worker was dropped."
+                << std::endl;
+      i--;
+      continue;
+    }
+    int32_t rank = header[2];
+    if (header[3] != workers || rank < 0 || rank >= workers ||
+        channels_[rank]) {
+      std::cerr << "Worker " << rank << " of " << header[3]
+                << " does not fit a run of " << workers << " workers!"
+                << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    channels_[rank] = std::move(channel);
+    hellos_.push_back(std::make_pair(rank, message));
+  }
+#ifndef _WIN32
+  close(listener);
+#endif
+}
+
+// All the workers must have built the same dictionary and matrices; the
+// first agreed model is the one of worker 0.
+void SyncCoordinator::handshake() {
+  std::sort(hellos_.begin(), hellos_.end());
+  const std::string& first = hellos_[0].second;
+  size_t pos = 4 * sizeof(int32_t) + sizeof(uint64_t);
+  int32_t n;
+  get(first, pos, &n, 1);
+  size_t shapeEnd = pos + 2 * n * sizeof(int64_t);
+  bool same = first.size() >= shapeEnd;
+  for (int32_t i = 0; same && i < n; i++) {
+    int64_t shape[2];
+    get(first, pos, shape, 2);
+    rows_.push_back(shape[0]);
+    cols_.push_back(shape[1]);
+  }
+  for (int32_t r = 1; same && r < workers_; r++) {
+    const std::string& other = hellos_[r].second;
+    same = other.size() >= shapeEnd &&
+           std::memcmp(other.data() + 4 * sizeof(int32_t),
+                       first.data() + 4 * sizeof(int32_t),
+                       shapeEnd - 4 * sizeof(int32_t)) == 0;
+  }
+  std::vector<SyncRows> initial;
+  size_t rowsPos = shapeEnd;
+  same = same && readRows(first, rowsPos, cols_, initial);
+  std::string reply;
+  put<int32_t>(reply, same ? 0 : 1);
+  for (int32_t r = 0; r < workers_; r++) {
+    std::string message = reply;
+    if (same && r > 0) {
+      message.append(first, shapeEnd, std::string::npos);
+    } else {
+      writeRows(message, std::vector<SyncRows>());
+    }
+    channels_[r]->send(message);
+  }
+  hellos_.clear();
+  if (!same) {
+    std::cerr << "The workers did not build the same dictionary and "
+              << "matrices: check that they got the same -input and "
+              << "arguments." << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  touched_.resize(n);
+  sums_.resize(n);
+  slots_.resize(n);
+}
+
+// Sums the moves of every worker, then sends all of them the mean. Returns
+// true once every worker is done.
+bool SyncCoordinator::round(int64_t& rowsAveraged) {
+  int32_t done = 0;
+  for (int32_t r = 0; r < workers_; r++) {
+    std::string message;
+    std::vector<SyncRows> moved;
+    int32_t flag;
+    size_t pos = 0;
+    if (!channels_[r]->receive(message) || !get(message, pos, &flag, 1) ||
+        !readRows(message, pos, cols_, moved)) {
+      std::cerr << "Lost worker " << r << "!" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    done += flag;
+    for (auto it = moved.cbegin(); it != moved.cend(); ++it) {
+      int32_t m = it->matrix;
+      int64_t n = cols_[m];
+      for (size_t i = 0; i < it->rows.size(); i++) {
+        int64_t row = it->rows[i];
+        if (row < 0 || row >= rows_[m]) continue;
+        auto found = slots_[m].find(row);
+        int64_t slot;
+        if (found == slots_[m].end()) {
+          slot = touched_[m].size();
+          slots_[m][row] = slot;
+          touched_[m].push_back(row);
+          sums_[m].resize(sums_[m].size() + n, 0.0);
+        } else {
+          slot = found->second;
+        }
+        real* sum = sums_[m].data() + slot * n;
+        const real* value = it->values.data() + i * n;
+        for (int64_t j = 0; j < n; j++) {
+          sum[j] += value[j];
+        }
+      }
+    }
+  }
+  std::vector<SyncRows> mean;
+  for (int32_t m = 0; m < touched_.size(); m++) {
+    if (touched_[m].empty()) continue;
+    std::sort(touched_[m].begin(), touched_[m].end());
+    int64_t n = cols_[m];
+    SyncRows rows;
+    rows.matrix = m;
+    rows.rows.swap(touched_[m]);
+    rows.values.resize(rows.rows.size() * n);
+    for (size_t i = 0; i < rows.rows.size(); i++) {
+      const real* sum = sums_[m].data() + slots_[m][rows.rows[i]] * n;
+      for (int64_t j = 0; j < n; j++) {
+        rows.values[i * n + j] = sum[j] / workers_;
+      }
+    }
+    sums_[m].clear();
+    slots_[m].clear();
+    rowsAveraged += rows.rows.size();
+    mean.push_back(std::move(rows));
+  }
+  bool finished = done == workers_;
+  std::string reply;
+  put<int32_t>(reply, finished ? 1 : 0);
+  writeRows(reply, mean);
+  for (int32_t r = 0; r < workers_; r++) {
+    if (!channels_[r]->send(reply)) {
+      std::cerr << "Lost worker " << r << "!" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+  return finished;
+}
+
+void SyncCoordinator::run() {
+  handshake();
+  int64_t rounds = 0;
+  int64_t rowsAveraged = 0;
+  auto start = std::chrono::steady_clock::now();
+  do {
+    rounds++;
+  } while (!round(rowsAveraged));
+  std::chrono::duration<double> seconds =
+      std::chrono::steady_clock::now() - start;
+  std::cerr << "Averaged " << rowsAveraged << " rows in " << rounds
+            << " rounds over " << seconds.count() << "s" << std::endl;
+}
+
+ParameterSync::ParameterSync(std::shared_ptr<Args> args,
+                             const std::vector<std::shared_ptr<Matrix>>& params,
+                             uint64_t fingerprint)
+  : args_(args), params_(params), agreed_(params.size()), finished_(false),
+    rounds_(0), rowsSent_(0) {
+  channel_ = SyncChannel::connect(args_->coordinator, 60.0);
+  if (!channel_) {
+    std::cerr << "Cannot reach the coordinator at " << args_->coordinator
+              << "!" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  std::vector<int64_t> cols;
+  for (auto it = params_.cbegin(); it != params_.cend(); ++it) {
+    cols.push_back(*it ? (*it)->n_ : 0);
+  }
+  std::string message =
+      hello(args_->rank, args_->workers, fingerprint, params_);
+  std::vector<SyncRows> initial;
+  if (args_->rank == 0) {
+    for (int32_t k = 0; k < params_.size(); k++) {
+      if (!params_[k]) continue;
+      SyncRows rows;
+      rows.matrix = k;
+      rows.rows.resize(params_[k]->m_);
+      for (int64_t i = 0; i < params_[k]->m_; i++) {
+        rows.rows[i] = i;
+      }
+      rows.values.assign(params_[k]->data_,
+                         params_[k]->data_ + params_[k]->m_ * params_[k]->n_);
+      initial.push_back(std::move(rows));
+    }
+  }
+  writeRows(message, initial);
+  initial.clear();
+  std::string reply;
+  int32_t status;
+  size_t pos = 0;
+  if (!channel_->send(message) || !channel_->receive(reply) ||
+      !get(reply, pos, &status, 1) || !readRows(reply, pos, cols, initial)) {
+    std::cerr << "Lost the coordinator!" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (status != 0) {
+    std::cerr << "The workers did not build the same dictionary and "
+              << "matrices!" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  adopt(initial);
+  for (int32_t k = 0; k < params_.size(); k++) {
+    if (!params_[k]) continue;
+    agreed_[k].reset(new Matrix(*params_[k]));
+    if (!args_->syncDense) {
+      params_[k]->trackDirty();
+      params_[k]->clearDirty();
+    }
+  }
+}
+
+void ParameterSync::adopt(const std::vector<SyncRows>& rows) {
+  for (auto it = rows.cbegin(); it != rows.cend(); ++it) {
+    Matrix& live = *params_[it->matrix];
+    for (size_t i = 0; i < it->rows.size(); i++) {
+      std::copy(it->values.data() + i * live.n_,
+                it->values.data() + (i + 1) * live.n_,
+                live.data_ + it->rows[i] * live.n_);
+    }
+  }
+}
+
+// done tells the coordinator that this worker has stopped training; the
+// rounds go on until every worker is done.
+void ParameterSync::exchange(bool done) {
+  std::vector<SyncRows> moved;
+  std::vector<int32_t> section(params_.size(), -1);
+  for (int32_t k = 0; k < params_.size(); k++) {
+    if (!params_[k]) continue;
+    const Matrix& live = *params_[k];
+    const Matrix& agreed = *agreed_[k];
+    int64_t n = live.n_;
+    SyncRows rows;
+    rows.matrix = k;
+    if (args_->syncDense) {
+      rows.rows.resize(live.m_);
+      for (int64_t i = 0; i < live.m_; i++) {
+        rows.rows[i] = i;
+      }
+    } else {
+      rows.rows = params_[k]->takeDirty();
+    }
+    if (rows.rows.empty()) continue;
+    rows.values.resize(rows.rows.size() * n);
+    for (size_t i = 0; i < rows.rows.size(); i++) {
+      const real* x = live.data_ + rows.rows[i] * n;
+      const real* base = agreed.data_ + rows.rows[i] * n;
+      for (int64_t j = 0; j < n; j++) {
+        rows.values[i * n + j] = x[j] - base[j];
+      }
+    }
+    rowsSent_ += rows.rows.size();
+    section[k] = moved.size();
+    moved.push_back(std::move(rows));
+  }
+
+  std::string message;
+  put<int32_t>(message, done ? 1 : 0);
+  writeRows(message, moved);
+  std::vector<int64_t> cols;
+  for (auto it = params_.cbegin(); it != params_.cend(); ++it) {
+    cols.push_back(*it ? (*it)->n_ : 0);
+  }
+  std::string reply;
+  std::vector<SyncRows> mean;
+  int32_t finished;
+  size_t pos = 0;
+  if (!channel_->send(message) || !channel_->receive(reply) ||
+      !get(reply, pos, &finished, 1) || !readRows(reply, pos, cols, mean)) {
+    std::cerr << "Lost the coordinator!" << std::endl;
+    exit(EXIT_FAILURE);
+  }
+
+  // both row lists are sorted, so the own move of each row is found by
+  // walking them together
+  for (auto it = mean.cbegin(); it != mean.cend(); ++it) {
+    Matrix& live = *params_[it->matrix];
+    Matrix& agreed = *agreed_[it->matrix];
+    int64_t n = live.n_;
+    const SyncRows* own =
+        section[it->matrix] >= 0 ? &moved[section[it->matrix]] : nullptr;
+    size_t o = 0;
+    for (size_t i = 0; i < it->rows.size(); i++) {
+      int64_t row = it->rows[i];
+      while (own && o < own->rows.size() && own->rows[o] < row) o++;
+      const real* mine = own && o < own->rows.size() && own->rows[o] == row
+                             ? own->values.data() + o * n
+                             : nullptr;
+      const real* step = it->values.data() + i * n;
+      real* x = live.data_ + row * n;
+      real* base = agreed.data_ + row * n;
+      for (int64_t j = 0; j < n; j++) {
+        x[j] += step[j] - (mine ? mine[j] : 0.0);
+        base[j] += step[j];
+      }
+    }
+  }
+  rounds_++;
+  finished_ = finished != 0;
+  // nothing is left to send, and the agreed rows are the exact mean where
+  // the live ones may differ by rounding
+  if (finished_) {
+    for (int32_t k = 0; k < params_.size(); k++) {
+      if (!params_[k]) continue;
+      Matrix& live = *params_[k];
+      std::copy(agreed_[k]->data_, agreed_[k]->data_ + live.m_ * live.n_,
+                live.data_);
+      agreed_[k].reset();
+    }
+  }
+}
+
+bool ParameterSync::finished() const {
+  return finished_;
+}
+
+int64_t ParameterSync::rounds() const {
+  return rounds_;
+}
+
+int64_t ParameterSync::rowsSent() const {
+  return rowsSent_;
+}
+
+}
@@ -0,0 +1,113 @@
+/**
+ * Copyright (c) 2016-present, Facebook, Inc.
+ *               2018-present, Ben Athiwaratkun
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree. An additional grant
+ * of patent rights can be found in the PATENTS file in the same directory.
+ */
+
+#ifndef FASTTEXT_SYNC_H
+#define FASTTEXT_SYNC_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "args.h"
+#include "matrix.h"
+#include "real.h"
+
+namespace fasttext {
+
+// A TCP connection carrying length-prefixed messages. Only available on
+// POSIX systems.
+class SyncChannel {
+  private:
+    int fd_;
+
+  public:
+    explicit SyncChannel(int);
+    ~SyncChannel();
+
+    // host:port, retried until the coordinator listens or timeout seconds
+    static std::unique_ptr<SyncChannel> connect(const std::string&, double);
+    static int listen(int32_t);
+    static std::unique_ptr<SyncChannel> accept(int);
+    // wakes a blocked accept() on the listener and closes it
+    static void stop(int);
+
+    bool send(const std::string&);
+    bool receive(std::string&);
+};
+
+// Rows of one parameter matrix, values holding rows.size() * cols reals.
+struct SyncRows {
+  int32_t matrix;
+  std::vector<int64_t> rows;
+  std::vector<real> values;
+};
+
+// The coordinator of a -workers run. Each round it takes from every worker
+// the rows it moved since the last agreed model and answers all of them
+// with the mean move, a row moved by some workers only counting zero for
+// the others. The first round hands the parameters of worker 0 to the
+// others; the last is the one all the workers mark as done.
+class SyncCoordinator {
+  private:
+    int32_t workers_;
+    std::vector<std::unique_ptr<SyncChannel>> channels_;
+    // the first message of every worker, by rank
+    std::vector<std::pair<int32_t, std::string>> hellos_;
+    // shape of every matrix, and the moves summed in the current round:
+    // the rows sent, their sums one after the other, and where the sum of
+    // each row is, so that only the rows of the round take memory
+    std::vector<int64_t> rows_;
+    std::vector<int64_t> cols_;
+    std::vector<std::vector<int64_t>> touched_;
+    std::vector<std::vector<real>> sums_;
+    std::vector<std::unordered_map<int64_t, int64_t>> slots_;
+
+    void handshake();
+    bool round(int64_t&);
+
+  public:
+    SyncCoordinator(int32_t, int32_t);
+
+    void run();
+};
+
+// The worker side: keeps the last agreed value of every row, sends how far
+// the rows written since have moved (all the rows with -syncDense), and
+// adds the mean move minus its own to the live rows. The training
+// threads go on writing meanwhile, so their updates made during a round
+// are kept for the next one.
+class ParameterSync {
+  private:
+    std::shared_ptr<Args> args_;
+    std::vector<std::shared_ptr<Matrix>> params_;
+    std::vector<std::unique_ptr<Matrix>> agreed_;
+    std::unique_ptr<SyncChannel> channel_;
+    bool finished_;
+    int64_t rounds_;
+    int64_t rowsSent_;
+
+    void adopt(const std::vector<SyncRows>&);
+
+  public:
+    ParameterSync(std::shared_ptr<Args>,
+                  const std::vector<std::shared_ptr<Matrix>>&, uint64_t);
+
+    void exchange(bool);
+    bool finished() const;
+    int64_t rounds() const;
+    int64_t rowsSent() const;
+};
+
+}
+
+#endif
@@ -10,7 +10,24 @@
 #include<cstdint>
 #include "utils.h"
 
+#include <algorithm>
+#include <iostream>
 #include <ios>
+#include <sstream>
+#include <string>
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <glob.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 namespace fasttext {
 
@@ -25,6 +42,152 @@ namespace utils {
     ifs.clear();
     ifs.seekg(std::streampos(pos));
   }
+
+  // Parses a sysfs cpulist such as "0-3,8-11".
+  static std::vector<int32_t> parseCpuList(const std::string& list) {
+    std::vector<int32_t> cpus;
+    std::stringstream ss(list);
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+      if (range.empty() || range == "\n") continue;
+      size_t dash = range.find('-');
+      int32_t lo = std::stoi(range.substr(0, dash));
+      int32_t hi = dash == std::string::npos ? lo : std::stoi(range.substr(dash + 1));
+      for (int32_t c = lo; c <= hi; c++) {
+        cpus.push_back(c);
+      }
+    }
+    return cpus;
+  }
+
+  std::vector<std::vector<int32_t>> numaNodeCpus() {
+    std::vector<std::vector<int32_t>> nodes;
+    for (int32_t n = 0; ; n++) {
+      std::ifstream ifs("/sys/devices/system/node/node" + std::to_string(n) + "/cpulist");
+      if (!ifs.is_open()) break;
+      std::string list;
+      std::getline(ifs, list);
+      // memory-only nodes keep their slot so indices match node ids
+      nodes.push_back(parseCpuList(list));
+    }
+    if (nodes.empty()) {
+      nodes.push_back(std::vector<int32_t>());
+    }
+    return nodes;
+  }
+
+  bool bindToCpus(const std::vector<int32_t>& cpus) {
+#ifdef __linux__
+    if (cpus.empty()) return false;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto it = cpus.cbegin(); it != cpus.cend(); ++it) {
+      CPU_SET(*it, &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+  }
+
+  // Interleaves the pages this thread (and threads it starts) allocates
+  // across the first n nodes, n <= 1 restores the default local policy.
+  bool setInterleave(int32_t n) {
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+    const int kMpolDefault = 0;
+    const int kMpolInterleave = 3;
+    if (n <= 1) {
+      return syscall(SYS_set_mempolicy, kMpolDefault, nullptr, 0) == 0;
+    }
+    std::vector<unsigned long> mask((n + 8 * sizeof(unsigned long) - 1) /
+                                    (8 * sizeof(unsigned long)), 0);
+    for (int32_t i = 0; i < n; i++) {
+      mask[i / (8 * sizeof(unsigned long))] |= 1UL << (i % (8 * sizeof(unsigned long)));
+    }
+    return syscall(SYS_set_mempolicy, kMpolInterleave, mask.data(),
+                   mask.size() * 8 * sizeof(unsigned long) + 1) == 0;
+#else
+    return false;
+#endif
+  }
+
+#ifndef _WIN32
+  static bool isDirectory(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+  }
+
+  // Files below dir in name order, hidden entries skipped.
+  static void listFiles(const std::string& dir,
+                        std::vector<std::string>& files) {
+    DIR* d = opendir(dir.c_str());
+    if (d == nullptr) return;
+    std::vector<std::string> names;
+    while (struct dirent* e = readdir(d)) {
+      if (e->d_name[0] != '.') names.push_back(e->d_name);
+    }
+    closedir(d);
+    std::sort(names.begin(), names.end());
+    for (auto it = names.cbegin(); it != names.cend(); ++it) {
+      std::string path = dir + "/" + *it;
+      if (isDirectory(path)) {
+        listFiles(path, files);
+      } else {
+        files.push_back(path);
+      }
+    }
+  }
+#endif
+
+  static void expandPath(const std::string& input,
+                         std::vector<std::string>& files) {
+    if (!input.empty() && input[0] == '@') {
+      std::ifstream ifs(input.substr(1));
+      if (!ifs.is_open()) {
+        std::cerr << "Input list " << input.substr(1) << " cannot be opened!"
+                  << std::endl;
+        exit(EXIT_FAILURE);
+      }
+      std::string line;
+      while (std::getline(ifs, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty() || line[0] == '#') continue;
+        expandPath(line, files);
+      }
+      return;
+    }
+#ifndef _WIN32
+    if (isDirectory(input)) {
+      listFiles(input, files);
+      return;
+    }
+    if (input.find_first_of("*?[") != std::string::npos) {
+      glob_t g;
+      if (glob(input.c_str(), 0, nullptr, &g) == 0) {
+        for (size_t i = 0; i < g.gl_pathc; i++) {
+          if (isDirectory(g.gl_pathv[i])) {
+            listFiles(g.gl_pathv[i], files);
+          } else {
+            files.push_back(g.gl_pathv[i]);
+          }
+        }
+      }
+      globfree(&g);
+      return;
+    }
+#endif
+    files.push_back(input);
+  }
+
+  std::vector<std::string> expandPaths(const std::string& input) {
+    std::vector<std::string> files;
+    expandPath(input, files);
+    if (files.empty()) {
+      std::cerr << "No input files match " << input << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    return files;
+  }
 }
 
 }
@@ -11,14 +11,36 @@
 #ifndef FASTTEXT_UTILS_H
 #define FASTTEXT_UTILS_H
 
+#include <cstdint>
 #include <fstream>
+#include <string>
+#include <vector>
 
 namespace fasttext {
 
 namespace utils {
 
+  // splitmix64 finalizer: spreads the bits of x evenly over the result
+  inline uint64_t mix64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+  }
+
   int64_t size(std::ifstream&);
   void seek(std::ifstream&, int64_t);
+
+  // NUMA helpers, read from sysfs and raw syscalls so no libnuma is needed.
+  // On non-Linux systems there is a single node and binding is a no-op.
+  std::vector<std::vector<int32_t>> numaNodeCpus();
+  bool bindToCpus(const std::vector<int32_t>&);
+  bool setInterleave(int32_t);
+
+  // Files named by an -input value: the files under a directory, the
+  // matches of a glob, the entries of an @list file, or the path itself.
+  // Directories and globs are sorted so that the order is reproducible.
+  std::vector<std::string> expandPaths(const std::string&);
 }
 
 }
@@ -119,17 +119,13 @@ void Vector::addRow(const QMatrix& A, int64_t i) {
 void Vector::mul(const Matrix& A, const Vector& vec) {
   assert(A.m_ == m_);
   assert(A.n_ == vec.m_);
-  for (int64_t i = 0; i < m_; i++) {
-    data_[i] = A.dotRow(vec, i);
-  }
+  A.dotRows(vec, data_);
 }
 
 void Vector::mul(const QMatrix& A, const Vector& vec) {
   assert(A.getM() == m_);
   assert(A.getN() == vec.m_);
-  for (int64_t i = 0; i < m_; i++) {
-    data_[i] = A.dotRow(vec, i);
-  }
+  A.dotRows(vec, data_);
 }
 
 int64_t Vector::argmax() {